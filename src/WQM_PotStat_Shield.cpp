@@ -2,6 +2,11 @@
 #include <Arduino.h>
 #include <Wire.h>
 #include <SoftwareSerial.h> // for BlueTooth
+#include <EEPROM.h> // for calibration table
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include <avr/sleep.h>
+#include <avr/power.h>
 #include "Adafruit_ADS1015.h"
 
 //Project files
@@ -27,10 +32,27 @@
    6: RG = 4M, PGA = 4X, 250nA
    7: RG = 4M, PGA = 16X, 63nA
 
-   %E:# = Experiment (1 or 2), 1 = CSV/LSV 2 = DPV (only CSV currently configured)
+   %E:# = Experiment (1, 2 or 3), 1 = CSV/LSV 2 = DPV 3 = EIS
 
    %EP:#,#,...#, = Experiment parameters, varies by selected experiment
 
+   %SM:# = Sample stream mode (optional), 0 = standard raw, 1 = comma separated, 2 = delta compressed
+   %BD:# = Bluetooth link decimation (optional, DUAL_LINK_EN), 0 = off, N = average of N samples sent
+   %CA:# = Co-add cycles (optional, CSV, COADD_EN), 1 = samples averaged over all cycles per potential
+           bin (COADD_BIN_MV wide, max COADD_BINS per scan direction), only the averaged voltammogram is
+           sent at the end, bins that reached COADD_N_MAX samples are reported
+   %BG:# = Background (optional, COADD_EN), 1 = run is a blank, binned reference stored in EEPROM,
+           2 = stored blank subtracted from each sample (same waveform and gain as the blank required)
+   %RU:# = iR compensation (optional, IRCOMP_EN), Ru (ohm), i * Ru of the latest sample added to the
+           output, 0 = off, -1 = Ru measured by current interrupt (potential step) before the start and
+           IR_COMP_PCT % of it compensated, not with %CA / %BG, sample DAC codes include the correction,
+           age of the compensated current (conversion start to DAC write) reported at the end, warning
+           when older than the measured cell time constant
+   %SS:#,#,...#,% = Scan-rate series (optional, CSV), up to SERIES_MAX slopes (mV/s) replacing P7, run back
+           to back with P8 scans each after one cleaning / deposition, %SR:# is the sample rate of the
+           1st slope and is scaled with the slope (constant points per mV), each segment is tagged by
+           info messages (segment, slope) in the stream, not with %CA / %BG
+
    CSV:
    P0 = Cleaning time
    P1 = Cleaning potential
@@ -53,6 +75,58 @@
    P7 = Pulse Amplitude, mV
    P8 = Pulse Width
    P9 = Pulse Period
+
+   EIS (impedance, sine around DC potential, only results are sent, one line per frequency point:
+   "F,f (mHz),|Z| (ohm),phase (0.1 deg)", %SR:# must be above twice the highest frequency):
+   P0 = Cleaning time
+   P1 = Cleaning potential
+   P2 = Deposition time
+   P3 = Deposition potential
+   P4 = DC potential (mV)
+   P5 = Amplitude (mV)
+   P6 = Start frequency (mHz)
+   P7 = Stop frequency (mHz)
+   P8 = Points per decade (log spaced)
+   P9 = Periods measured per point (one more period is applied first for settling)
+
+   Commands are accepted at any time (non-blocking), one frame '<' ... '/>':
+   R  = Run experiment (see above), stops a running WQM experiment first
+        rejected if the planner (planExperiment()) finds it exceeds the CPU or link budget
+   D  = Dry run, same parameters as R, reports the plan (duration, samples, bytes, CPU and link load)
+   V  = Verify, same parameters as R, waveform generated on a virtual clock (no DAC/ADC, faster than
+        real time), reports DAC update and sample counts and CRC16 (xmodem) of the DAC codes of each,
+        optional %VP:1% also sends every sample point as text line "V,tick,dacOut" (tick in us),
+        runs in the background, R / C / D / V / U are rejected as busy until the results are sent, X aborts
+   C  = Calibrate (see below)
+   W  = Start WQM experiment, optional fields: %RM:# = report mode (0 = every sample, 1 = on change),
+        %HB:# = heartbeat, max. time without report (s), %LI:# = log interval (s), e.g. <W%RM:1%HB:300%/>
+   L  = Dump WQM log (records stored in EEPROM while the host link was down), oldest first:
+        'L' n(2) n * [seq tMin(2) temp(2) pH(2) cl(2)] CR, records are marked sent afterwards
+   X  = Abort experiment, DAC returned to DACVAL0
+   P  = Pause experiment, waveform phase preserved
+   G  = Resume paused experiment
+   B  = Profiler report (PROF_EN), JSON line with call count and min/max/mean execution time (us)
+        of each hot path since the last report, counters are reset
+   Q  = Status query, reply: 'Q' expStarted paused currInterval currCycle(2) cycles(2) tExp(6, us) CR
+   U  = Live parameter update, optional fields, applied at the next cycle boundary (PotStat) or
+        Cl switch period (WQM) and acknowledged with the cycle index, e.g. <U%G:3%SR:60%/>
+        %G:# = Gain, %SR:# = Sample rate, %CN:# = Cl switch on time (ms), %CM:# = Cl measure time (ms)
+        a new sample rate of a running experiment is rejected if the planner finds it exceeds the budget
+        in a scan-rate series an update takes effect by the next segment at the latest, whose rate
+        replaces the %SR of the update
+   With more than one potentiostat channel (PS_CHANNELS) every sample frame (and retransmission) is
+   preceded by the channel tag 'N' ch (packed stream: first record in the frame), CSV stream lines get
+   the channel as last field.
+
+   Single chars: '!' = handshake (reply 'C', host link up, pending log records reported),
+   '?' = start WQM, 'x' = abort, '#' seq = retransmit sample
+
+   Calibration command example:
+   <C%R:10000%/>
+
+   'C' = Calibrate current measurement for all gain settings of every channel, results stored in EEPROM
+   %R:# = Calibration resistor connected between WE and CE/RE (of each channel), ohm
+          0 = no resistor connected, only the zero current offsets are measured
 */
 
 /* IO
@@ -88,6 +162,19 @@
 //Board Vars
 boolean WQM_Present = false; //WQM Shield Present
 boolean PS_Present = false; //PotStat Shield Present
+boolean calStored = false; //Current calibration loaded from EEPROM
+
+//Boot / BLE link bring-up
+byte bootState = BOOT_POWERUP;
+unsigned long bleBaud = BLE_BAUD_DEFAULT; //current hardware serial baud rate
+unsigned long tBle = 0; //time last AT command sent / state entered (ms)
+byte ledToggles = 0; //LED toggles left of non-blocking flash (startFlash())
+unsigned int ledFlashMs = 0; //on/off time (ms)
+unsigned long tLed = 0; //time of last toggle (ms)
+byte bleTries = 0; //attempts of current AT command
+char bleRx[BLE_RX_LEN]; //AT response
+byte nBleRx = 0;
+unsigned long tFirstSample = 0; //time of first measurement since reset (ms), 0 = none yet
 
 //unsigned long tScratch2 = 0;
 
@@ -97,7 +184,50 @@ boolean PS_Present = false; //PotStat Shield Present
 // GND  <-->  GND
 // TxD  <-->  pin D2
 // RxD  <-->  pin D3
-SoftwareSerial Serial_BT(3,2);
+//only with DUAL_LINK_EN: the object links in SoftwareSerial's rx buffer and pin change ISRs
+#if DUAL_LINK_EN
+SoftwareSerial Serial_BT(2,3);
+#endif
+
+//Output queue for a link without transmit buffer (Serial_BT)
+class LinkQueue : public Print {
+  public:
+    unsigned int dropped = 0; //bytes dropped, queue full
+    size_t write(uint8_t b) {
+      byte next = (head + 1) & (BT_QUEUE_LEN - 1);
+      if (next == tail) {
+        dropped++;
+        return 0;
+      }
+      buf[head] = b;
+      head = next;
+      return 1;
+    }
+    boolean available() {
+      return head != tail;
+    }
+    uint8_t read() {
+      uint8_t b = buf[tail];
+      tail = (tail + 1) & (BT_QUEUE_LEN - 1);
+      return b;
+    }
+  private:
+    uint8_t buf[BT_QUEUE_LEN];
+    byte head = 0;
+    byte tail = 0;
+};
+
+LinkQueue btOut; //decimated stream for Serial_BT
+byte btDecim = BT_DECIM; //samples per decimated sample, 0 = off
+byte btCount = 0; //samples accumulated
+long btAdcSum = 0;
+unsigned long btSlotMax = 0; //longest transmit slot (us)
+
+//Idle sleep statistics (IDLE_SLEEP_EN)
+volatile unsigned long tEvent = 0; //time of last timer event (us), set in ISR
+uint64_t tIdleStart = 0; //start of statistics period (us, microsExt())
+uint64_t tSleepAcc = 0; //time spent asleep (us)
+unsigned long tWakeMax = 0; //max. time from timer event to handling in loop() (us)
 
 // WQM Variables
 Adafruit_ADS1115 WQM_adc1(0x48);
@@ -105,16 +235,65 @@ Adafruit_ADS1115 WQM_adc2(0x49);
 
 bool ClSwState = false;
 
-float voltage_pH = 0.0; //Voltage in mV
-float current_Cl = 0.0; //Current in nA
-float temperature = 0.0; //Temperature in deg. C
-float V_temp = 0.0; //Voltage for temperature calculation
-float voltage_alkalinity = 0.0; //Voltage for alkalinity calculation
+long voltage_pH = 0; //Voltage in uV
+long current_Cl = 0; //Current in pA
+int temperature = 2500; //Temperature in 0.01 deg. C
+long V_temp = 0; //Voltage for temperature calculation, uV
+long voltage_alkalinity = 0; //Voltage for alkalinity calculation, uV
+int pH = PH_ISO; //Temperature compensated pH, 0.001 pH
+unsigned long tSampleWQM = 0; //device time of WQM sample (ms since reset)
+
+//WQM report on change (WQM_REPORT_CHANGE)
+//deadband per channel, same units/order as sendValues(): uV, uV, pA, uV, 0.01 deg. C, 0.001 pH
+const long WQM_DEADBAND[WQM_NCH] PROGMEM = {1000, 1000, 25000, 1000, 10, 10};
+byte wqmReportMode = WQM_REPORT_ALL;
+unsigned int wqmHeartbeat = WQM_HEARTBEAT; //s
+long wqmLast[WQM_NCH]; //values at last report
+long wqmMin[WQM_NCH];
+long wqmMax[WQM_NCH];
+int64_t wqmSum[WQM_NCH];
+unsigned int wqmN = 0; //samples since last report
+boolean wqmReported = false; //first sample of an experiment is always reported
+boolean wqmLastSw = false; //Cl switch state at last report
+unsigned long tReport = 0; //time of last report (ms)
+
+//WQM log record, LOG_SLOTS ring in EEPROM at LOG_EE_ADDR
+//every slot is written once per lap (wear levelling), the newest record is found at boot from seq
+struct LogRec {
+  uint8_t seq;     //record counter, 0..0XFE, 0XFF = slot never written
+  uint8_t status;  //LOG_PENDING / LOG_DRAINED
+  uint16_t tMin;   //device time (min since reset)
+  int16_t temp;    //temperature (0.01 deg. C)
+  int16_t pH;      //pH (0.001)
+  int16_t cl;      //free Cl current (10 nA)
+};
+
+boolean linkUp = false; //host connected (handshake), cleared by BLE module "+LOST" notification
+byte logHead = 0; //next slot written
+byte logSeq = 0; //seq of next record
+byte logPending = 0; //records not yet sent to host
+unsigned int logInterval = LOG_INTERVAL; //s
+unsigned long tLog = 0; //start of log interval (ms)
+long logSum[3]; //temperature, pH, Cl current (10 nA) sums
+unsigned int logN = 0;
+byte iLost = 0; //match position in "+LOST"
+
+/* Thermistor linearisation table: temperature (0.01 deg. C) at ADC code i * 2^TEMP_LUT_SHIFT
+   (WQM_adc2 diff 0-1, PGA 4X), linear interpolation between entries.
+   Generated for a 10k NTC (B = 3950) with a 100k bias resistor from 3.3 V, clamped to -20..150 deg. C
+*/
+const int16_t TEMP_LUT[33] PROGMEM = {
+  15000, 8841, 6655, 5484, 4692, 4099, 3625, 3231, 2895, 2601, 2341,
+  2106, 1893, 1698, 1517, 1349, 1192, 1044, 905, 773, 647, 527,
+  412, 302, 196, 94, -5, -101, -193, -283, -371, -456, -539
+};
 
 //Current time in seconds since start of free Cl measurement collection (milliseconds)
 long switchTimeACC = 0;
-//Total time of on and off phases
-long switchTimePRE = CL_SW_ON_TIME + CL_MEASURE_TIME;
+//Start of current on/off switch period (us, low 32 bits of microsExt())
+unsigned long tSwitchStart = 0;
+//Number of completed on/off switch periods
+int switchCycle = 0;
 
 int16_t WQM_adc1_diff_0_1;  // pin0 - pin1, raw ADC val
 int16_t WQM_adc1_diff_2_3;  // pin2 - pin3, raw ADC val
@@ -123,28 +302,173 @@ int16_t WQM_adc2_diff_2_3;  // pin0 - pin1, raw ADC val
 
 //end WQM vars
 
+//Potentiostat channel descriptor, PS_CHANNELS entries in PS_CH[]
+struct PsChannel {
+  uint8_t dac;  //MAX5217 address
+  uint8_t adc;  //ADS1115 address
+  uint8_t mux0; //gain select multiplexer pins
+  uint8_t mux1;
+};
+const PsChannel PS_CH[PS_CHANNELS] PROGMEM = {
+  {PS_DAC_ADDR, PS_ADC_ADDR, PS_MUX0, PS_MUX1},
+#if PS_CHANNELS > 1
+  {0x1D, 0x4A, 2, 3}, //2nd shield: DAC ADDR pin high, ADS1115 ADDR to SDA, gain mux on D2/D3 (not with DUAL_LINK_EN)
+#endif
+};
+
+//ADS1115 retargeted to the address of the selected channel (selectChannel())
+class ChannelADC : public Adafruit_ADS1115 {
+  public:
+    ChannelADC(uint8_t i2cAddress) : Adafruit_ADS1115(i2cAddress) {}
+    void setAddress(uint8_t i2cAddress) {
+      m_i2cAddress = i2cAddress;
+    }
+    uint8_t address() {
+      return m_i2cAddress;
+    }
+    //Single-shot conversion AIN0 - AIN1 started without the library conversion delay,
+    //result by readConversion() PLAN_ADC_US later (stale result read back by the library dropped)
+    void startDifferential_0_1() {
+      uint8_t d = m_conversionDelay;
+      m_conversionDelay = 0;
+      readADC_Differential_0_1();
+      m_conversionDelay = d;
+    }
+    int16_t readConversion() {
+      uint8_t d = m_conversionDelay;
+      m_conversionDelay = 0;
+      int16_t r = getLastConversionResults();
+      m_conversionDelay = d;
+      return r;
+    }
+};
+
 // PS ADC declaration
-Adafruit_ADS1115 PS_adc1(0x4B);
+ChannelADC PS_adc1(PS_ADC_ADDR);
+byte psChannels = 1; //channels present (initChannels())
+byte psCh = 0; //channel of next / current sample
 
 int16_t PS_adc1_diff_0_1;  // pin0 - pin1, raw ADC val
 int16_t PS_adc1_diff_2_3;  // pin2 - pin3, raw ADC val
 
-//Number of parameters required per experiment, index 0 = null/not used, index 1 = CSV/LSV, index 2 = DPV
-const int PARAMS_REQD[3] = {0, 9, 10};
-//Experiment parameter limits: [Experiment][Parameter][Max/Min]
-const long EXP_LIMITS[3][10][2] =  {
+//Number of parameters required per experiment, index 0 = null/not used, index 1 = CSV/LSV, index 2 = DPV, index 3 = EIS
+const int PARAMS_REQD[4] = {0, 9, 10, 10};
+//Experiment parameter limits: [Experiment][Parameter][Max/Min], in flash (expLimit())
+const int32_t EXP_LIMITS[4][10][2] PROGMEM = {
   {{0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}}, //null experiment / not used
   {{LIMS_CLEANT}, {LIMS_CLEANV}, {LIMS_CLEANT}, {LIMS_CLEANV}, {LIMS_CSV0}, {LIMS_CSV1}, {LIMS_CSV2}, {LIMS_CSV3}, {LIMS_CSV4}, {LIMS_CSV5}}, //CSV limits
-  {{LIMS_CLEANT}, {LIMS_CLEANV}, {LIMS_CLEANT}, {LIMS_CLEANV}, {LIMS_DPV0}, {LIMS_DPV1}, {LIMS_DPV2}, {LIMS_DPV3}, {LIMS_DPV4}, {LIMS_DPV5}}  //DPV limits
+  {{LIMS_CLEANT}, {LIMS_CLEANV}, {LIMS_CLEANT}, {LIMS_CLEANV}, {LIMS_DPV0}, {LIMS_DPV1}, {LIMS_DPV2}, {LIMS_DPV3}, {LIMS_DPV4}, {LIMS_DPV5}}, //DPV limits
+  {{LIMS_CLEANT}, {LIMS_CLEANV}, {LIMS_CLEANT}, {LIMS_CLEANV}, {LIMS_EIS0}, {LIMS_EIS1}, {LIMS_EIS2}, {LIMS_EIS3}, {LIMS_EIS4}, {LIMS_EIS5}}  //EIS limits
+};
+
+//Quarter sine wave, sin(i * pi / 128) in Q15, for DDS (sinQ15())
+const int16_t SINE_Q15[65] PROGMEM = {
+  0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+  12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530, 18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+  23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+  30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+  32767
 };
 
+//Message catalog text, indexed by MSG_ codes (header)
+const char MSG_TXT0[] PROGMEM = "DAC out of range";
+const char MSG_TXT1[] PROGMEM = "Could not parse command / command invalid";
+const char MSG_TXT2[] PROGMEM = "Command not recognized";
+const char MSG_TXT3[] PROGMEM = "Command not received";
+const char MSG_TXT4[] PROGMEM = "Received command not valid";
+const char MSG_TXT5[] PROGMEM = "Sample Rate out of range";
+const char MSG_TXT6[] PROGMEM = "Gain out of range";
+const char MSG_TXT7[] PROGMEM = "Selected experiment invalid/not supported";
+const char MSG_TXT8[] PROGMEM = "Parameter out of range (below min)";
+const char MSG_TXT9[] PROGMEM = "Parameter out of range (above max)";
+const char MSG_TXT10[] PROGMEM = "Calibration resistor out of range";
+const char MSG_TXT11[] PROGMEM = "Calibration not possible, no PotStat board or experiment running";
+const char MSG_TXT12[] PROGMEM = "PotStat Setup complete";
+const char MSG_TXT13[] PROGMEM = "No PotStat board detected";
+const char MSG_TXT14[] PROGMEM = "WQM Setup complete";
+const char MSG_TXT15[] PROGMEM = "No WQM board detected";
+const char MSG_TXT16[] PROGMEM = "Starting Experiment";
+const char MSG_TXT17[] PROGMEM = "Experiment Complete";
+const char MSG_TXT18[] PROGMEM = "Experiment Stopped";
+const char MSG_TXT19[] PROGMEM = "Starting WQM Experiment";
+const char MSG_TXT20[] PROGMEM = "Calibration loaded";
+const char MSG_TXT21[] PROGMEM = "No calibration stored, using nominal gain values";
+const char MSG_TXT22[] PROGMEM = "Starting calibration";
+const char MSG_TXT23[] PROGMEM = "Calibration complete";
+const char MSG_TXT24[] PROGMEM = "Link ready (ms since reset), baud";
+const char MSG_TXT25[] PROGMEM = "No BLE module response, baud";
+const char MSG_TXT26[] PROGMEM = "First sample (ms since reset)";
+const char MSG_TXT27[] PROGMEM = "Experiment running";
+const char MSG_TXT28[] PROGMEM = "Experiment paused";
+const char MSG_TXT29[] PROGMEM = "Experiment resumed";
+const char MSG_TXT30[] PROGMEM = "Parameter update applied at cycle";
+const char MSG_TXT31[] PROGMEM = "Parameter update invalid";
+const char MSG_TXT32[] PROGMEM = "Plan: duration (ms)";
+const char MSG_TXT33[] PROGMEM = "Plan: samples";
+const char MSG_TXT34[] PROGMEM = "Plan: bytes on link";
+const char MSG_TXT35[] PROGMEM = "Plan: CPU load (%)";
+const char MSG_TXT36[] PROGMEM = "Plan: link load (%)";
+const char MSG_TXT37[] PROGMEM = "Plan accepted";
+const char MSG_TXT38[] PROGMEM = "Plan: fits link with stream mode";
+const char MSG_TXT39[] PROGMEM = "CPU budget exceeded, max sample rate";
+const char MSG_TXT40[] PROGMEM = "Link budget exceeded, max sample rate";
+const char MSG_TXT41[] PROGMEM = "Pulse shorter than ADC sync window (us)";
+const char MSG_TXT42[] PROGMEM = "Parameters inconsistent, parameter";
+const char MSG_TXT43[] PROGMEM = "BT link: max transmit slot (us)";
+const char MSG_TXT44[] PROGMEM = "BT link: bytes dropped";
+const char MSG_TXT45[] PROGMEM = "CPU duty cycle (0.1 %)";
+const char MSG_TXT46[] PROGMEM = "Max. wake latency (us)";
+const char MSG_TXT47[] PROGMEM = "Log records stored";
+const char MSG_TXT48[] PROGMEM = "Log records sent";
+const char MSG_TXT49[] PROGMEM = "Verify: DAC updates";
+const char MSG_TXT50[] PROGMEM = "Verify: samples";
+const char MSG_TXT51[] PROGMEM = "Verify: DAC CRC";
+const char MSG_TXT52[] PROGMEM = "Verify: sample CRC";
+const char MSG_TXT53[] PROGMEM = "Co-added points sent";
+const char MSG_TXT54[] PROGMEM = "Blank stored, bins";
+const char MSG_TXT55[] PROGMEM = "No blank for this waveform / gain";
+const char MSG_TXT56[] PROGMEM = "iR comp.: Ru (ohm)";
+const char MSG_TXT57[] PROGMEM = "iR comp.: cell time constant (us)";
+const char MSG_TXT58[] PROGMEM = "Ru measurement failed, decay ratio (0.1 %)";
+const char MSG_TXT59[] PROGMEM = "iR comp.: max age of the compensated current (us)";
+const char MSG_TXT60[] PROGMEM = "iR comp.: mean age of the compensated current (us)";
+const char MSG_TXT61[] PROGMEM = "Warning: iR comp. current older than the cell time constant, may oscillate, age (us)";
+const char MSG_TXT62[] PROGMEM = "Scan-rate series: segment";
+const char MSG_TXT63[] PROGMEM = "Scan-rate series: slope (mV/s)";
+const char MSG_TXT64[] PROGMEM = "Plan: channels";
+const char MSG_TXT65[] PROGMEM = "Retransmit history shorter than link round trip, max sample rate";
+const char MSG_TXT66[] PROGMEM = "Warning: co-add bins full, later samples dropped, bins";
+const char * const MSG_TEXT[MSG_COUNT] PROGMEM = {
+  MSG_TXT0, MSG_TXT1, MSG_TXT2, MSG_TXT3, MSG_TXT4, MSG_TXT5, MSG_TXT6, MSG_TXT7, MSG_TXT8,
+  MSG_TXT9, MSG_TXT10, MSG_TXT11, MSG_TXT12, MSG_TXT13, MSG_TXT14, MSG_TXT15, MSG_TXT16,
+  MSG_TXT17, MSG_TXT18, MSG_TXT19, MSG_TXT20, MSG_TXT21, MSG_TXT22, MSG_TXT23, MSG_TXT24,
+  MSG_TXT25, MSG_TXT26, MSG_TXT27, MSG_TXT28, MSG_TXT29, MSG_TXT30, MSG_TXT31,
+  MSG_TXT32, MSG_TXT33, MSG_TXT34, MSG_TXT35, MSG_TXT36, MSG_TXT37, MSG_TXT38, MSG_TXT39,
+  MSG_TXT40, MSG_TXT41, MSG_TXT42, MSG_TXT43, MSG_TXT44, MSG_TXT45, MSG_TXT46, MSG_TXT47, MSG_TXT48,
+  MSG_TXT49, MSG_TXT50, MSG_TXT51, MSG_TXT52, MSG_TXT53,
+  MSG_TXT54, MSG_TXT55, MSG_TXT56, MSG_TXT57, MSG_TXT58, MSG_TXT59, MSG_TXT60, MSG_TXT61,
+  MSG_TXT62, MSG_TXT63, MSG_TXT64, MSG_TXT65, MSG_TXT66
+};
+
+//Sample frame size (bytes) by stream mode (STREAM_STD, STREAM_CSV, STREAM_PACKED incl. keyframes / sync)
+const byte PLAN_FRAME_BYTES[3] = {9, 24, 9};
+
 unsigned int timer1_preload;
 unsigned int timer2_preload;
 
-unsigned long tExpStart = 0; // experiment start time
-unsigned long tExp = 0; // current experiment time since start (total)
+// Extended timebase, micros() (wraps after ~71 min) extended to 64 bits by microsExt()
+uint32_t tMicrosHigh = 0; // micros() overflow count
+unsigned long tMicrosLast = 0; // micros() at last microsExt() call
+
+uint64_t tExpStart = 0; // experiment start time
+uint64_t tExp = 0; // current experiment time since start (total)
 unsigned long tInt = 0; // current time since start of experiment interval
 
+// Start of current cycle / interval phase in experiment time (us, low 32 bits)
+// advanced by e.tCycle in calcInterval(), no divide per DAC update
+unsigned long tCycleStart = 0;
+unsigned long tPhaseStart = 0;
+
 unsigned long tScratch = 0;
 
 // current interval during experiment
@@ -155,6 +479,9 @@ int currCycle = 0;
 
 // experiment started flag
 uint8_t expStarted = 0;
+// experiment paused flag, timers stopped and experiment time frozen
+boolean expPaused = false;
+uint64_t tPause = 0; // time paused (microsExt())
 // async. adc sampling started flag
 boolean samplingStarted = false;
 
@@ -166,15 +493,160 @@ boolean WQM_startADC = false;
 //FWD and REV sampling completed for current cycle / period
 boolean syncADCcompleteFWD = false;
 boolean syncADCcompleteREV = false;
+boolean virtualRun = false; //waveform generated on virtual clock (verifyTask()), no output
+unsigned long vrSamples = 0; //verify sample count
+uint16_t vrCrc = 0; //verify CRC of sampled DAC codes
+boolean vrActive = false; //verify run in progress (verifyTask())
+
+long iIn = 0;  //pA
+
+//CV cycle co-addition (COADD_EN), [0] = 1st interval (vertex 1 to 2), [1] = 2nd interval
+long coSum[2][COADD_BINS]; //sum of ADC codes
+uint16_t coN[2][COADD_BINS]; //samples summed
+byte coBins = COADD_BINS; //bins per scan direction of the current scan (coaddInit())
+boolean coadd = false; //co-addition selected for current experiment (%CA:1%)
+uint16_t coLo = 0; //DAC code range of the scan
+uint16_t coHi = 0;
+byte bgMode = BG_OFF; //blank record / subtract (%BG:#)
+
+//Scan-rate series (%SS:#,...%), slopes (mV/s) of the segments
+int seriesSlope[SERIES_MAX];
+byte seriesN = 0; //segments, 0 = no series
+byte seriesSeg = 0; //current segment
+unsigned int seriesSR0 = 0; //sample rate of 1st segment (%SR:#)
+
+//iR compensation (IRCOMP_EN)
+long irRu = 0; //compensated resistance (ohm), 0 = off, -1 = measure before start (%RU:#)
+boolean irFresh = false; //TIA sample of this run in iIn, DAC updates compensated with it
+boolean irSlow = false; //latency warning sent
+unsigned long tIrAdc = 0; //conversion start of the sample in iIn (micros)
+unsigned long irTau = 0; //cell time constant (us) from measureRu(), 0 = Ru given, not measured
+unsigned long irLatMax = 0; //age of iIn at the DAC write, conversion start to write (us)
+uint64_t irLatSum = 0; //every DAC update of the run (500 Hz)
+unsigned long irLatN = 0;
+
+//Blank reference header in EEPROM (BLANK_EE_ADDR), followed by int16_t mean code [2][bins]
+struct BlankHdr {
+  uint16_t magic;
+  uint16_t lo;      //DAC code range of the blank scan
+  uint16_t hi;
+  uint8_t gain;
+  uint8_t bins;
+};
+
+//Experiment type of current config (EXP_CSV, EXP_DPV, EXP_EIS)
+byte expType = 0;
+
+//Impedance (EXP_EIS), DC potential and amplitude in e.vStart[0] / e.vStart[1], points in e.cycles
+float eisFStart = 0.0; //Hz
+float eisFStop = 0.0;
+byte eisPeriods = 0; //periods measured per point
+unsigned long eisTotal = 0; //duration of all points (us)
+byte eisPoint = 0; //current frequency point
+float eisF = 0.0; //frequency of current point (Hz)
+uint64_t eisInc = 0; //DDS phase increment per us, 2^32 = 1 period, 16 fractional bits
+unsigned long tEisPoint = 0; //start of current point (experiment time, us)
+unsigned long eisDur = 0; //duration of current point incl. settling period (us)
+unsigned long eisSettle = 0; //settling period (us)
+boolean eisConv = false; //conversion running, the sine is updated meanwhile (loop())
+unsigned long tEisConv = 0; //start of the running conversion (micros)
+long eisN = 0; //demodulator: samples, sums of code, sine and cosine reference, code * reference
+long eisSum = 0;
+long eisS = 0;
+long eisC = 0;
+int64_t eisSs = 0;
+int64_t eisSc = 0;
+
+//Profiler statistics (PROF_EN)
+const char PROF_NAME0[] PROGMEM = "calcInterval";
+const char PROF_NAME1[] PROGMEM = "calcOutput";
+const char PROF_NAME2[] PROGMEM = "scaleOutput";
+const char PROF_NAME3[] PROGMEM = "writeDAC";
+const char PROF_NAME4[] PROGMEM = "dacUpdate";
+const char PROF_NAME5[] PROGMEM = "sendSample";
+const char PROF_NAME6[] PROGMEM = "psSample";
+const char PROF_NAME7[] PROGMEM = "parseRunCmd";
+const char PROF_NAME8[] PROGMEM = "getMeasurementsWQM";
+const char * const PROF_NAME[PROF_COUNT] PROGMEM = {
+  PROF_NAME0, PROF_NAME1, PROF_NAME2, PROF_NAME3, PROF_NAME4, PROF_NAME5, PROF_NAME6, PROF_NAME7, PROF_NAME8
+};
+unsigned long profN[PROF_COUNT];
+unsigned long profSum[PROF_COUNT];
+unsigned int profMin[PROF_COUNT];
+unsigned int profMax[PROF_COUNT];
+
+//Benchmark (BENCH_EN / test_bench): run command per config, kernel names as in the profiler report
+const char BENCH_CMD0[] PROGMEM = "R%SR:30%G:2%E:1%SM:2%EP:0,0,0,0,0,-200,600,400,3,%/";
+const char BENCH_CMD1[] PROGMEM = "R%SR:30%G:2%E:1%EP:0,0,0,0,-500,-500,500,100,1,%/";
+const char BENCH_CMD2[] PROGMEM = "R%SR:30%G:2%E:2%SM:2%EP:0,0,0,0,-200,600,5,50,50,100,%/";
+const char * const BENCH_CMD[BENCH_CONFIGS] PROGMEM = {BENCH_CMD0, BENCH_CMD1, BENCH_CMD2};
+const char BENCH_EXP0[] PROGMEM = "CV";
+const char BENCH_EXP1[] PROGMEM = "LSV";
+const char BENCH_EXP2[] PROGMEM = "DPV";
+const char * const BENCH_EXP[BENCH_CONFIGS] PROGMEM = {BENCH_EXP0, BENCH_EXP1, BENCH_EXP2};
+const char * const BENCH_NAME[BENCH_KERNELS] PROGMEM = {
+  PROF_NAME0, PROF_NAME1, PROF_NAME2, PROF_NAME7, PROF_NAME5, PROF_NAME8
+};
+byte benchCmd = 0; //config loaded
+uint64_t benchT = 0; //experiment time of the next kernel call (us)
+
+//Debug trace queue (TRACE_EN), written from ISRs and loop()
+struct TraceRec {
+  uint8_t type;
+  uint8_t arg;
+  uint16_t data;
+  unsigned long us;
+};
+TraceRec traceBuf[TRACE_LEN];
+volatile byte traceHead = 0;
+byte traceTail = 0;
+volatile unsigned int traceDropped = 0;
 
-float vIn = 0.0;  //mV
-float iIn = 0.0;  //uA
 float vOut = 0.0; //V
 
 uint16_t dacOut = DACVAL0; //Raw value for DAC output
 
-//selected TIA feedback resistor value, in k ohm
-float rGain;
+//Sample stream (see STREAM_ modes)
+byte streamMode = STREAM_DEFAULT;
+uint16_t streamDac = 0; //last sent DAC code
+int16_t streamAdc = 0; //last sent ADC code
+int16_t streamDacStep = 0; //last DAC code step (mod 2^16)
+unsigned long streamTick = 0; //last sent sample tick
+unsigned long streamTickStep = 0; //last sample tick step
+byte streamCount = 0; //samples since last keyframe
+byte streamSeq = 0; //sequence number of next sample record
+byte frameCrc = 0; //CRC-8 of the packed record being sent
+
+//Sent samples, indexed by seq % STREAM_HIST_LEN, for retransmission
+struct StreamSample {
+  uint16_t dac;
+  int16_t adc;
+  unsigned long tick;
+  byte ch;
+};
+StreamSample streamHist[STREAM_HIST_LEN];
+byte rtxQueue[STREAM_RTX_LEN]; //requested sequence numbers
+byte nRtx = 0;
+uint64_t tSample = 0; //device time of current sample (us, microsExt())
+unsigned long tSync = 0; //time last sync record sent (ms)
+
+//Calibration of a single gain setting
+//current (pA) = ((code - offset) * scale) >> shift
+struct GainCal {
+  int16_t offset;   //ADC code at zero current
+  uint16_t scale;   //pA per ADC code, fixed point with 'shift' fractional bits
+  uint8_t shift;
+};
+
+//Calibration table for all gain settings, stored in EEPROM at calEeAddr(channel)
+struct CalTable {
+  uint16_t magic;
+  GainCal g[MAX_GAIN + 1];
+  uint8_t checksum;
+};
+
+CalTable cal[PS_CHANNELS]; //per channel
+GainCal *gCal = &cal[0].g[0]; //calibration of selected channel and gain setting
 
 //Structure for storing experiment config
 struct Experiment {
@@ -192,6 +664,7 @@ struct Experiment {
   unsigned int sampRate;    //ADC sampling rate, if async sampling implemented
   boolean syncSamplingEN;     //Sync samping - false: ADC sampling based on Timer1 (CV, LSV) true: ADC samp. occurs twice per cycle (DPV, SWV)
   unsigned long tSyncSample;  //ADC start time for sync sampling
+  unsigned long syncOffset;   //sync sampling window before end of interval (us), set by planExperiment()
   /* Gain Setting (0-7): Determines TIA feedback resistance and ADC PGA setting:
      0: RG = 500, PGA = 4X, 2000uA
      1: RG = 500, PGA = 16X, 500uA
@@ -203,10 +676,53 @@ struct Experiment {
      7: RG = 4M, PGA = 16X, 63nA
   */
   byte gain;
+  long tClOn;       //WQM free Cl switch on time (ms)
+  long tClPeriod;   //WQM free Cl switch total time of on and off phases (ms)
 };
 
 Experiment e; //current experiment config
-char charRcvd;
+
+//Pending live parameter update, the U fields of e and Timer1 reload values, copied into e at the next cycle boundary
+struct ExpUpdate {
+  byte gain;
+  unsigned int sampRate;
+  long tClOn;
+  long tClPeriod;
+  unsigned int preload; //Timer1 preload / prescaler for sampRate
+  byte prescale;
+};
+ExpUpdate eNext;
+boolean eNextPending = false;
+
+//Config and run options of the last R, saved while an R / D / V command is parsed into e (restoreRun())
+struct SavedRun {
+  Experiment e;
+  byte streamMode;
+  byte btDecim;
+  boolean coadd;
+  byte bgMode;
+  long irRu;
+  byte seriesN;
+};
+SavedRun savedRun;
+
+//Verify run (V command) on the virtual clock, advanced by verifyTask() from loop()
+struct VerifyRun {
+  uint64_t t;          //virtual time of the next DAC update (us)
+  uint64_t tNext;      //next async sample
+  unsigned long tSamp; //sample period (us)
+  unsigned long nDac;  //DAC updates
+  uint16_t crcDac;     //CRC16 of the DAC codes
+  boolean sampling;
+  boolean points;      //sample points sent as text
+};
+VerifyRun vr;
+
+//Command receiver
+byte cmdState = CMD_IDLE;
+char cmdBuf[MAX_CMD_LENGTH];
+byte nCmd = 0;
+unsigned long tCmd = 0; //command frame start (ms)
 /*
  * setup()
  *
@@ -227,42 +743,44 @@ void setup() {
   //PotStat board present input
   pinMode(PS_BrdPresent, INPUT_PULLUP);
 
-  delay(250);
+  //allow board present inputs to settle
+  delay(5);
 
   //Check for boards present
   WQM_Present = digitalRead(WQM_BrdPresent) ? false : true;
   PS_Present = digitalRead(PS_BrdPresent) ? false : true;
 
-  delay(5000);
-  //Initialize serial port - setup BLE shield
-    Serial.begin(9600);
-    while (!Serial) {
-      ; // wait for serial port to connect. Needed for native USB port only
-    }
-    Serial.println("Master Baud Rate: = 9600");
-    Serial.println("Setting BLE shield comms settings, name/baud rate(115200)");
-    delay(500);
-    Serial.print("AT+NAMEIMWQMS"); //Set board name
-    delay(250);
-    Serial.print("AT+BAUD4"); //Set baud rate to 115200 on BLE Shield
-    delay(250);
-    Serial.println();
-    Serial.println("Increasing MCU baud rate to 115200");
-    delay(500);
-    Serial.begin(9600);
-    delay(200);
-    Serial.println("Master Baud Rate: = 115200");
+  //Initialize serial port, BLE shield is configured by bootTask() from loop()
+  //serial output is held until the link is ready (bootState == BOOT_DONE)
+  Serial.begin(BLE_BAUD_DEFAULT);
+  while (!Serial) {
+    ; // wait for serial port to connect. Needed for native USB port only
+  }
+
+#if DUAL_LINK_EN
+  Serial_BT.begin(BT_BAUD);
+#endif
+
+  //find newest WQM log record
+  checkEeLayout();
+  initLog();
 
   //Initialize I2C
   Wire.begin(); //Start I2C
   Wire.setClock(400000L);
 
+  //internal ADC and analog comparator are not used
+  if (IDLE_SLEEP_EN) {
+    ADCSRA = 0;
+    ACSR |= _BV(ACD);
+    power_adc_disable();
+  }
+
 
   if (PS_Present) {
     //Setup PotStat outputs
-    //Gain select outputs
-    pinMode(PS_MUX0, OUTPUT);
-    pinMode(PS_MUX1, OUTPUT);
+    //Gain select outputs, probe further channels
+    initChannels();
     //PotStat LEDs
     pinMode(PS_LED1, OUTPUT);
     pinMode(PS_LED2, OUTPUT);
@@ -273,6 +791,9 @@ void setup() {
     digitalWrite(PS_WE_SwEn, ON); //todo: update to only turn on during experiment
     PS_adc1.begin();
 
+    //load current calibration from EEPROM (or nominal values)
+    calStored = loadCal();
+
     //default to gain range 2 (10k, 4X PGA gain)
     setGain(2);
 
@@ -281,10 +802,12 @@ void setup() {
 
     clearExp(); //clear experiment config
     defCVExp(); //set default exp config
-
-    sendInfo("PotStat Setup complete");
-  } else {
-    sendInfo("No PotStat board detected");
+  } else if (MCU_ONLY) {
+    //debug without shield, nominal current scale on every channel
+    psChannels = PS_CHANNELS;
+    for (byte ch = 0; ch < PS_CHANNELS; ch++) defaultCal(ch);
+    clearExp();
+    defCVExp();
   }
   if (WQM_Present) {
     //Setup WQM outputs
@@ -297,19 +820,137 @@ void setup() {
     WQM_adc2.begin();
     WQM_adc1.setGain(GAIN_TWO); // set PGA gain to 2 (LSB=0.0625 mV, FSR=2.048)
     WQM_adc2.setGain(GAIN_FOUR); // set PGA gain to 4 (LSB=0.03125 mV, FSR=1.024)
-    sendInfo("WQM Setup complete");
-    //Run WQM only
-    delay(1000);
+    //Run WQM only, sampling starts while the BLE link is still being configured
     startExperimentWQM(); //TODO: Delete when comms complete
-  } else {
-    sendInfo("No WQM board detected");
   }
-  delay(100);
+  //setup status and LEDs off are handled by reportBoot() once the link is ready
+  if (BENCH_EN) benchRun();
+}
+/*
+ * Boot state machine, called from loop() until bootState == BOOT_DONE
+ *
+ * Configures the BLE shield without blocking sensor start up:
+ * 1. wait BLE_POWERUP after reset, probe module with "AT" at BLE_BAUD_DEFAULT,
+ *    then at BLE_BAUD (module keeps its baud rate from a previous boot)
+ * 2. set board name (AT+NAMEIMWQMS), enable connection notifications (AT+NOTI1)
+ * 3. if still at BLE_BAUD_DEFAULT, set BLE_BAUD (AT+BAUD4) and switch the UART after the module confirms
+ * Each command is checked for an "OK" response and retried BLE_RETRIES times.
+ */
+void bootTask() {
+  byte r = (bootState == BOOT_POWERUP || bootState == BOOT_SWITCH) ? BLE_WAIT : bleResponse();
+  switch (bootState) {
+    case BOOT_POWERUP:
+      if (millis() >= BLE_POWERUP) bleSend(F("AT"), BOOT_PROBE);
+      break;
+    case BOOT_PROBE:
+      if (r == BLE_OK) {
+        bleTries = 0;
+        bleSend(F("AT+NAMEIMWQMS"), BOOT_NAME); //Set board name
+      } else if (r == BLE_FAIL && bleTries < BLE_RETRIES) {
+        bleSend(F("AT"), BOOT_PROBE);
+      } else if (r == BLE_FAIL && bleBaud != BLE_BAUD) {
+        //no response at factory baud rate, module may already be configured
+        setBaud(BLE_BAUD);
+        bleTries = 0;
+        bleSend(F("AT"), BOOT_PROBE);
+      } else if (r == BLE_FAIL) {
+        //no BLE module (USB only), continue at BLE_BAUD
+        bootState = BOOT_DONE;
+        sendInfo(MSG_BOOT_NO_BLE, bleBaud);
+        reportBoot();
+      }
+      break;
+    case BOOT_NAME:
+      if (r == BLE_FAIL && bleTries < BLE_RETRIES) {
+        bleSend(F("AT+NAMEIMWQMS"), BOOT_NAME);
+      } else if (r != BLE_WAIT) {
+        bleTries = 0;
+        bleSend(F("AT+NOTI1"), BOOT_NOTI); //Connection notifications, host link state for WQM log
+      }
+      break;
+    case BOOT_NOTI:
+      if (r == BLE_FAIL && bleTries < BLE_RETRIES) {
+        bleSend(F("AT+NOTI1"), BOOT_NOTI);
+      } else if (r != BLE_WAIT && bleBaud != BLE_BAUD) {
+        bleTries = 0;
+        bleSend(F("AT+BAUD4"), BOOT_BAUD); //Set baud rate to 115200 on BLE Shield
+      } else if (r != BLE_WAIT) {
+        bootState = BOOT_DONE;
+        reportBoot();
+      }
+      break;
+    case BOOT_BAUD:
+      if (r == BLE_OK) {
+        tBle = millis();
+        bootState = BOOT_SWITCH;
+      } else if (r == BLE_FAIL && bleTries < BLE_RETRIES) {
+        bleSend(F("AT+BAUD4"), BOOT_BAUD);
+      } else if (r == BLE_FAIL) {
+        //module did not accept new baud rate, stay at current rate
+        bootState = BOOT_DONE;
+        reportBoot();
+      }
+      break;
+    case BOOT_SWITCH:
+      if (millis() - tBle >= BLE_SWITCH_DELAY) {
+        setBaud(BLE_BAUD);
+        bootState = BOOT_DONE;
+        reportBoot();
+      }
+      break;
+  }
+}
+
+//Send AT command to BLE module and wait for response in boot state 'state'
+void bleSend(const __FlashStringHelper *cmd, byte state) {
+  nBleRx = 0;
+  Serial.print(cmd);
+  tBle = millis();
+  bleTries++;
+  bootState = state;
+}
+
+/* Collect BLE module response (non-blocking)
+    returns: BLE_OK if "OK" received, BLE_FAIL on timeout, otherwise BLE_WAIT
+*/
+byte bleResponse() {
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+    if (TRACE_EN) trace(TR_RX, c, 0);
+    if (nBleRx < BLE_RX_LEN) bleRx[nBleRx++] = c;
+  }
+  if (findSubstring(0, "OK", 2, bleRx, nBleRx) >= 0) return BLE_OK;
+  if (millis() - tBle >= BLE_TIMEOUT) return BLE_FAIL;
+  return BLE_WAIT;
+}
+
+//Change hardware serial baud rate, pending output is sent first
+void setBaud(unsigned long baud) {
+  Serial.flush();
+  Serial.begin(baud);
+  bleBaud = baud;
+  while (Serial.available() > 0) Serial.read();
+}
+
+//Send board setup status once the link is ready, boot indicator LEDs off
+void reportBoot() {
+  sendInfo(MSG_BOOT_LINK, millis());
+  sendInfo(PS_Present ? MSG_PS_SETUP : MSG_PS_NONE);
+  if (PS_Present) sendInfo(calStored ? MSG_CAL_LOADED : MSG_CAL_NOMINAL);
+  sendInfo(WQM_Present ? MSG_WQM_SETUP : MSG_WQM_NONE);
+  if (tFirstSample) sendInfo(MSG_BOOT_SAMPLE, tFirstSample);
   digitalWrite(PS_LED1, OFF);
   digitalWrite(PS_LED2, OFF);
   wqm_led(OFF);
+}
 
+//Record cold start to first sample time, reported when available
+void markFirstSample() {
+  if (tFirstSample) return;
+  tFirstSample = millis();
+  if (bootState == BOOT_DONE) sendInfo(MSG_BOOT_SAMPLE, tFirstSample);
 }
+
 /*
  * Interrupt Service Routine
  * called by TMR2 overflow
@@ -319,6 +960,8 @@ ISR(TIMER2_OVF_vect)
 {
   TCNT2 = timer2_preload;   // preload timer
   startDAC = true;
+  if (IDLE_SLEEP_EN) tEvent = micros();
+  if (TRACE_EN) trace(TR_ISR, 2, 0);
 }
 /*
  * Interrupt Service Routine
@@ -328,17 +971,14 @@ ISR(TIMER2_OVF_vect)
 ISR(TIMER1_OVF_vect)        // interrupt service routine
 {
   TCNT1 = timer1_preload;   // preload timer
+  if (IDLE_SLEEP_EN) tEvent = micros();
+  if (TRACE_EN) trace(TR_ISR, 1, 0);
   if (expStarted == PS_EXP_RUNNING) {
     PS_startADC = true;
     WQM_startADC = false;
   } else if (expStarted == WQM_EXP_RUNNING) {
     PS_startADC = false;
     WQM_startADC = true;
-    //Calculate time used for switched Cl measurements
-    switchTimeACC = switchTimeACC + (1000 / WQM_SAMP_RATE);
-    if (switchTimeACC > switchTimePRE) {
-      switchTimeACC = switchTimeACC - switchTimePRE;
-    }
   } else {
     PS_startADC = false;
     WQM_startADC = false;
@@ -347,6 +987,35 @@ ISR(TIMER1_OVF_vect)        // interrupt service routine
 
 }
 
+/* Process the TIA code of the current sample (PS_adc1_diff_0_1):
+   blank subtraction, current, IR compensation input, sample / co-add / EIS demodulator
+*/
+void psSample() {
+  if (TRACE_EN) trace(TR_ADC, PS_adc1.address(), PS_adc1_diff_0_1);
+  if (COADD_EN && bgMode == BG_SUB) {
+    //blank codes include the ADC offset, kept once for convCurrent()
+    long d = (long)PS_adc1_diff_0_1 - blankAt(dacOut, currInterval == INTERVAL_EXP2) + gCal->offset;
+    PS_adc1_diff_0_1 = constrain(d, -32768L, 32767L);
+  }
+  iIn = convCurrent(PS_adc1_diff_0_1); // in pA
+  if (IRCOMP_EN && irRu > 0) {
+    //current averaged from the conversion start on, held until the next sample
+    tIrAdc = (unsigned long)tSample;
+    irFresh = true;
+  }
+
+  //**** Send new data message
+  unsigned long tSend = PROF_EN ? micros() : 0;
+  if (expType == EXP_EIS) {
+    eisSample();
+  } else {
+    if (COADD_EN && (coadd || bgMode == BG_RECORD)) coaddSample();
+    if (!(COADD_EN && coadd)) sendSample();
+  }
+  if (PROF_EN) profEnd(PROF_SEND_SAMPLE, tSend);
+  if (DUAL_LINK_EN && psCh == 0) btSample();
+}
+
 /*
  * Main program execution loop
  * 1. Calculate and start DAC conversion if flag set high (interrupt)
@@ -356,12 +1025,18 @@ ISR(TIMER1_OVF_vect)        // interrupt service routine
  */
 void loop()
 {
+  //configure BLE link after reset (non-blocking)
+  if (bootState != BOOT_DONE) bootTask();
+
   //startDAC flag set (set from interrupt)
   if (startDAC) {
-    tScratch = micros(); //track execution time
+    if (IDLE_SLEEP_EN) trackWake();
+    tScratch = PROF_EN ? micros() : 0; //track execution time
     //calculate experiment time (time since exp. start)
-    tExp = micros() - tExpStart;
+    tExp = microsExt() - tExpStart;
     calcInterval(tExp); //calculate current interval, also currCycle and tInt
+    if (expType == EXP_EIS && currInterval > INTERVAL_DEP) eisInterval(tExp);
+    if (seriesN && currInterval == INTERVAL_DN && seriesSeg + 1 < seriesN) seriesNext(tExp);
 
     if (!samplingStarted  && !e.syncSamplingEN && (currInterval > INTERVAL_DEP) && (currInterval < INTERVAL_DN)) {
       //start adc interrupt timer only after deposition period
@@ -373,15 +1048,18 @@ void loop()
       //calculate voltage output
 
       vOut = (float)calcOutput(tInt, currCycle);
+      if (IRCOMP_EN && irRu > 0) {
+        //positive feedback, drop across Ru at the latest current added
+        vOut += constrain(iIn * 1.0E-12 * irRu, -IR_CORR_MAX, IR_CORR_MAX);
+      }
       dacOut = scaleOutput(vOut);
       if (dacOut >= 0 && dacOut <= 65535) {
-        long tdac = micros();
+        unsigned long tdac = PROF_EN ? micros() : 0;
         writeDAC(dacOut); //MAX5217
-        tdac = micros() - tdac;
-        //Serial.print("Set DAC et: ");
-        //Serial.println(tdac);
+        if (PROF_EN) profEnd(PROF_WRITE_DAC, tdac);
+        if (IRCOMP_EN && irFresh) irTrack();
       } else {
-        sendError("DAC out of range");
+        sendError(MSG_ERR_DAC_RANGE);
         //dac.setVoltage(DACVAL0, false);
         writeDAC(DACVAL0);
         programFail(4);
@@ -389,13 +1067,13 @@ void loop()
 
       // Check sync sampling (DPV/SWV)
       // FWD sample takes place at end of 1st interval
-      if (e.syncSamplingEN && !syncADCcompleteFWD && (tInt >= (e.tSwitch - SYNC_OFFSET)) && (tInt < e.tSwitch)) {
+      if (e.syncSamplingEN && !syncADCcompleteFWD && (tInt >= (e.tSwitch - e.syncOffset)) && (tInt < e.tSwitch)) {
         //sample ADC
         PS_startADC = true;
         syncADCcompleteFWD = true;
       }
       // REV sample takes place at end of 2nd interval
-      if (e.syncSamplingEN && !syncADCcompleteREV && (tInt >= (e.tCycle - SYNC_OFFSET))) {
+      if (e.syncSamplingEN && !syncADCcompleteREV && (tInt >= (e.tCycle - e.syncOffset))) {
         //sample ADC
         PS_startADC = true;
         syncADCcompleteREV = true;
@@ -403,73 +1081,70 @@ void loop()
 
     } else {
       //experiment completed
-      Serial.println("no");
+      if (COADD_EN && coadd) sendCoadd();
+      if (COADD_EN && bgMode == BG_RECORD) saveBlank();
       finishExperiment();
-      sendInfo("Experiment Complete");
+      sendInfo(MSG_EXP_COMPLETE);
     }
     startDAC = false;
 
+    //bluetooth link transmit slot, next DAC update is ~1 period away
+    if (DUAL_LINK_EN) btService();
+
     //execution time:
-    tScratch = micros() - tScratch;
-    //Serial.print("Start DAC Total et: ");
-    //Serial.println(tScratch);
+    if (PROF_EN) profEnd(PROF_DAC_UPDATE, tScratch);
   }
-  //PS_startADC flag set  (set from interrupt (CSV) or after DAC(DPV))
-  if (PS_startADC) {
-    tScratch = micros();
+  //PS_startADC flag set  (set from interrupt (CSV) or after DAC(DPV)), after a running EIS conversion
+  if (PS_startADC && !eisConv) {
+    tScratch = PROF_EN ? micros() : 0;
 
+    markFirstSample();
+    tSample = microsExt();
     if (!PS_Present && MCU_ONLY) {
-      iIn = vOut;
+      PS_adc1_diff_0_1 = 0; //debug without shield, no ADC read
+    } else if (expType == EXP_EIS) {
+      //no blocking read, the DAC keeps following the sine during the conversion
+      PS_adc1.startDifferential_0_1();
+      tEisConv = micros();
+      eisConv = true;
     } else {
       PS_adc1_diff_0_1 = PS_adc1.readADC_Differential_0_1();
-      vIn = PS_adc1_diff_0_1 * 0.03125; // in mV
-      iIn = vIn / rGain; // in uA
-    }
-
-    //**** Send new data message
-
-    if (PS_STD_MSG){ /* Standard raw data msg */
-      //Interface is expecting signed 32bit integer so data
-      //must be padded with leading 0's or 1's depending on sign
-      uint8_t fillBits = 0;
-      if (PS_adc1_diff_0_1 < 0) fillBits = 0XFF;
-
-      Serial.write('B'); //signify new data follows
-      Serial.write(13); //cr
-      Serial.flush();
-      //Send Data
-
-      //DAC output
-      Serial.write((uint8_t)(dacOut & 0XFF));
-      Serial.write((uint8_t)(dacOut >> 8));
-      //Serial.print(dacOut);
-
-      //ADC input
-      Serial.write((uint8_t)(PS_adc1_diff_0_1 & 0XFF));
-      Serial.write((uint8_t)(PS_adc1_diff_0_1 >> 8));
-      Serial.write(fillBits);
-      Serial.write(fillBits);
-      Serial.write(13); //cr
-      Serial.flush();
-    }
-    else /* debug / csv style msg */
-    {
-      Serial.print(dacOut);
-      Serial.write(',');
-      Serial.print(vOut);
-      Serial.write(',');
-      Serial.println(iIn);
     }
+    if (!eisConv) psSample();
 
     PS_startADC = false;
-    tScratch = micros() - tScratch;
-    //Serial.println(tScratch);
+    if (psChannels > 1) {
+      //next channel, sync sampling converts all channels back to back
+      selectChannel(psCh + 1 < psChannels ? psCh + 1 : 0);
+      if (e.syncSamplingEN && psCh != 0) PS_startADC = true;
+    }
+    if (PROF_EN) profEnd(PROF_PS_SAMPLE, tScratch);
+  }
+  if (eisConv && micros() - tEisConv >= PLAN_ADC_US) {
+    PS_adc1_diff_0_1 = PS_adc1.readConversion();
+    eisConv = false;
+    psSample();
+  }
+  //periodic sync record for host clock drift correction
+  if (expStarted == PS_EXP_RUNNING && streamMode == STREAM_PACKED && millis() - tSync >= STREAM_SYNC_INTERVAL) {
+    sendSync();
   }
   //WQM_startADC flag set  (set from interrupt)
   if (WQM_startADC) {
+    if (IDLE_SLEEP_EN) trackWake();
+    markFirstSample();
+    tScratch = PROF_EN ? micros() : 0;
     getMeasurementsWQM();
-    sendValues();
-    if (switchTimeACC >= CL_SW_ON_TIME && switchTimeACC < switchTimePRE) {
+    if (PROF_EN) profEnd(PROF_WQM_MEAS, tScratch);
+    //switch time of this sample, state reported is the one during the measurement
+    updateSwitchTime();
+    if (bootState == BOOT_DONE) reportWQM();
+    logSample();
+    if (DUAL_LINK_EN && btDecim > 0 && ++btCount >= btDecim) {
+      btCount = 0;
+      sendValues(btOut);
+    }
+    if (switchTimeACC >= e.tClOn && switchTimeACC < e.tClPeriod) {
       ClSwState = true;
     } else {
       ClSwState = false;
@@ -483,91 +1158,232 @@ void loop()
 
   /*
      Respond to serial communications
+     during boot the BLE module replies are read by bootTask()
   */
-  /*
-  if (Serial.available() > 0) {
-    charRcvd = Serial.read();
-    //check if experiment started
-    if (expStarted == 0 && charRcvd == '!') {
-      //handshake received, reply and prepare to read command
-      Serial.print("C");
-      led(ON);
-      //receive and parse command
-      receiveCmd();
-    } else if (expStarted == 0 && charRcvd == '?') {
-      startExperimentWQM();
-    } else if (expStarted == 0 && true && charRcvd == 'r') {//TODO: delete
-      startExperiment();
-    } else if (charRcvd == 'x') {
-      finishExperiment();
-      sendInfo("Experiment Stopped");
-    }
-  }
-  */
-
+  if (bootState == BOOT_DONE) pollCmd();
+  flashTask();
+  if (vrActive) verifyTask();
+  //bluetooth link transmit, no DAC updates to avoid
+  if (DUAL_LINK_EN && expStarted != PS_EXP_RUNNING) btService();
+  //keep timebase extension current in every state (idle, paused, running): micros() wraps after ~71 min
+  microsExt();
+  if (TRACE_EN) traceFlush();
+  //sleep until next interrupt (timer event, serial rx, millis() tick)
+  if (IDLE_SLEEP_EN) idleSleep();
 }
 /*
  * FUNCTIONS
  */
 /*
- * Receives potentiostat experiment command from serial port
- * Parses data and starts experiment if valid
+ * Receives commands from serial port (non-blocking), called every loop() once the link is ready
+ * At most CMD_POLL_BYTES are processed per call and commands that take long
+ * (run, calibrate) are only accepted when no potentiostat experiment is running,
+ * so DAC updates are not delayed by the command channel
+ */
+void pollCmd() {
+  if (cmdState != CMD_IDLE && millis() - tCmd > CMD_TIMEOUT) {
+    //read timed out
+    if (cmdState == CMD_FRAME) sendError(MSG_ERR_CMD_TIMEOUT);
+    cmdState = CMD_IDLE;
+    led(OFF);
+  }
+  for (byte i = 0; i < CMD_POLL_BYTES && Serial.available() > 0; i++) {
+    char c = Serial.read();
+    if (TRACE_EN) trace(TR_RX, c, 0);
+    switch (cmdState) {
+      case CMD_IDLE:
+        if (c == '<') {
+          //command start char
+          nCmd = 0;
+          tCmd = millis();
+          cmdState = CMD_FRAME;
+        } else if (c == '#') {
+          //retransmission request, seq follows
+          tCmd = millis();
+          cmdState = CMD_RTX;
+        } else if (c == '!') {
+          //handshake received, reply
+          Serial.print('C');
+          led(ON);
+          linkUp = true;
+          if (logPending) sendInfo(MSG_LOG_PENDING, logPending);
+        } else if (c == '?' && expStarted == 0) {
+          startExperimentWQM();
+        } else if (c == 'x' && expStarted) {
+          finishExperiment();
+          sendInfo(MSG_EXP_STOPPED);
+        } else {
+          linkNotify(c);
+        }
+        break;
+
+      case CMD_RTX:
+        if (expStarted == PS_EXP_RUNNING && streamMode == STREAM_PACKED && nRtx < STREAM_RTX_LEN) {
+          rtxQueue[nRtx++] = c;
+        }
+        cmdState = CMD_IDLE;
+        break;
+
+      case CMD_FRAME:
+        if (c == '>') {
+          cmdState = CMD_IDLE;
+          if (nCmd > 0 && cmdBuf[nCmd - 1] == '/') {
+            //command start/stop chars valid; parse cmd data
+            runCmd(cmdBuf, nCmd);
+          } else {
+            sendError(MSG_ERR_CMD_INVALID);
+          }
+          led(OFF);
+          return; //one command per call
+        } else if (nCmd < MAX_CMD_LENGTH) {
+          cmdBuf[nCmd++] = c;
+        } else {
+          //command too long
+          cmdState = CMD_IDLE;
+          sendError(MSG_ERR_CMD_INVALID);
+          led(OFF);
+        }
+        break;
+    }
+  }
+}
+
+/*
+ * Execute received command frame (contents between '<' and '>')
  */
-void receiveCmd() {
-  boolean receiving = true;
-  boolean valid = false; //command has valid prefix/suffix chars
-  unsigned long rxStart = millis();
-
-  char cmd[MAX_CMD_LENGTH];
-  memset(cmd, 0, sizeof(cmd));
-  int nReceived = -1;
-  Serial.setTimeout(2000);
-  while (receiving && (millis() - rxStart) < 20000) {
-    if (Serial.available() > 0) {
-      //data has arrived, check for leading/start char ('<')
-      if (Serial.read() == '<') {
-        //leading char correct, check remaining chars
-        nReceived = Serial.readBytesUntil('>', cmd, MAX_CMD_LENGTH);
-        if (nReceived > 0 && cmd[nReceived - 1] == '/' ) {
-          //command start/stop chars valid; parse cmd data
-          //cmd[nReceived - 1] = 0;
-          valid = true;
-          //determine command type
-          switch (cmd[0]) {
-            case 'R':
-              if (parseRunCmd(cmd, nReceived)) {
-                startExperiment();
-              } else {
-                sendError("Could not parse command / command invalid");
-              }
-              break;
-
-            default:
-              //Command not recognized
-              sendError("Command not recognized");
-              break;
+void runCmd(char *cmd, int ncmd) {
+  long rCal;
+  //determine command type
+  switch (cmd[0]) {
+    case 'R':
+    case 'C':
+      if (expStarted == PS_EXP_RUNNING || vrActive) {
+        sendError(MSG_ERR_BUSY);
+        break;
+      }
+      //WQM measurements are stopped for potentiostat experiments / calibration
+      if (expStarted == WQM_EXP_RUNNING) finishExperiment();
+      if (cmd[0] == 'R') {
+        //parsed into the config of the last run, restored if the command is rejected
+        saveRun();
+        unsigned long timeEx = PROF_EN ? micros() : 0;
+        boolean ok = parseRunCmd(cmd, ncmd);
+        if (PROF_EN) profEnd(PROF_PARSE_RUN, timeEx);
+        if (!ok) {
+          sendError(MSG_ERR_CMD_PARSE);
+        } else if (COADD_EN && bgMode == BG_SUB && !checkBlank()) {
+          //no matching blank, not started
+        } else if (IRCOMP_EN && irRu < 0 && !measureRu()) {
+          //Ru not measurable, not started
+        } else if (planExperiment(false)) {
+          startExperiment();
+        }
+        if (expStarted != PS_EXP_RUNNING) restoreRun();
+      } else if (parseCalCmd(cmd, ncmd, &rCal)) {
+        calibrate(rCal);
+      } else {
+        sendError(MSG_ERR_CMD_PARSE);
+      }
+      break;
 
+    case 'D':
+    case 'V':
+      if (expStarted == PS_EXP_RUNNING || vrActive) {
+        sendError(MSG_ERR_BUSY);
+      } else {
+        //config restored after planning / verify, a running WQM experiment is not affected
+        saveRun();
+        long points = 0;
+        if (parseField(cmd, ncmd, "%VP:", 4, &points, 0, 1) >= 0 && parseRunCmd(cmd, ncmd)) {
+          if (cmd[0] == 'D') {
+            planExperiment(true);
+            restoreRun();
+          } else {
+            verifyStart(points);
           }
-          receiving = false;
         } else {
-          //read timed out or invalid cmd stop char
-          receiving = false;
+          sendError(MSG_ERR_CMD_PARSE);
+          restoreRun();
+        }
+      }
+      break;
+
+    case 'W':
+      if (expStarted) {
+        sendError(MSG_ERR_BUSY);
+        break;
+      }
+      {
+        //all fields parsed before any is applied, a rejected command leaves the settings unchanged
+        const long limsHB[2] = {LIMS_HB};
+        const long limsLI[2] = {LIMS_LI};
+        long rm, hb, li;
+        int rRM = parseField(cmd, ncmd, "%RM:", 4, &rm, WQM_REPORT_ALL, WQM_REPORT_CHANGE);
+        int rHB = parseField(cmd, ncmd, "%HB:", 4, &hb, limsHB[0], limsHB[1]);
+        int rLI = parseField(cmd, ncmd, "%LI:", 4, &li, limsLI[0], limsLI[1]);
+        if (rRM < 0 || rHB < 0 || rLI < 0) {
+          sendError(MSG_ERR_CMD_PARSE);
+          break;
         }
+        if (rRM > 0) wqmReportMode = rm;
+        if (rHB > 0) wqmHeartbeat = hb;
+        if (rLI > 0) logInterval = li;
+      }
+      startExperimentWQM();
+      break;
+
+    case 'X':
+      if (vrActive) verifyEnd(false);
+      if (expStarted) {
+        finishExperiment();
+        sendInfo(MSG_EXP_STOPPED);
+      }
+      break;
+
+    case 'P':
+      pauseExperiment();
+      break;
 
+    case 'G':
+      resumeExperiment();
+      break;
+
+    case 'Q':
+      sendStatus();
+      break;
+
+    case 'B':
+      if (PROF_EN) sendProfile();
+      break;
+
+    case 'L':
+      //EEPROM writes (marking records sent) would delay DAC updates
+      if (expStarted == PS_EXP_RUNNING) {
+        sendError(MSG_ERR_BUSY);
       } else {
-        //leading char not correct
-        receiving = false;
+        dumpLog();
       }
-    }
+      break;
+
+    case 'U':
+      if (vrActive) {
+        sendError(MSG_ERR_BUSY);
+      } else if (!parseUpdateCmd(cmd, ncmd)) {
+        sendError(MSG_ERR_UPDATE);
+      }
+      break;
+
+    default:
+      //Command not recognized
+      sendError(MSG_ERR_CMD_UNKNOWN);
+      break;
   }
-  if (receiving) sendError("Command not received");
-  else if (!valid) sendError("Received command not valid");
-  led(OFF);
 }
 
 /* Extract parameters from run command char array
 
-    References global current experiment config 'e'
+    References global current experiment config 'e', saved before and restored after a dry run / verify
+    or a rejected command (saveRun()), hardware (gain mux) is set when the experiment starts
 
     returns: success status - function is successful if parameters
     were extraced, converted to experiment config, and config is valid
@@ -596,7 +1412,7 @@ boolean parseRunCmd(char *cmd, int ncmd) {
   if (value >= MIN_SAMPLE_RATE && value <= MAX_SAMPLE_RATE) {
     e.sampRate = value;
   } else {
-    sendError("Sample Rate out of range");
+    sendError(MSG_ERR_SR_RANGE);
     return false; //out of range
   }
 
@@ -611,13 +1427,50 @@ boolean parseRunCmd(char *cmd, int ncmd) {
   if (!convInt(&value, cmd, iStart + 1, iEnd - 1)) return false; //conversion not successful
   //check if extracted gain in valid range:
   if (value >= MIN_GAIN && value <= MAX_GAIN) {
-    e.gain = value;
-    setGain(e.gain);
+    e.gain = value; //gain mux set when the experiment starts
   } else {
-    sendError("Gain out of range");
+    sendError(MSG_ERR_GAIN_RANGE);
     return false; //out of range
   }
 
+  //*** Stream mode (optional)
+  //look for "%SM:" in command (stream mode)
+  iStart = findSubstring(0, "%SM:", 4, cmd, ncmd);
+  if (iStart >= 0) {
+    //find enclosing '%'
+    iEnd = findSubstring(iStart, "%", 1, cmd, ncmd);
+    if (iEnd < 0) return false; // substring not found
+    if (!convInt(&value, cmd, iStart + 1, iEnd - 1)) return false; //conversion not successful
+    if (value < STREAM_STD || value > STREAM_PACKED) return false; //invalid mode
+    streamMode = value;
+  } else {
+    //not kept from a previous run
+    streamMode = STREAM_DEFAULT;
+  }
+
+  //*** Bluetooth link decimation (optional)
+  if (parseField(cmd, ncmd, "%BD:", 4, &value, 0, 255) < 0) return false;
+  if (findSubstring(0, "%BD:", 4, cmd, ncmd) >= 0) btDecim = value;
+
+  //*** Cycle co-addition (optional)
+  int r = parseField(cmd, ncmd, "%CA:", 4, &value, 0, 1);
+  if (r < 0) return false;
+  coadd = COADD_EN && r > 0 && value;
+
+  //*** Background, blank record / subtract (optional)
+  r = parseField(cmd, ncmd, "%BG:", 4, &value, BG_OFF, BG_SUB);
+  if (r < 0) return false;
+  bgMode = (COADD_EN && r > 0) ? value : BG_OFF;
+
+  //*** iR compensation (optional), binned modes need the uncorrected DAC code
+  r = parseField(cmd, ncmd, "%RU:", 4, &value, -1, IR_RU_MAX);
+  if (r < 0) return false;
+  irRu = (IRCOMP_EN && r > 0) ? value : 0;
+  irTau = 0;
+  if (irRu && (coadd || bgMode)) return false;
+  //per sample state of one channel only
+  if (psChannels > 1 && (coadd || bgMode || irRu)) return false;
+
   //*** Experiment Parameters
   //look for "%EP:" in command (exp. params)
   iStart = findSubstring(0, "%EP:", 4, cmd, ncmd);
@@ -649,27 +1502,221 @@ boolean parseRunCmd(char *cmd, int ncmd) {
   //check if extracted experiment is valid:
   if (value == EXP_CSV) {
     //valid experiment
-    if (checkParams(value, nParams, params) && setConfig(value, params)) {
+    if (checkParams(value, nParams, params) && setConfig(value, params) && parseSeries(cmd, ncmd)) {
       //params valid and experiment configuration set
       return true;
     } else {
       return false;
     }
-  } else if (value == EXP_DPV) {
+  } else if (value == EXP_DPV || value == EXP_EIS) {
     //valid experiment
-    if (checkParams(value, nParams, params) && setConfig(value, params)) {
+    if (checkParams(value, nParams, params) && setConfig(value, params) && parseSeries(cmd, ncmd)) {
       //params valid and experiment configuration set
       return true;
     } else {
       return false;
     }
   } else {
-    sendError("Selected experiment invalid/not supported");
+    sendError(MSG_ERR_EXP_INVALID);
     return false; //out of range
   }
   return true;
 }
 
+/* Extract scan-rate series (optional, CSV) from run command: "%SS:#,#,...#,%" slopes (mV/s)
+   called after the experiment config is set, 1st slope applied to it
+   returns false if malformed, not CSV, combined with %CA / %BG or a slope / scaled sample rate / scan time out of range
+*/
+boolean parseSeries(char *cmd, int ncmd) {
+  seriesN = 0;
+  seriesSeg = 0;
+  int iStart = findSubstring(0, "%SS:", 4, cmd, ncmd);
+  if (iStart < 0) return true; //no series
+  int iEnd = findSubstring(iStart, "%", 1, cmd, ncmd);
+  if (iEnd < 0 || expType != EXP_CSV || coadd || bgMode) return false;
+  seriesSR0 = e.sampRate;
+  int iDelimPrev = iStart;
+  while (true) {
+    int iDelim = findSubstring(iDelimPrev + 1, ",", 1, cmd, ncmd);
+    if (iDelim < 0 || iDelim >= iEnd || seriesN >= SERIES_MAX) return false;
+    long v;
+    if (!convInt(&v, cmd, iDelimPrev + 1, iDelim - 1)) return false;
+    //same limits as P7
+    if (v < expLimit(EXP_CSV, 7, 0)) {
+      sendError(MSG_ERR_PAR_MIN, 7);
+      return false;
+    }
+    if (v > expLimit(EXP_CSV, 7, 1)) {
+      sendError(MSG_ERR_PAR_MAX, 7);
+      return false;
+    }
+    //slower slope of the series: scan times bounded as for P7
+    if (max(e.tSwitch, e.tOffset) * (fabs(e.vSlope[0]) * 1.0E9 / v) > CSV_SCAN_MAX) {
+      sendError(MSG_ERR_PAR_EXP, 7);
+      return false;
+    }
+    seriesSlope[seriesN++] = v;
+    if (seriesRate(seriesN - 1) < MIN_SAMPLE_RATE || seriesRate(seriesN - 1) > MAX_SAMPLE_RATE) {
+      sendError(MSG_ERR_SR_RANGE);
+      return false;
+    }
+    if (iDelim == iEnd - 1) break; //last delimiter
+    iDelimPrev = iDelim;
+  }
+  seriesApply(0);
+  return true;
+}
+
+//Sample rate of series segment k, scaled from the 1st segment for constant points per mV
+unsigned int seriesRate(byte k) {
+  return ((long)seriesSR0 * seriesSlope[k] + seriesSlope[0] / 2) / seriesSlope[0];
+}
+
+//Apply slope of series segment k to the CSV config, scan times scaled by the slope ratio
+void seriesApply(byte k) {
+  float r = fabs(e.vSlope[0]) * 1.0E9 / seriesSlope[k]; //current / new slope
+  e.tOffset = e.tOffset * r + 0.5;
+  e.tSwitch = e.tSwitch * r + 0.5;
+  e.tCycle = 2 * e.tSwitch;
+  e.vSlope[0] /= r;
+  e.vSlope[1] /= r;
+  e.sampRate = seriesRate(k);
+}
+
+/* Start next segment of the scan-rate series at experiment time t (calcInterval() returned INTERVAL_DN)
+    the active region restarts at t without cleaning / deposition (deposition time extended, unsigned
+    arithmetic wraps consistently with calcInterval()), sample timer switched to the segment rate.
+    A live update still pending from the last cycle of the segment takes effect first, the segment
+    rate then replaces its %SR.
+*/
+void seriesNext(uint64_t t) {
+  if (eNextPending) applyUpdate(currCycle);
+  seriesSeg++;
+  seriesApply(seriesSeg);
+  e.tDep = (unsigned long)t - e.tClean;
+  currCycle = -1;
+  calcInterval(t);
+  if (virtualRun) return;
+  if (samplingStarted) {
+    unsigned int preload;
+    byte prescale;
+    calcTimer1(e.sampRate, &preload, &prescale);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      timer1_preload = preload;
+      TCCR1B = prescale;
+    }
+  }
+  sendInfo(MSG_SERIES_SEG, seriesSeg);
+  sendInfo(MSG_SERIES_SLOPE, seriesSlope[seriesSeg]);
+}
+
+/* Extract calibration resistor from calibration command char array
+
+    returns: success status - function is successful if resistance
+    was extracted and is within LIMS_CALR
+*/
+boolean parseCalCmd(char *cmd, int ncmd, long * rcal) {
+  const long lims[2] = {LIMS_CALR};
+  int iStart, iEnd;
+
+  //look for "%R:" in command (calibration resistor)
+  iStart = findSubstring(0, "%R:", 3, cmd, ncmd);
+  if (iStart < 0) return false; // substring not found
+  //find enclosing '%'
+  iEnd = findSubstring(iStart, "%", 1, cmd, ncmd);
+  if (iEnd < 0) return false; // substring not found
+  if (!convInt(rcal, cmd, iStart + 1, iEnd - 1)) return false; //conversion not successful
+  if (*rcal < lims[0] || *rcal > lims[1]) {
+    sendError(MSG_ERR_CALR_RANGE);
+    return false;
+  }
+  return true;
+}
+
+/* Extract optional integer field "key#%" from command char array
+
+    returns: 1 if found and within vmin..vmax, 0 if not found, -1 if invalid
+*/
+int parseField(char *cmd, int ncmd, char *key, int nkey, long * v, long vmin, long vmax) {
+  int iStart = findSubstring(0, key, nkey, cmd, ncmd);
+  if (iStart < 0) return 0; // substring not found
+  //find enclosing '%'
+  int iEnd = findSubstring(iStart, "%", 1, cmd, ncmd);
+  if (iEnd < 0) return -1; // substring not found
+  if (!convInt(v, cmd, iStart + 1, iEnd - 1)) return -1; //conversion not successful
+  if (*v < vmin || *v > vmax) return -1; //out of range
+  return 1;
+}
+
+/* Live parameter update, <U%G:#%SR:#%CN:#%CM:#%/> (all fields optional)
+    Changes are made to a copy of the U fields of the current config (eNext), Timer1 reload values are
+    calculated here so the swap at the next cycle boundary (applyUpdate()) is only a copy.
+    When no experiment is running the update is applied immediately.
+    All fields are parsed and checked before eNext is changed, a rejected update leaves a pending one as it was.
+
+    returns: true if all supplied fields valid
+*/
+boolean parseUpdateCmd(char *cmd, int ncmd) {
+  const long limsCl[2] = {LIMS_CLT};
+  long g, sr, cn, cm;
+  int rG = parseField(cmd, ncmd, "%G:", 3, &g, MIN_GAIN, MAX_GAIN);
+  int rSR = parseField(cmd, ncmd, "%SR:", 4, &sr, MIN_SAMPLE_RATE, MAX_SAMPLE_RATE);
+  int rCN = parseField(cmd, ncmd, "%CN:", 4, &cn, limsCl[0], limsCl[1]);
+  int rCM = parseField(cmd, ncmd, "%CM:", 4, &cm, limsCl[0], limsCl[1]);
+  if (rG < 0 || rSR < 0 || rCN < 0 || rCM < 0) return false;
+  if (rG > 0 && COADD_EN && (coadd || bgMode) && expStarted == PS_EXP_RUNNING) return false; //binned codes need one gain
+  if (rSR > 0 && expStarted == WQM_EXP_RUNNING) return false;
+
+  //U fields of the pending config (or the current one) with the update applied
+  byte gain = rG > 0 ? g : (eNextPending ? eNext.gain : e.gain);
+  unsigned int rate = rSR > 0 ? sr : (eNextPending ? eNext.sampRate : e.sampRate);
+  long bOn = eNextPending ? eNext.tClOn : e.tClOn;
+  long bPeriod = eNextPending ? eNext.tClPeriod : e.tClPeriod;
+  long clOn = rCN > 0 ? cn : bOn;
+  long clPeriod = rCM > 0 ? clOn + cm : bPeriod - bOn + clOn;
+
+  if (rSR > 0 && expStarted == PS_EXP_RUNNING) {
+    //new rate must fit the CPU / link budget as a run command would, planned with the updated fields
+    Experiment saved = e;
+    e.gain = gain;
+    e.sampRate = rate;
+    boolean ok = planExperiment(false);
+    e = saved;
+    if (!ok) return false;
+  }
+
+  eNext.gain = gain;
+  eNext.sampRate = rate;
+  eNext.tClOn = clOn;
+  eNext.tClPeriod = clPeriod;
+  calcTimer1(eNext.sampRate, &eNext.preload, &eNext.prescale);
+  eNextPending = true;
+  if (!expStarted || expPaused) applyUpdate(currCycle);
+  return true;
+}
+
+/* Swap pending update (eNext) into current config, called at cycle boundary
+    eNext holds only the fields of the U command, the rest of e may have changed since it was taken
+    (series segment), acknowledged with the cycle index where the update took effect
+*/
+void applyUpdate(int cycle) {
+  e.gain = eNext.gain;
+  e.sampRate = eNext.sampRate;
+  e.tClOn = eNext.tClOn;
+  e.tClPeriod = eNext.tClPeriod;
+  eNextPending = false;
+  if (expStarted == PS_EXP_RUNNING) {
+    setGain(e.gain);
+    if (samplingStarted && !expPaused) {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        timer1_preload = eNext.preload;
+        TCCR1B = eNext.prescale;
+      }
+    }
+  }
+  sendInfo(MSG_UPDATE_APPLIED, cycle);
+}
+
 /* Finds substring within char array starting from a provided index
    inputs:
    @param   start   starting index to begin search
@@ -738,6 +1785,11 @@ boolean isNum(char c) {
   return (c >= 0x30 && c <= 0x39);
 }
 
+//Limit of parameter i of experiment e, m = 0 min, 1 max
+long expLimit(byte e, byte i, byte m) {
+  return (int32_t)pgm_read_dword(&EXP_LIMITS[e][i][m]);
+}
+
 /*
  * Checks if experiment parameters are within max/min limits
  *
@@ -746,16 +1798,16 @@ boolean isNum(char c) {
  * returns: true if successful
  */
 boolean checkParams (int e, int np, long * par) {
-  if ((e != EXP_CSV) && (e != EXP_DPV)) return false; // invalid experiment
+  if ((e != EXP_CSV) && (e != EXP_DPV) && (e != EXP_EIS)) return false; // invalid experiment
   if (np != PARAMS_REQD[e]) return false; // number of supplied parameters not equal to required parameters for selected exp
 
   //Check if supplied parameters within constant limits
   for (int i = 0; i < np; i++) {
-    if (par[i] < EXP_LIMITS[e][i][0]) {
-      sendError("Parameter out of range (below min)");
+    if (par[i] < expLimit(e, i, 0)) {
+      sendError(MSG_ERR_PAR_MIN, i);
       return false;
-    } else if (par[i] > EXP_LIMITS[e][i][1]) {
-      sendError("Parameter out of range (above max)");
+    } else if (par[i] > expLimit(e, i, 1)) {
+      sendError(MSG_ERR_PAR_MAX, i);
       return false;
     }
   }
@@ -764,10 +1816,46 @@ boolean checkParams (int e, int np, long * par) {
 
   switch (e) {
     case EXP_CSV:
-      // TODO
+      //vertices must differ (non zero cycle time)
+      if (par[5] == par[6]) {
+        sendError(MSG_ERR_PAR_EXP, 6);
+        return false;
+      }
+      //scan times bounded, cycle time tracked in 32 bits by calcInterval()
+      if (abs(par[6] - par[5]) * 1.0E6 / par[7] > CSV_SCAN_MAX || abs(par[5] - par[4]) * 1.0E6 / par[7] > CSV_SCAN_MAX) {
+        sendError(MSG_ERR_PAR_EXP, 7);
+        return false;
+      }
       break;
     case EXP_DPV:
-      // TODO Pulse period > pulse width, experiment < 70 min, stop voltage > start voltage, stop voltage + amplitude < 1500 mv
+      //Pulse period > pulse width
+      if (par[9] <= par[8]) {
+        sendError(MSG_ERR_PAR_EXP, 9);
+        return false;
+      }
+      //stop voltage > start voltage by at least one step, stop voltage + amplitude <= 1500 mv
+      if (par[5] - par[4] < par[6]) {
+        sendError(MSG_ERR_PAR_EXP, 5);
+        return false;
+      }
+      if (par[5] + par[7] > 1500) {
+        sendError(MSG_ERR_PAR_EXP, 7);
+        return false;
+      }
+      break;
+    case EXP_EIS:
+      //demodulator of one channel
+      if (psChannels > 1) return false;
+      //sine within DAC range
+      if (abs(par[4]) + par[5] > 1500) {
+        sendError(MSG_ERR_PAR_EXP, 5);
+        return false;
+      }
+      //sample rate above twice the highest frequency (mHz)
+      if ((long)::e.sampRate * 500 <= max(par[6], par[7])) {
+        sendError(MSG_ERR_PAR_EXP, par[6] > par[7] ? 6 : 7);
+        return false;
+      }
       break;
   }
   return true;
@@ -800,7 +1888,7 @@ boolean checkParams (int e, int np, long * par) {
    2      Dep. T (us)         e.tDep=par[2];
    3      Dep. V (mV)         e.vDep=par[3]/1000;
    4      Start (mV)          e.vStart[0] = par[4];
-   5      Stop (mV)           determines # cycles from Start and Step: e.cycles = (par[4]-par[5])/par[6];
+   5      Stop (mV)           determines # cycles from Start and Step: e.cycles = (par[5]-par[4])/par[6];
    6      Step (mV)
    7      Pulse Amp(mV)       e.vStart[1] = par[7] - e.vStart[0];
    8      Pulse Width (ms)    e.tSwitch = (par[9]-par[8])*1e3
@@ -841,40 +1929,630 @@ boolean setConfig (int experiment, long * par) {
       e.vSlope[1] = 0.0;
       e.tCycle = par[9] * 1e3;
       e.tSwitch = (par[9] - par[8]) * 1e3;
-      e.cycles = (par[4] - par[5]) / par[6];
+      e.cycles = (par[5] - par[4]) / par[6];
       e.syncSamplingEN = true;
       e.offset = float(par[6] / 1000.0);
       break;
 
+    case EXP_EIS:
+      e.tClean = par[0];
+      e.vClean = float(par[1] / 1000.0);
+      e.tDep = par[2];
+      e.vDep = float(par[3] / 1000.0);
+      e.tOffset = 0;
+      e.vStart[0] = float(par[4] / 1000.0);
+      e.vStart[1] = float(par[5] / 1000.0);
+      e.vSlope[0] = 0.0;
+      e.vSlope[1] = 0.0;
+      e.tSwitch = 0;
+      e.tCycle = 0; //frequency points timed by eisInterval()
+      e.syncSamplingEN = false;
+      e.offset = 0;
+      eisFStart = par[6] / 1000.0;
+      eisFStop = par[7] / 1000.0;
+      eisPeriods = par[9];
+      //log spaced points, both end frequencies included
+      e.cycles = (int)(fabs(log10(eisFStop / eisFStart)) * par[8] + 0.5) + 1;
+      eisTotal = 0;
+      for (byte k = 0; k < e.cycles; k++) {
+        eisSetPoint(k);
+        eisTotal += eisDur;
+      }
+      break;
+
     default:
       return false;
   }
+  expType = experiment;
   return true;
 }
-//Add error prefix text to message and send to user
-size_t sendError(String s) {
-  //return 0;
-  return Serial.println(String("Error: " + s));
-}
-
-//Add info prefix text to message and send to user
-size_t sendInfo(String s) {
-  //return 0;
-  return Serial.println(String("Info: " + s));
-}
+/* Plan experiment in current config (e, streamMode) before it is started
+    estimates duration, sample count, bytes on the link and CPU load (ADC conversions,
+    DAC updates, blocking serial output) and sets the sync sampling window (DPV).
+    report = true sends the estimates (dry run).
 
-
-/* Calculate output voltage (float) based on current interval (global var),
-    experiment interval time (ti), current cycle (c), and current
-    experiment configuration (global var)
+    returns: false if the run exceeds the CPU or link budget, or a DPV pulse is shorter than
+    the sync sampling window. A max sample rate / stream mode that fits is suggested.
+*/
+boolean planExperiment(boolean report) {
+  byte frame = PLAN_FRAME_BYTES[streamMode];
+  float rate = e.syncSamplingEN ? 2.0E6 / e.tCycle : e.sampRate; //samples per s
+  float tRun = (float)e.cycles * e.tCycle * 1.0E-6; //active experiment time (s)
+  if (expType == EXP_EIS) {
+    //results only, samples are not sent
+    tRun = eisTotal * 1.0E-6;
+    frame = 0;
+  }
+  float samples = rate * tRun;
+  if (seriesN > 0) {
+    //scan-rate series, same samples per segment, budget checked at the fastest segment
+    float t0 = tRun;
+    tRun = 0;
+    for (byte k = 0; k < seriesN; k++) {
+      float tk = t0 * seriesSlope[0] / seriesSlope[k];
+      tRun += tk;
+      if (seriesRate(k) > rate) rate = seriesRate(k);
+    }
+    samples *= seriesN;
+  }
+  float linkMax = bleBaud / 10.0 * PLAN_LINK_MAX / 100.0; //usable bytes per s
+  //std mode waits for frame to be sent (Serial.flush)
+  if (psChannels > 1) {
+    //channel tag per sample, sync sampling converts every channel
+    if (frame) frame += 2;
+    if (e.syncSamplingEN) rate *= psChannels;
+  }
+  float sampleUs = PLAN_ADC_US + (streamMode == STREAM_STD ? frame * 1.0E7 / bleBaud : PLAN_TX_US);
+  float dacUs = (float)PLAN_DAC_RATE * PLAN_DAC_US * psChannels; //per s, all DACs written
+  float cpu = (dacUs + rate * sampleUs) / 1.0E4; //%
+
+  setSyncOffset();
+
+  if (report) {
+    sendInfo(MSG_PLAN_TIME, (e.tClean + e.tDep) / 1000 + (long)(tRun * 1000.0));
+    sendInfo(MSG_PLAN_SAMPLES, samples);
+    sendInfo(MSG_PLAN_BYTES, samples * frame);
+    sendInfo(MSG_PLAN_CPU, cpu);
+    sendInfo(MSG_PLAN_LINK, rate * frame * 100.0 / (bleBaud / 10.0));
+    sendInfo(MSG_PLAN_CHANNELS, psChannels);
+  }
+  if (e.syncSamplingEN && (e.tSwitch < e.syncOffset || e.tCycle - e.tSwitch < e.syncOffset)) {
+    sendError(MSG_ERR_PLAN_SYNC, e.syncOffset);
+    return false;
+  }
+  if (cpu > PLAN_CPU_MAX) {
+    sendError(MSG_ERR_PLAN_CPU, (PLAN_CPU_MAX * 1.0E4 - dacUs) / sampleUs);
+    return false;
+  }
+  if (rate * frame > linkMax) {
+    sendError(MSG_ERR_PLAN_LINK, linkMax / frame);
+    if (streamMode != STREAM_PACKED && rate * PLAN_FRAME_BYTES[STREAM_PACKED] <= linkMax) {
+      sendInfo(MSG_PLAN_USE_PACKED, STREAM_PACKED);
+    }
+    return false;
+  }
+  //lost record must still be in the history when its retransmission request arrives
+  if (streamMode == STREAM_PACKED && frame && rate * STREAM_RTT_MS > STREAM_HIST_LEN * 1000.0) {
+    sendError(MSG_ERR_PLAN_RTX, STREAM_HIST_LEN * 1000L / STREAM_RTT_MS);
+    return false;
+  }
+  if (report) sendInfo(MSG_PLAN_OK);
+  return true;
+}
+
+/* Send catalog message to user
+    binary frame (MSG_BINARY) for machine consumers, or
+    prefixed text from flash (MSG_VERBOSE), value appended if hasValue
+*/
+size_t sendMsg(char type, byte code, long value, boolean hasValue) {
+  size_t n = 0;
+  if (code >= MSG_COUNT || bootState != BOOT_DONE) return 0;
+  if (MSG_BINARY) {
+    n += Serial.write(type);
+    n += Serial.write(code);
+    for (byte i = 0; i < 4; i++) {
+      n += Serial.write((uint8_t)(value >> (8 * i)));
+    }
+    n += Serial.write(13); //cr
+  }
+  if (MSG_VERBOSE) {
+    n += Serial.print(type == MSG_ERROR ? F("Error: ") : F("Info: "));
+    n += Serial.print((const __FlashStringHelper *)pgm_read_ptr(&MSG_TEXT[code]));
+    if (hasValue) {
+      n += Serial.print(' ');
+      n += Serial.print(value);
+    }
+    n += Serial.println();
+  }
+  return n;
+}
+
+//Send error message (catalog code) to user
+//messages are discarded until the BLE link is ready (bootTask())
+size_t sendError(byte code) {
+  return sendMsg(MSG_ERROR, code, 0, false);
+}
+
+//Send error message (catalog code) with value to user
+size_t sendError(byte code, long value) {
+  return sendMsg(MSG_ERROR, code, value, true);
+}
+
+//Send info message (catalog code) to user
+size_t sendInfo(byte code) {
+  return sendMsg(MSG_INFO, code, 0, false);
+}
+
+//Send info message (catalog code) with value to user
+size_t sendInfo(byte code, long value) {
+  return sendMsg(MSG_INFO, code, value, true);
+}
+
+
+/* Send potentiostat sample (dacOut, PS_adc1_diff_0_1) in selected stream mode
+*/
+void sendSample() {
+  unsigned long tick = (unsigned long)(tSample >> STREAM_TICK_SHIFT);
+  if (psChannels > 1 && streamMode == STREAM_STD) {
+    //channel tag, applies to the following frame
+    Serial.write('N');
+    Serial.write(psCh);
+  }
+  if (streamMode == STREAM_PACKED) {
+    int16_t adc = PS_adc1_diff_0_1;
+    frameStart();
+    if (psChannels > 1) {
+      //channel tag, applies to this record
+      frameWrite('N');
+      frameWrite(psCh);
+    }
+    if (streamCount >= STREAM_KEY_INTERVAL) {
+      //keyframe, absolute values
+      frameWrite('K');
+      frameWrite(streamSeq);
+      frameWrite((uint8_t)(dacOut & 0XFF));
+      frameWrite((uint8_t)(dacOut >> 8));
+      frameWrite((uint8_t)(adc & 0XFF));
+      frameWrite((uint8_t)(adc >> 8));
+      for (byte i = 0; i < 4; i++) {
+        frameWrite((uint8_t)(tick >> (8 * i)));
+      }
+      streamDacStep = 0;
+      streamTickStep = 0;
+      streamCount = 0;
+    } else {
+      //delta record, DAC and tick predicted from previous step, DAC step and its change mod 2^16
+      int16_t step = (int16_t)(dacOut - streamDac);
+      unsigned long tickStep = tick - streamTick;
+      frameWrite('D');
+      frameWrite(streamSeq);
+      writeVarint((int16_t)(step - streamDacStep));
+      writeVarint((long)adc - streamAdc);
+      writeVarint((long)(tickStep - streamTickStep));
+      streamDacStep = step;
+      streamTickStep = tickStep;
+    }
+    frameEnd();
+    streamDac = dacOut;
+    streamAdc = adc;
+    streamTick = tick;
+    streamCount++;
+    //keep in history, then send one queued retransmission
+    StreamSample *h = &streamHist[streamSeq & (STREAM_HIST_LEN - 1)];
+    h->dac = dacOut;
+    h->adc = adc;
+    h->tick = tick;
+    h->ch = psCh;
+    streamSeq++;
+    if (nRtx > 0) {
+      sendRetransmit(rtxQueue[0]);
+      nRtx--;
+      memmove(rtxQueue, rtxQueue + 1, nRtx);
+    }
+  }
+  else if (streamMode == STREAM_STD) { /* Standard raw data msg */
+    //Interface is expecting signed 32bit integer so data
+    //must be padded with leading 0's or 1's depending on sign
+    uint8_t fillBits = 0;
+    if (PS_adc1_diff_0_1 < 0) fillBits = 0XFF;
+
+    Serial.write('B'); //signify new data follows
+    Serial.write(13); //cr
+    Serial.flush();
+    //Send Data
+
+    //DAC output
+    Serial.write((uint8_t)(dacOut & 0XFF));
+    Serial.write((uint8_t)(dacOut >> 8));
+
+    //ADC input
+    Serial.write((uint8_t)(PS_adc1_diff_0_1 & 0XFF));
+    Serial.write((uint8_t)(PS_adc1_diff_0_1 >> 8));
+    Serial.write(fillBits);
+    Serial.write(fillBits);
+    Serial.write(13); //cr
+    Serial.flush();
+  }
+  else /* debug / csv style msg */
+  {
+    Serial.print(dacOut);
+    Serial.write(',');
+    Serial.print(vOut);
+    Serial.write(',');
+    Serial.print(iIn);
+    Serial.write(',');
+    Serial.print((unsigned long)tSample);
+    if (psChannels > 1) {
+      Serial.write(',');
+      Serial.print(psCh);
+    }
+    Serial.println();
+  }
+}
+
+//Add execution time since t0 (micros()) to profiler slot
+void profEnd(byte slot, unsigned long t0) {
+  unsigned long t = micros() - t0;
+  unsigned int tc = t > 0XFFFF ? 0XFFFF : t;
+  if (profN[slot] == 0 || tc < profMin[slot]) profMin[slot] = tc;
+  if (tc > profMax[slot]) profMax[slot] = tc;
+  profSum[slot] += t;
+  profN[slot]++;
+}
+
+/* Send profiler statistics as one JSON line and reset them, e.g.
+    {"sr":20,"sync":0,"prof":[{"fn":"calcInterval","n":512,"min":36,"max":52,"mean":40},...]}
+    sr / sync = sample rate and sync sampling (DPV) of the current experiment config
+*/
+void sendProfile() {
+  Serial.print(F("{\"sr\":"));
+  Serial.print(e.sampRate);
+  Serial.print(F(",\"sync\":"));
+  Serial.print(e.syncSamplingEN);
+  Serial.print(F(",\"prof\":["));
+  for (byte i = 0; i < PROF_COUNT; i++) {
+    if (i) Serial.print(',');
+    Serial.print(F("{\"fn\":\""));
+    Serial.print((const __FlashStringHelper *)pgm_read_ptr(&PROF_NAME[i]));
+    Serial.print(F("\",\"n\":"));
+    Serial.print(profN[i]);
+    Serial.print(F(",\"min\":"));
+    Serial.print(profN[i] ? profMin[i] : 0);
+    Serial.print(F(",\"max\":"));
+    Serial.print(profMax[i]);
+    Serial.print(F(",\"mean\":"));
+    Serial.print(profN[i] ? profSum[i] / profN[i] : 0);
+    Serial.print('}');
+    profN[i] = 0;
+    profSum[i] = 0;
+    profMax[i] = 0;
+  }
+  Serial.println(F("]}"));
+}
+
+//Load benchmark config c (BENCH_CMD) as a virtual run, false if the command is rejected
+boolean benchConfig(byte c) {
+  benchCmd = c;
+  virtualRun = true;
+  strcpy_P(cmdBuf, (const char *)pgm_read_ptr(&BENCH_CMD[c]));
+  return parseRunCmd(cmdBuf, strlen(cmdBuf));
+}
+
+//Set up call i of kernel k (not timed): experiment time i / BENCH_CALLS of the first two cycles
+void benchPrep(byte k, byte i) {
+  if (i == 0) {
+    currInterval = INTERVAL_NA;
+    currCycle = -1;
+  }
+  unsigned long span = e.tOffset + e.tCycle * (e.cycles < 2 ? e.cycles : 2);
+  benchT = e.tClean + e.tDep + (uint64_t)span * i / BENCH_CALLS;
+  if (k != BENCH_CALC_INTERVAL) calcInterval(benchT);
+  if (k == BENCH_SCALE_OUTPUT || k == BENCH_SEND_SAMPLE) vOut = calcOutput(tInt, currCycle);
+  if (k == BENCH_SEND_SAMPLE) {
+    dacOut = scaleOutput(vOut);
+    PS_adc1_diff_0_1 = (int16_t)(dacOut - DACVAL0) / 4;
+    tSample = benchT;
+    Serial.flush();
+  }
+  if (k == BENCH_PARSE_RUN) strcpy_P(cmdBuf, (const char *)pgm_read_ptr(&BENCH_CMD[benchCmd]));
+}
+
+//Timed part of kernel k
+void benchCall(byte k) {
+  switch (k) {
+    case BENCH_CALC_INTERVAL:
+      calcInterval(benchT);
+      break;
+    case BENCH_CALC_OUTPUT:
+      vOut = calcOutput(tInt, currCycle);
+      break;
+    case BENCH_SCALE_OUTPUT:
+      dacOut = scaleOutput(vOut);
+      break;
+    case BENCH_PARSE_RUN:
+      parseRunCmd(cmdBuf, strlen(cmdBuf));
+      break;
+    case BENCH_SEND_SAMPLE:
+      sendSample();
+      break;
+    case BENCH_WQM_MEAS:
+      getMeasurementsWQM();
+      break;
+  }
+}
+
+/* Benchmark build (BENCH_EN), called from setup(): cycles per kernel call from Timer1 without
+    prescaler (one overflow counted, calls up to 8 ms), read overhead subtracted, one JSON line per
+    kernel and config, e.g.
+    {"fn":"calcOutput","exp":"CV","n":64,"min":612,"max":980,"mean":701}
+    then the CPU halts with interrupts off, which ends a simavr run (tools/bench.py)
+*/
+void benchRun() {
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+  TIMSK1 = 0;
+  uint16_t t0 = TCNT1;
+  uint16_t ovh = TCNT1 - t0;
+  for (byte c = 0; c < BENCH_CONFIGS; c++) {
+    for (byte k = 0; k < BENCH_KERNELS; k++) {
+      if (!benchConfig(c)) continue;
+      unsigned long sum = 0, lo = 0XFFFFFFFFUL, hi = 0;
+      for (byte i = 0; i < BENCH_CALLS; i++) {
+        benchPrep(k, i);
+        TIFR1 = _BV(TOV1);
+        t0 = TCNT1;
+        benchCall(k);
+        unsigned long n = (uint16_t)(TCNT1 - t0) - ovh;
+        if ((TIFR1 & _BV(TOV1)) && n < 0X8000) n += 0X10000UL;
+        sum += n;
+        if (n < lo) lo = n;
+        if (n > hi) hi = n;
+      }
+      Serial.flush();
+      Serial.print(F("{\"fn\":\""));
+      Serial.print((const __FlashStringHelper *)pgm_read_ptr(&BENCH_NAME[k]));
+      Serial.print(F("\",\"exp\":\""));
+      Serial.print((const __FlashStringHelper *)pgm_read_ptr(&BENCH_EXP[c]));
+      Serial.print(F("\",\"n\":"));
+      Serial.print(BENCH_CALLS);
+      Serial.print(F(",\"min\":"));
+      Serial.print(lo);
+      Serial.print(F(",\"max\":"));
+      Serial.print(hi);
+      Serial.print(F(",\"mean\":"));
+      Serial.print(sum / BENCH_CALLS);
+      Serial.println('}');
+    }
+  }
+  Serial.flush();
+  cli();
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  sleep_enable();
+  sleep_cpu();
+}
+
+//Queue trace record (TRACE_EN), safe to call from ISRs
+//outside ISRs queued records are sent first while the queue is half full, so none are lost
+void trace(byte type, byte arg, uint16_t data) {
+  unsigned long us = micros(); //time of the event, not of the queue space
+  if (type != TR_ISR && bootState == BOOT_DONE) {
+    while (((traceHead - traceTail) & (TRACE_LEN - 1)) >= TRACE_LEN / 2) traceSend();
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    byte next = (traceHead + 1) & (TRACE_LEN - 1);
+    if (next == traceTail) {
+      traceDropped++;
+    } else {
+      TraceRec *r = &traceBuf[traceHead];
+      r->type = type;
+      r->arg = arg;
+      r->data = data;
+      r->us = us;
+      traceHead = next;
+    }
+  }
+}
+
+//Send queued trace records while the serial tx buffer has room, lost records reported first (TR_DROP)
+void traceFlush() {
+  if (bootState != BOOT_DONE) return;
+  unsigned int n;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    n = traceDropped;
+    traceDropped = 0;
+  }
+  if (n) trace(TR_DROP, 0, n);
+  while (traceTail != traceHead && Serial.availableForWrite() >= TRACE_FRAME) traceSend();
+}
+
+//Send the oldest queued trace record (SLIP frame), blocks while the serial tx buffer is full
+void traceSend() {
+  TraceRec r = traceBuf[traceTail];
+  frameStart();
+  frameWrite('Z');
+  frameWrite(r.type);
+  frameWrite(r.arg);
+  frameWrite(r.data & 0XFF);
+  frameWrite(r.data >> 8);
+  for (byte i = 0; i < 4; i++) frameWrite((uint8_t)(r.us >> (8 * i)));
+  frameEnd();
+  traceTail = (traceTail + 1) & (TRACE_LEN - 1);
+}
+
+/* Sleep in AVR idle mode until the next interrupt, timers, USART and TWI keep running
+    Wake-up from idle takes a few clock cycles, so sample timing is set by the ISRs as before.
+    The ADS1115s use single-shot conversions (Adafruit lib) and power down between samples.
+    Flags are checked with interrupts disabled, sei() executes the next instruction (sleep)
+    before any pending interrupt, so a flag set after the check always wakes the CPU.
+*/
+void idleSleep() {
+  if (cmdState != CMD_IDLE || vrActive || Serial.available()) return;
+  if (DUAL_LINK_EN && btOut.available()) return;
+  unsigned long t0 = micros();
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  if (!startDAC && !PS_startADC && !WQM_startADC) {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+  }
+  sei();
+  tSleepAcc += micros() - t0;
+}
+
+//Record time from timer event (ISR) to handling in loop()
+void trackWake() {
+  unsigned long t;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    t = tEvent;
+  }
+  t = micros() - t;
+  if (t > tWakeMax) tWakeMax = t;
+}
+
+//Start new idle statistics period (experiment start)
+void resetIdleStats() {
+  tIdleStart = microsExt();
+  tSleepAcc = 0;
+  tWakeMax = 0;
+}
+
+/* Decimated sample for bluetooth link, average ADC code of btDecim samples
+    queued as standard raw data msg ('B' CR dac(2) adc(4) CR)
+*/
+void btSample() {
+  if (btDecim == 0) return;
+  btAdcSum += PS_adc1_diff_0_1;
+  if (++btCount < btDecim) return;
+  int16_t adc = btAdcSum / btDecim;
+  uint8_t fillBits = adc < 0 ? 0XFF : 0;
+  btOut.write('B');
+  btOut.write(13); //cr
+  btOut.write((uint8_t)(dacOut & 0XFF));
+  btOut.write((uint8_t)(dacOut >> 8));
+  btOut.write((uint8_t)(adc & 0XFF));
+  btOut.write((uint8_t)(adc >> 8));
+  btOut.write(fillBits);
+  btOut.write(fillBits);
+  btOut.write(13); //cr
+  btCount = 0;
+  btAdcSum = 0;
+}
+
+/* Send queued bytes on bluetooth link (SoftwareSerial) for max BT_SLOT_US
+    longest slot recorded in btSlotMax (measured transmit cost)
+*/
+void btService() {
+#if DUAL_LINK_EN
+  unsigned long t0 = micros();
+  unsigned long t = 0;
+  while (btOut.available() && t + BT_BYTE_US <= BT_SLOT_US) {
+    Serial_BT.write(btOut.read());
+    t = micros() - t0;
+  }
+  if (t > btSlotMax) btSlotMax = t;
+#endif
+}
+
+//Send sync record, device time for host clock drift estimation (STREAM_PACKED)
+void sendSync() {
+  uint64_t t = microsExt();
+  frameStart();
+  frameWrite('T');
+  for (byte i = 0; i < 8; i++) {
+    frameWrite((uint8_t)(t >> (8 * i)));
+  }
+  frameEnd();
+  tSync = millis();
+}
+
+/* Resend sample seq from history ('R'), or 'X' if it is no longer available
+*/
+void sendRetransmit(byte seq) {
+  byte age = streamSeq - seq; //samples sent since seq, mod 256
+  frameStart();
+  if (age == 0 || age > STREAM_HIST_LEN) {
+    frameWrite('X');
+    frameWrite(seq);
+    frameEnd();
+    return;
+  }
+  StreamSample *h = &streamHist[seq & (STREAM_HIST_LEN - 1)];
+  if (psChannels > 1) {
+    frameWrite('N');
+    frameWrite(h->ch);
+  }
+  frameWrite('R');
+  frameWrite(seq);
+  frameWrite((uint8_t)(h->dac & 0XFF));
+  frameWrite((uint8_t)(h->dac >> 8));
+  frameWrite((uint8_t)(h->adc & 0XFF));
+  frameWrite((uint8_t)(h->adc >> 8));
+  for (byte i = 0; i < 4; i++) {
+    frameWrite((uint8_t)(h->tick >> (8 * i)));
+  }
+  frameEnd();
+}
+
+//Force keyframe and sync record on next packed stream sample (new experiment)
+void resetStream() {
+  streamCount = STREAM_KEY_INTERVAL;
+  streamSeq = 0;
+  nRtx = 0;
+  tSync = millis() - STREAM_SYNC_INTERVAL;
+}
+
+//Start SLIP frame of a packed stream record, END also terminates any garbage before it
+void frameStart() {
+  Serial.write(SLIP_END);
+  frameCrc = 0XFF;
+}
+
+//Write record byte to the frame, END / ESC escaped
+void frameWrite(uint8_t b) {
+  frameCrc = _crc8_ccitt_update(frameCrc, b);
+  if (b == SLIP_END) {
+    Serial.write(SLIP_ESC);
+    b = SLIP_ESC_END;
+  } else if (b == SLIP_ESC) {
+    Serial.write(SLIP_ESC);
+    b = SLIP_ESC_ESC;
+  }
+  Serial.write(b);
+}
+
+//Close frame, CRC-8 of the record (escaped) and END
+void frameEnd() {
+  uint8_t crc = frameCrc;
+  frameWrite(crc);
+  Serial.write(SLIP_END);
+}
+
+//Write zigzag encoded variable length integer to the frame (STREAM_PACKED)
+void writeVarint(long n) {
+  unsigned long z = ((unsigned long)n << 1) ^ (unsigned long)(n >> 31);
+  while (z >= 0x80) {
+    frameWrite((uint8_t)(z | 0x80));
+    z >>= 7;
+  }
+  frameWrite((uint8_t)z);
+}
+
+/* Calculate output voltage (float) based on current interval (global var),
+    experiment interval time (ti), current cycle (c), and current
+    experiment configuration (global var)
 */
 float calcOutput(unsigned long ti, unsigned int c) {
   float vout;
-  unsigned long timeEx = micros();
+  unsigned long timeEx = PROF_EN ? micros() : 0;
   if (currInterval == INTERVAL_CLEAN) {
     vout = e.vClean;
   } else if (currInterval == INTERVAL_DEP) {
     vout = e.vDep;
+  } else if (currInterval == INTERVAL_EXP1 && expType == EXP_EIS) {
+    //impedance, sine around DC potential
+    vout = e.vStart[0] + e.vStart[1] * sinQ15(eisPhase(ti)) / 32768.0;
   } else if (currInterval == INTERVAL_EXP1) {
     //in active experiment region, 1st interval
     vout = e.vStart[0] + e.vSlope[0] * (float)ti + (float)c * e.offset;
@@ -884,8 +2562,7 @@ float calcOutput(unsigned long ti, unsigned int c) {
   } else {
     vout = 0.0;
   }
-  timeEx = micros() - timeEx;
-  //Serial.println(timeEx);
+  if (PROF_EN) profEnd(PROF_CALC_OUTPUT, timeEx);
   return vout;
 }
 
@@ -893,7 +2570,7 @@ float calcOutput(unsigned long ti, unsigned int c) {
 */
 uint16_t scaleOutput(float in) {
   uint16_t scaled;
-  unsigned long timeEx = micros();
+  unsigned long timeEx = PROF_EN ? micros() : 0;
   if (in >= 1.5) {
     //desired output out of range (>1.5V)
     //scaled = 4095;
@@ -910,39 +2587,69 @@ uint16_t scaleOutput(float in) {
       scaled += 1;
     }
   }
-  timeEx = micros() - timeEx;
-  //Serial.println(timeEx);
+  if (PROF_EN) profEnd(PROF_SCALE_OUTPUT, timeEx);
   return scaled;
 }
 
+/* micros() extended to 64 bits, must be called at least once per micros() overflow (~71 min),
+    called by every loop() pass, also while idle
+*/
+uint64_t microsExt() {
+  unsigned long t = micros();
+  if (t < tMicrosLast) tMicrosHigh++;
+  tMicrosLast = t;
+  return ((uint64_t)tMicrosHigh << 32) | t;
+}
+
 /* Calculate current experiment interval and cycle based on experiment time
     if interval is a exp. cycle interval, set global var tInt
     reset syncADCcomplete on new cycle
 
+    Cycle and interval phase are tracked incrementally (tCycleStart, tPhaseStart) with
+    32 bit differences, valid as calcInterval() is called every DAC update. currCycle < 0
+    on entering the active region initializes them.
+
     TODO this will probably need to be adjusted when DPV is added as there will be many
     cycles per scan, modify to check # of scans and cycles before marking experiment complete,
     and increment scans as appropriate (after every two cycles for CV)
 */
-void calcInterval(unsigned long t) {
+void calcInterval(uint64_t t) {
   byte prevInterval = currInterval;
-  unsigned long timeEx = micros();
+  unsigned long timeEx = PROF_EN ? micros() : 0;
   if (t < e.tClean) {
     currInterval = INTERVAL_CLEAN;
     tInt = 0;
     currCycle = -1;
   }
-  else if (t < (e.tClean + e.tDep)) {
+  else if (t < ((uint64_t)e.tClean + e.tDep)) {
     currInterval = INTERVAL_DEP;
     tInt = 0;
     currCycle = -1;
   }
   else {
     //in active experiment region
+    unsigned long tLow = (unsigned long)t;
+    if (currCycle < 0) {
+      //start of active region, cycles counted from end of deposition, interval time offset by tOffset
+      currCycle = 0;
+      tCycleStart = e.tClean + e.tDep;
+      tPhaseStart = tCycleStart - e.tOffset;
+    }
     //determine current cycle
-    currCycle = (t - e.tClean - e.tDep) / e.tCycle;
+    boolean newCycle = false;
+    while (e.tCycle > 0 && tLow - tCycleStart >= e.tCycle && currCycle < e.cycles) {
+      tCycleStart += e.tCycle;
+      currCycle++;
+      newCycle = true;
+    }
+    //pending live parameter update takes effect at cycle boundary
+    if (newCycle && eNextPending && currCycle < e.cycles) applyUpdate(currCycle);
     //calc interval time
-    tInt = (t - (e.tClean + e.tDep) + e.tOffset) % e.tCycle;
-    if (currCycle >= e.cycles) {
+    while (e.tCycle > 0 && tLow - tPhaseStart >= e.tCycle) {
+      tPhaseStart += e.tCycle;
+    }
+    tInt = tLow - tPhaseStart;
+    if (currCycle >= e.cycles || e.tCycle == 0) {
       //experiment complete
       currInterval = INTERVAL_DN;
     }
@@ -952,7 +2659,7 @@ void calcInterval(unsigned long t) {
         //new interval, reset sync ADC
         syncADCcompleteFWD = false;
         syncADCcompleteREV = false;
-        if (prevInterval == INTERVAL_EXP2) Serial.println("S"); //send new scan char, TODO: update when DPV added
+        if (prevInterval == INTERVAL_EXP2 && !virtualRun) Serial.println(F("S")); //send new scan char, TODO: update when DPV added
       }
       currInterval = INTERVAL_EXP1;
     } else {
@@ -960,19 +2667,48 @@ void calcInterval(unsigned long t) {
       currInterval = INTERVAL_EXP2;
     }
   }
-  timeEx = micros() - timeEx;
-  //Serial.println(timeEx);
+  if (PROF_EN) profEnd(PROF_CALC_INTERVAL, timeEx);
 }
 
-/* Issue write command to DAC via I2C, return without writing if no shield (potentiostat) present */
+/* Issue write command to the DAC of every channel via I2C, return without writing if no shield (potentiostat) present */
 void writeDAC(uint16_t value) {
-  if (!PS_Present)
-    return;
-  Wire.beginTransmission(0x1C);
-  Wire.write((uint8_t)0x01);
-  Wire.write((uint8_t)(value >> 8));
-  Wire.write((uint8_t)(value & 0XFF));
-  Wire.endTransmission(0x1C);
+  for (byte ch = 0; ch < psChannels; ch++) {
+    uint8_t addr = pgm_read_byte(&PS_CH[ch].dac);
+    if (TRACE_EN) trace(TR_DAC, addr, value);
+    if (!PS_Present)
+      continue;
+    Wire.beginTransmission(addr);
+    Wire.write((uint8_t)0x01);
+    Wire.write((uint8_t)(value >> 8));
+    Wire.write((uint8_t)(value & 0XFF));
+    Wire.endTransmission(addr);
+  }
+}
+
+/* Find channels present, 1st channel is the shield detected by PS_BrdPresent
+    further channels counted while their DAC and ADC acknowledge on I2C, gain mux pins set as outputs
+*/
+void initChannels() {
+  psChannels = 1;
+  while (psChannels < PS_CHANNELS) {
+    Wire.beginTransmission(pgm_read_byte(&PS_CH[psChannels].dac));
+    if (Wire.endTransmission() != 0) break;
+    Wire.beginTransmission(pgm_read_byte(&PS_CH[psChannels].adc));
+    if (Wire.endTransmission() != 0) break;
+    psChannels++;
+  }
+  for (byte ch = 0; ch < psChannels; ch++) {
+    pinMode(pgm_read_byte(&PS_CH[ch].mux0), OUTPUT);
+    pinMode(pgm_read_byte(&PS_CH[ch].mux1), OUTPUT);
+  }
+  selectChannel(0);
+}
+
+//Select channel ch for the following ADC reads (sample, calibration), same gain setting, its calibration
+void selectChannel(byte ch) {
+  gCal = &cal[ch].g[gCal - cal[psCh].g];
+  psCh = ch;
+  PS_adc1.setAddress(pgm_read_byte(&PS_CH[ch].adc));
 }
 
 /* Start timer used for to trigger interrupt for ADC conversion
@@ -985,33 +2721,39 @@ void startTimerADC()
   TCCR1B = 0;
 
   if (!e.syncSamplingEN) {
+    byte prescale;
     // Set timer1_counter to the correct value for our interrupt interval
-    timer1_preload = 131;
-
-    if (e.sampRate > 30) {
-      // 8x prescaler
-      TCCR1B |= (1 << CS11);
-      // preload timer 65536-16MHz/8/XXHz
-      timer1_preload = 65536 - (2000000 / e.sampRate);
-      //check if result should be rounded up
-      if (2000000 % e.sampRate > e.sampRate / 2)
-        timer1_preload += 1;
-    } else {
-      // 64x prescaler
-      TCCR1B |= (1 << CS10);
-      TCCR1B |= (1 << CS11);
-      // preload timer 65536-16MHz/64/XXHz
-      timer1_preload = 65536 - (250000 / e.sampRate);
-      //check if result should be rounded up
-      if (250000 % e.sampRate > e.sampRate / 2)
-        timer1_preload += 1;
-    }
+    calcTimer1(e.sampRate, &timer1_preload, &prescale);
+    TCCR1B = prescale;
     TIMSK1 |= (1 << TOIE1);   // enable timer overflow interrupt
     TCNT1 = timer1_preload;   // preload timer
     samplingStarted = true;
   }
 }
 
+/* Calculate Timer1 preload and prescaler (TCCR1B) for ADC sampling rate (Hz)
+*/
+void calcTimer1(unsigned int rate, unsigned int * preload, byte * prescale)
+{
+  if (rate > 30) {
+    // 8x prescaler
+    *prescale = (1 << CS11);
+    // preload timer 65536-16MHz/8/XXHz
+    *preload = 65536 - (2000000 / rate);
+    //check if result should be rounded up
+    if (2000000 % rate > rate / 2)
+      *preload += 1;
+  } else {
+    // 64x prescaler
+    *prescale = (1 << CS10) | (1 << CS11);
+    // preload timer 65536-16MHz/64/XXHz
+    *preload = 65536 - (250000 / rate);
+    //check if result should be rounded up
+    if (250000 % rate > rate / 2)
+      *preload += 1;
+  }
+}
+
 /* Start timer used for to trigger interrupt for DAC conversion
     Timer preload/prescalers based on desired DAC output rate
 */
@@ -1057,56 +2799,237 @@ void flashLed(byte n, unsigned int d) {
   }
 }
 
+//Flash Arduino board led n times with on/off time of d ms without blocking, toggled by flashTask()
+void startFlash(byte n, unsigned int d) {
+  ledToggles = n * 2;
+  ledFlashMs = d;
+  tLed = millis() - d;
+}
+
+//Toggle LEDs of non-blocking flash when due, called every loop()
+void flashTask() {
+  if (ledToggles == 0 || millis() - tLed < ledFlashMs) return;
+  digitalWrite(MB_LED, digitalRead(MB_LED) ^ 1);
+  digitalWrite(EXT_LED, digitalRead(MB_LED) ^ 1);
+  tLed = millis();
+  ledToggles--;
+}
+
 
 //Select feedback resistance based on gain selection (0-7)
 void setGain(byte n) {
-  //Set feedback resistance based on selection
+  //Set feedback resistance based on selection, same on all channels
+  byte m0 = 0;
+  byte m1 = 0;
   switch (n / 2)
   {
     case 0:
       //NO1, RG = RG1
-      rGain = RGAIN1;
-      digitalWrite(PS_MUX0, 0);
-      digitalWrite(PS_MUX1, 0);
+      m0 = 0;
+      m1 = 0;
       break;
     case 1:
       //NO2, RG = RG2
-      rGain = RGAIN2;
-      digitalWrite(PS_MUX0, 1);
-      digitalWrite(PS_MUX1, 0);
+      m0 = 1;
+      m1 = 0;
       break;
     case 2:
       //NO3, RG = RG3
-      rGain = RGAIN3;
-      digitalWrite(PS_MUX0, 0);
-      digitalWrite(PS_MUX1, 1);
+      m0 = 0;
+      m1 = 1;
       break;
     case 3:
       //NO3, RG = RG4
-      rGain = RGAIN4;
-      digitalWrite(PS_MUX0, 1);
-      digitalWrite(PS_MUX1, 1);
+      m0 = 1;
+      m1 = 1;
       break;
     default:
       //Invalid selection
       programFail(3);
       break;
   }
+  for (byte ch = 0; ch < psChannels; ch++) {
+    digitalWrite(pgm_read_byte(&PS_CH[ch].mux0), m0);
+    digitalWrite(pgm_read_byte(&PS_CH[ch].mux1), m1);
+  }
   if (n % 2) {
     //n = 1,3,5, or 7
     PS_adc1.setGain(GAIN_SIXTEEN);
-    rGain = rGain * 4;
   } else {
     //n = 0,2,4 or 6
     PS_adc1.setGain(GAIN_FOUR);// set PGA gain to 4 (LSB=0.03125 mV, FSR=+/-1.048)
   }
+  gCal = &cal[psCh].g[n];
+}
+
+/* Convert raw TIA ADC code to current (pA) using calibration of the selected gain
+    fixed point multiply and shift only, called for every potentiostat sample
+*/
+long convCurrent(int16_t code) {
+  long d = (long)code - gCal->offset;
+  d = constrain(d, -32768L, 32767L);
+  return ((long)(int16_t)d * (long)gCal->scale) >> gCal->shift;
+}
+
+/* Set scale of gain setting n of channel ch from current per ADC code (pA)
+    scale is normalized to use the full 16 bit range for best resolution
+*/
+void setCalScale(byte ch, byte n, float pA) {
+  uint8_t shift = 0;
+  while (pA < 32768.0 && shift < 31) {
+    pA *= 2.0;
+    shift++;
+  }
+  cal[ch].g[n].scale = pA < 65535.0 ? (uint16_t)(pA + 0.5) : 65535;
+  cal[ch].g[n].shift = shift;
+}
+
+//Set calibration table of channel ch to nominal values (RGAIN1..4, no offset)
+void defaultCal(byte ch) {
+  const float rg[4] = {RGAIN1, RGAIN2, RGAIN3, RGAIN4};
+  cal[ch].magic = CAL_MAGIC;
+  for (byte n = 0; n <= MAX_GAIN; n++) {
+    cal[ch].g[n].offset = 0;
+    //16X PGA setting has 1/4 of the LSB of the 4X setting
+    setCalScale(ch, n, PS_ADC_LSB * 1.0E6 / rg[n / 2] / ((n % 2) ? 4.0 : 1.0));
+  }
+  cal[ch].checksum = calChecksum(ch);
+}
+
+//EEPROM address of the calibration table of channel ch
+int calEeAddr(byte ch) {
+  return ch ? CAL_CH_EE_ADDR + (ch - 1) * CAL_EE_LEN : CAL_EE_ADDR;
+}
+
+/* Load calibration tables from EEPROM, nominal values are used for a channel without valid table
+    returns: true if the stored tables of all channels present are valid
+*/
+boolean loadCal() {
+  boolean ok = true;
+  for (byte ch = 0; ch < PS_CHANNELS; ch++) {
+    EEPROM.get(calEeAddr(ch), cal[ch]);
+    if (cal[ch].magic != CAL_MAGIC || cal[ch].checksum != calChecksum(ch)) {
+      defaultCal(ch);
+      if (ch < psChannels) ok = false;
+    }
+  }
+  return ok;
+}
+
+//Store calibration tables of the channels present in EEPROM
+void saveCal() {
+  for (byte ch = 0; ch < psChannels; ch++) {
+    cal[ch].magic = CAL_MAGIC;
+    cal[ch].checksum = calChecksum(ch);
+    EEPROM.put(calEeAddr(ch), cal[ch]);
+  }
+}
+
+//Sum of calibration table bytes of channel ch (excl. checksum)
+uint8_t calChecksum(byte ch) {
+  uint8_t sum = 0;
+  uint8_t *p = (uint8_t *)&cal[ch];
+  for (byte i = 0; i < offsetof(CalTable, checksum); i++) {
+    sum += p[i];
+  }
+  return sum;
+}
+
+//Average of CAL_SAMPLES TIA ADC reads
+int16_t readAvgADC() {
+  long sum = 0;
+  for (byte i = 0; i < CAL_SAMPLES; i++) {
+    int16_t code = PS_adc1.readADC_Differential_0_1();
+    if (TRACE_EN) trace(TR_ADC, PS_adc1.address(), code);
+    sum += code;
+  }
+  return sum / CAL_SAMPLES;
+}
+
+/* Self calibration of all gain settings of every channel present
+    Offset: WE switch opened (zero current), ADC code averaged
+    Scale: WE switch closed with calibration resistor rcal (ohm) connected to the cell
+    terminals, +V and -V applied, scale = (2V / rcal) / (code(+V) - code(-V))
+    V is chosen to use half of the gain setting's range, limited to CAL_V_MAX.
+    Gain settings where V < CAL_V_MIN (or rcal = 0) keep the nominal scale.
+    All DACs are written, so every channel is calibrated with its own rcal connected.
+
+    returns: true if calibration completed and was stored in EEPROM
+*/
+boolean calibrate(long rcal) {
+  if (!PS_Present || expStarted) {
+    sendError(MSG_ERR_CAL);
+    return false;
+  }
+  sendInfo(MSG_CAL_START);
+  for (byte ch = 0; ch < psChannels; ch++) {
+    selectChannel(ch);
+    defaultCal(ch);
+    for (byte n = 0; n <= MAX_GAIN; n++) {
+      setGain(n);
+
+      //zero current offset
+      digitalWrite(PS_WE_SwEn, OFF);
+      delay(CAL_SETTLE);
+      cal[ch].g[n].offset = readAvgADC();
+      digitalWrite(PS_WE_SwEn, ON);
+
+      if (rcal > 0) {
+        //nominal full scale current (pA) and potential giving half of it across rcal (mV)
+        float pA = (float)(32767L * (long)cal[ch].g[n].scale) / (float)(1UL << cal[ch].g[n].shift);
+        float mV = pA * 0.5E-9 * rcal;
+        if (mV > CAL_V_MAX) mV = CAL_V_MAX;
+        if (mV >= CAL_V_MIN) {
+          writeDAC(scaleOutput(mV / 1000.0));
+          delay(CAL_SETTLE);
+          int16_t codeP = readAvgADC();
+          writeDAC(scaleOutput(-mV / 1000.0));
+          delay(CAL_SETTLE);
+          int16_t codeN = readAvgADC();
+          if (codeP != codeN) {
+            setCalScale(ch, n, abs(2.0E9 * mV / rcal / (float)(codeP - codeN)));
+          }
+        }
+      }
+    }
+  }
+  writeDAC(DACVAL0);
+  selectChannel(0);
+  setGain(e.gain);
+  saveCal();
+  calStored = true;
+  sendInfo(MSG_CAL_DONE);
+  return true;
 }
 
 void startExperiment() {
-  printExp();//TODO: temp
-  flashLed(4, 150);
-  sendInfo("Starting Experiment");
-  tExpStart = micros();
+  startFlash(4, 150); //replaces a flash of the last experiment end, first sample not delayed
+  sendInfo(MSG_EXP_START);
+  tExpStart = microsExt();
+  currCycle = -1;
+  resetStream();
+  btCount = 0;
+  btAdcSum = 0;
+  btSlotMax = 0; //link statistics reported per experiment
+  btOut.dropped = 0;
+  if (IDLE_SLEEP_EN) resetIdleStats();
+  selectChannel(0);
+  setGain(e.gain);
+  if (COADD_EN && (coadd || bgMode)) coaddInit();
+  if (seriesN) {
+    seriesSeg = 0;
+    sendInfo(MSG_SERIES_SEG, 0);
+    sendInfo(MSG_SERIES_SLOPE, seriesSlope[0]);
+  }
+  if (IRCOMP_EN) {
+    iIn = 0;
+    irFresh = false;
+    irSlow = false;
+    irLatMax = 0;
+    irLatSum = 0;
+    irLatN = 0;
+  }
+  if (expType == EXP_EIS) eisStart();
   samplingStarted = false;
   startTimerDAC();
   expStarted = PS_EXP_RUNNING;
@@ -1121,9 +3044,526 @@ void finishExperiment() {
   tExpStart = 0;
   currCycle = 0;
   stopTimers();
+  if (expStarted == WQM_EXP_RUNNING && WQM_Present) setClSw(OFF);
   expStarted = 0;
+  expPaused = false;
+  eNextPending = false;
+  startDAC = false;
+  PS_startADC = false;
+  eisConv = false;
+  WQM_startADC = false;
   switchTimeACC = 0; //Reset WQM switch time
-  flashLed(2, 300);
+  selectChannel(0);
+  if (IRCOMP_EN && irLatN > 0) {
+    sendInfo(MSG_IR_LAT_MAX, irLatMax);
+    sendInfo(MSG_IR_LAT_MEAN, (long)(irLatSum / irLatN));
+    irLatN = 0;
+  }
+  if (DUAL_LINK_EN) {
+    sendInfo(MSG_BT_SLOT_MAX, btSlotMax);
+    sendInfo(MSG_BT_DROPPED, btOut.dropped);
+  }
+  if (IDLE_SLEEP_EN) {
+    //awake share of experiment time
+    uint64_t t = microsExt() - tIdleStart;
+    if (t > 0) sendInfo(MSG_IDLE_DUTY, (long)(((t - tSleepAcc) * 1000) / t));
+    sendInfo(MSG_WAKE_MAX, tWakeMax);
+  }
+  startFlash(2, 300);
+}
+
+/* Pause active experiment
+    timers stopped, DAC holds its output, experiment time frozen until resumed
+*/
+void pauseExperiment() {
+  if (!expStarted || expPaused) return;
+  stopTimers();
+  tPause = microsExt();
+  expPaused = true;
+  startDAC = false;
+  PS_startADC = false;
+  eisConv = false;
+  WQM_startADC = false;
+  sendInfo(MSG_EXP_PAUSED);
+}
+
+/* Resume paused experiment
+    start time shifted by paused duration so waveform continues at the same phase
+*/
+void resumeExperiment() {
+  if (!expPaused) return;
+  uint64_t dt = microsExt() - tPause;
+  expPaused = false;
+  if (expStarted == PS_EXP_RUNNING) {
+    tExpStart += dt;
+    samplingStarted = false; //ADC timer restarted on next DAC update
+    startTimerDAC();
+  } else {
+    tSwitchStart += (unsigned long)dt;
+    startTimerADC();
+  }
+  sendInfo(MSG_EXP_RESUMED);
+}
+
+//Sync sampling window: conversion of every channel must complete before the potential changes
+void setSyncOffset() {
+  e.syncOffset = PLAN_ADC_US * psChannels + 1000000UL / PLAN_DAC_RATE;
+  if (e.syncOffset < SYNC_OFFSET) e.syncOffset = SYNC_OFFSET;
+}
+
+/* Run experiment config on a virtual clock: DAC updates every 1/PLAN_DAC_RATE, samples at
+    sampRate from the start of the active region (CSV) or at the sync points (DPV, window of
+    setSyncOffset() as for a run), same calcInterval() / calcOutput() / scaleOutput() path as loop()
+    (eisInterval() for EIS), no hardware access.
+    Results are deterministic for a given config, so they can be compared with golden values.
+    The run is advanced by verifyTask() from loop(), VERIFY_STEPS DAC updates per call, commands are
+    read in between (R / C / D / V / U rejected as busy, X aborts), results sent at the end.
+*/
+void verifyStart(boolean points) {
+  setSyncOffset();
+  virtualRun = true;
+  currInterval = INTERVAL_NA;
+  currCycle = -1;
+  seriesSeg = 0;
+  if (expType == EXP_EIS) eisStart();
+  vr.t = 0;
+  vr.tNext = 0;
+  vr.tSamp = 1000000UL / e.sampRate;
+  vr.nDac = 0;
+  vr.crcDac = 0;
+  vr.sampling = false;
+  vr.points = points;
+  vrSamples = 0;
+  vrCrc = 0;
+  vrActive = true;
+}
+
+//Advance the verify run by VERIFY_STEPS DAC updates, results sent after the last one
+void verifyTask() {
+  const unsigned long tStep = 1000000UL / PLAN_DAC_RATE;
+  for (byte n = 0; n < VERIFY_STEPS; n++) {
+    calcInterval(vr.t);
+    if (expType == EXP_EIS && currInterval > INTERVAL_DEP) eisInterval(vr.t);
+    if (seriesN && currInterval == INTERVAL_DN && seriesSeg + 1 < seriesN) {
+      seriesNext(vr.t);
+      vr.tSamp = 1000000UL / e.sampRate;
+    }
+    if (currInterval >= INTERVAL_DN) {
+      verifyEnd(true);
+      return;
+    }
+    uint16_t code = scaleOutput(calcOutput(tInt, currCycle));
+    vr.crcDac = _crc_xmodem_update(vr.crcDac, code & 0XFF);
+    vr.crcDac = _crc_xmodem_update(vr.crcDac, code >> 8);
+    vr.nDac++;
+    if (!vr.sampling && !e.syncSamplingEN && currInterval > INTERVAL_DEP) {
+      vr.sampling = true;
+      vr.tNext = vr.t + vr.tSamp;
+    }
+    //samples until the next DAC update see this code
+    if (e.syncSamplingEN) {
+      if (!syncADCcompleteFWD && (tInt >= (e.tSwitch - e.syncOffset)) && (tInt < e.tSwitch)) {
+        syncADCcompleteFWD = true;
+        verifySample(code, vr.t, vr.points);
+      }
+      if (!syncADCcompleteREV && (tInt >= (e.tCycle - e.syncOffset))) {
+        syncADCcompleteREV = true;
+        verifySample(code, vr.t, vr.points);
+      }
+    }
+    while (vr.sampling && vr.tNext < vr.t + tStep) {
+      verifySample(code, vr.tNext, vr.points);
+      vr.tNext += vr.tSamp;
+    }
+    vr.t += tStep;
+  }
+}
+
+//End verify run, results sent if complete, config of the last run restored
+void verifyEnd(boolean complete) {
+  vrActive = false;
+  virtualRun = false;
+  currInterval = INTERVAL_NA;
+  currCycle = -1;
+  syncADCcompleteFWD = false;
+  syncADCcompleteREV = false;
+  if (complete) {
+    sendInfo(MSG_VR_DAC, vr.nDac);
+    sendInfo(MSG_VR_SAMPLES, vrSamples);
+    sendInfo(MSG_VR_CRC_DAC, vr.crcDac);
+    sendInfo(MSG_VR_CRC_SAMPLES, vrCrc);
+  }
+  restoreRun();
+}
+
+//Save config and run options of the last R before a command is parsed into them (R, D, V)
+void saveRun() {
+  savedRun.e = e;
+  savedRun.streamMode = streamMode;
+  savedRun.btDecim = btDecim;
+  savedRun.coadd = coadd;
+  savedRun.bgMode = bgMode;
+  savedRun.irRu = irRu;
+  savedRun.seriesN = seriesN;
+}
+
+void restoreRun() {
+  e = savedRun.e;
+  streamMode = savedRun.streamMode;
+  btDecim = savedRun.btDecim;
+  coadd = savedRun.coadd;
+  bgMode = savedRun.bgMode;
+  irRu = savedRun.irRu;
+  seriesN = savedRun.seriesN;
+}
+
+//Add sample of DAC code at virtual time t (us) to verify results
+void verifySample(uint16_t code, uint64_t t, boolean points) {
+  vrCrc = _crc_xmodem_update(vrCrc, code & 0XFF);
+  vrCrc = _crc_xmodem_update(vrCrc, code >> 8);
+  vrSamples++;
+  if (points) {
+    Serial.print(F("V,"));
+    Serial.print((unsigned long)t);
+    Serial.print(',');
+    Serial.println(code);
+  }
+}
+
+/* Clear co-add buffer, bins span the DAC codes of the scan intervals (vertex potentials, CSV,
+    or start to stop potential incl. pulse, DPV), COADD_BIN_MV wide up to COADD_BINS per direction
+    co-addition applies to CSV only, sync sampled experiments (DPV) stream as usual
+*/
+void coaddInit() {
+  if (e.syncSamplingEN) coadd = false;
+  float v[4] = {e.vStart[0], e.vStart[1], e.vStart[0] + e.cycles * e.offset, e.vStart[1] + e.cycles * e.offset};
+  coLo = 65535;
+  coHi = 0;
+  for (byte i = 0; i < 4; i++) {
+    uint16_t c = scaleOutput(v[i]);
+    if (c < coLo) coLo = c;
+    if (c > coHi) coHi = c;
+  }
+  //span in mV * 21845 (DAC codes per V), rounded to whole bins
+  long bins = (((long)coHi - coLo) * 1000 + COADD_BIN_MV * 21845L / 2) / (COADD_BIN_MV * 21845L);
+  coBins = constrain(bins, 1, COADD_BINS);
+  for (byte d = 0; d < 2; d++) {
+    for (byte b = 0; b < COADD_BINS; b++) {
+      coSum[d][b] = 0;
+      coN[d][b] = 0;
+    }
+  }
+}
+
+//Add sample (PS_adc1_diff_0_1 at dacOut) to its bin, samples outside the scan intervals are dropped
+void coaddSample() {
+  if (currInterval != INTERVAL_EXP1 && currInterval != INTERVAL_EXP2) return;
+  byte d = currInterval == INTERVAL_EXP2;
+  long b = ((long)dacOut - coLo) * coBins / ((long)coHi - coLo + 1);
+  b = constrain(b, 0, coBins - 1);
+  if (coN[d][b] < COADD_N_MAX) {
+    coSum[d][b] += PS_adc1_diff_0_1;
+    coN[d][b]++;
+  }
+}
+
+/* Send co-added voltammogram in scan order in the selected stream mode
+    one sample per filled bin: DAC code of bin centre, mean ADC code (rounded)
+    full bins dropped the samples of later cycles, their count is reported first
+*/
+void sendCoadd() {
+  byte nSent = 0;
+  byte nFull = 0;
+  long span = (long)coHi - coLo + 1;
+  boolean up = scaleOutput(e.vStart[1]) >= scaleOutput(e.vStart[0]);
+  for (byte d = 0; d < 2; d++) {
+    for (byte b = 0; b < coBins; b++) {
+      if (coN[d][b] == COADD_N_MAX) nFull++;
+    }
+  }
+  if (nFull) sendInfo(MSG_COADD_FULL, nFull);
+  for (byte d = 0; d < 2; d++) {
+    for (byte k = 0; k < coBins; k++) {
+      byte b = (up == (d == 0)) ? k : coBins - 1 - k;
+      uint16_t n = coN[d][b];
+      if (n == 0) continue;
+      long s = coSum[d][b];
+      dacOut = coLo + ((2 * b + 1) * span) / (2 * coBins);
+      vOut = dacOut / 21845.0 - 1.5;
+      PS_adc1_diff_0_1 = (s >= 0 ? s + n / 2 : s - n / 2) / n;
+      iIn = convCurrent(PS_adc1_diff_0_1);
+      tSample = microsExt();
+      sendSample();
+      nSent++;
+    }
+  }
+  sendInfo(MSG_COADD_SENT, nSent);
+}
+
+/* Store blank reference (mean code per bin) in EEPROM, empty bins take the nearest filled bin
+    of the same scan direction so interpolation never sees a gap
+*/
+void saveBlank() {
+  BlankHdr h = {BLANK_MAGIC, coLo, coHi, e.gain, coBins};
+  byte nFilled = 0;
+  for (byte d = 0; d < 2; d++) {
+    int16_t last = 0;
+    boolean any = false;
+    for (byte b = 0; b < coBins; b++) {
+      if (coN[d][b]) {
+        last = coSum[d][b] / coN[d][b];
+        if (!any) {
+          //fill leading empty bins
+          for (byte k = 0; k < b; k++) EEPROM.put(BLANK_EE_ADDR + sizeof(h) + (d * coBins + k) * 2, last);
+        }
+        any = true;
+        nFilled++;
+      }
+      if (any) EEPROM.put(BLANK_EE_ADDR + sizeof(h) + (d * coBins + b) * 2, last);
+    }
+    if (!any) {
+      for (byte b = 0; b < coBins; b++) EEPROM.put(BLANK_EE_ADDR + sizeof(h) + (d * coBins + b) * 2, (int16_t)0);
+    }
+  }
+  EEPROM.put(BLANK_EE_ADDR, h);
+  sendInfo(MSG_BLANK_SAVED, nFilled);
+}
+
+//Stored blank matches current waveform (DAC code range) and gain, called after parsing (BG_SUB)
+boolean checkBlank() {
+  BlankHdr h;
+  EEPROM.get(BLANK_EE_ADDR, h);
+  coaddInit(); //DAC code range of current config
+  if (h.magic != BLANK_MAGIC || h.lo != coLo || h.hi != coHi || h.gain != e.gain || h.bins != coBins) {
+    sendError(MSG_ERR_BLANK);
+    return false;
+  }
+  return true;
+}
+
+/* Measure Ru by current interrupt (potential step), %RU:-1%, called after parsing
+    The cell is held at the first scan potential, stepped by IR_STEP_MV and the transient read
+    by three back to back conversions. Each conversion averages the decaying current
+    i = iss + di * exp(-t / tau), so tau follows from the ratio of the successive differences
+    and di from extrapolating the 1st average back to the step: Ru = step / di.
+    IR_COMP_PCT % of Ru is used, false (not started) if the decay is not resolved by the ADC.
+*/
+boolean measureRu() {
+  if (!PS_Present) {
+    sendError(MSG_ERR_IR_MEAS, 0);
+    return false;
+  }
+  setGain(e.gain);
+  //step towards 0 V, stays in DAC range
+  float v0 = e.vStart[0];
+  float dv = (v0 > 0 ? -IR_STEP_MV : IR_STEP_MV) / 1000.0;
+  dacOut = scaleOutput(v0);
+  writeDAC(dacOut);
+  delay(IR_SETTLE_MS);
+  long base = 0;
+  for (byte i = 0; i < IR_BASE_SAMPLES; i++) base += irRead();
+  base /= IR_BASE_SAMPLES;
+
+  dacOut = scaleOutput(v0 + dv);
+  writeDAC(dacOut);
+  unsigned long tStep = micros();
+  float a[3];
+  for (byte k = 0; k < 3; k++) a[k] = irRead() - base;
+  //conversion spacing and averaging time, start delay after step (us)
+  float ts = (micros() - tStep) / 3.0;
+  float tc = EIS_ADC_CONV_US;
+  float td = IR_ADC_START_US;
+  writeDAC(DACVAL0);
+  dacOut = DACVAL0;
+
+  if (a[0] < 0) {
+    //cathodic step, fit on magnitude
+    for (byte k = 0; k < 3; k++) a[k] = -a[k];
+  }
+  float d1 = a[0] - a[1];
+  float d2 = a[1] - a[2];
+  float r = d1 > 0 ? d2 / d1 : 0;
+  if (r <= IR_R_MIN || r >= IR_R_MAX) {
+    sendError(MSG_ERR_IR_MEAS, (long)(r * 1000));
+    return false;
+  }
+  float tau = -ts / log(r);
+  float di = d1 / (1.0 - r) * tc / (tau * (1.0 - exp(-tc / tau))) * exp(td / tau); //pA
+  float ru = fabs(dv) / (di * 1.0E-12) * IR_COMP_PCT / 100.0;
+  irRu = constrain(ru, 1.0, (float)IR_RU_MAX);
+  sendInfo(MSG_IR_RU, irRu);
+  irTau = tau;
+  sendInfo(MSG_IR_TAU, (long)tau);
+  return true;
+}
+
+//TIA current (pA) for Ru measurement
+long irRead() {
+  tSample = microsExt();
+  int16_t code = PS_adc1.readADC_Differential_0_1();
+  if (TRACE_EN) trace(TR_ADC, PS_adc1.address(), code);
+  return convCurrent(code);
+}
+
+/* Latency of the compensation loop, called for every compensated DAC write: age of the current in iIn,
+    from the start of its conversion (conversion time plus the time since the sample, up to one sample period)
+    warning sent once per experiment above IR_LAT_TAU_PCT % of the cell time constant (Ru measured, %RU:-1)
+*/
+void irTrack() {
+  unsigned long lat = micros() - tIrAdc;
+  if (lat > irLatMax) irLatMax = lat;
+  irLatSum += lat;
+  irLatN++;
+  if (irTau > 0 && lat > irTau * IR_LAT_TAU_PCT / 100 && !irSlow) {
+    irSlow = true;
+    sendInfo(MSG_IR_SLOW, lat);
+  }
+}
+
+/* Blank code at DAC code dac, scan direction d, linear interpolation between bin centres
+    reads two bins from EEPROM, no SRAM copy of the reference
+*/
+int16_t blankAt(uint16_t dac, byte d) {
+  long span = (long)coHi - coLo + 1;
+  long pos = (((long)dac - coLo) * coBins * 256) / span - 128; //bin units, 8 fractional bits
+  pos = constrain(pos, 0, (coBins - 1) * 256L);
+  byte i = pos >> 8;
+  byte f = pos & 0XFF;
+  int addr = BLANK_EE_ADDR + sizeof(BlankHdr) + (d * coBins + i) * 2;
+  int16_t m0, m1;
+  EEPROM.get(addr, m0);
+  if (f == 0) return m0;
+  EEPROM.get(addr + 2, m1);
+  return m0 + (((long)(m1 - m0) * f) >> 8);
+}
+
+/* Set frequency point k of impedance scan (log spaced from eisFStart to eisFStop)
+    duration is one settling period plus eisPeriods measured periods, demodulator cleared
+*/
+void eisSetPoint(byte k) {
+  eisF = e.cycles > 1 ? eisFStart * pow(eisFStop / eisFStart, (float)k / (e.cycles - 1)) : eisFStart;
+  eisInc = (uint64_t)(eisF * 281474976710656.0 / 1.0E6); // f * 2^48 / 1E6
+  eisSettle = 1.0E6 / eisF;
+  eisDur = (eisPeriods + 1) * eisSettle;
+  eisN = 0;
+  eisSum = 0;
+  eisS = 0;
+  eisC = 0;
+  eisSs = 0;
+  eisSc = 0;
+}
+
+//First frequency point of an impedance scan, starts after cleaning / deposition
+void eisStart() {
+  eisPoint = 0;
+  tEisPoint = e.tClean + e.tDep;
+  eisSetPoint(0);
+}
+
+/* Impedance scan progress at experiment time t, replaces the cycle / interval of calcInterval()
+    result of a point is sent when its duration has passed, INTERVAL_DN after the last point
+*/
+void eisInterval(uint64_t t) {
+  if (eisPoint >= e.cycles) {
+    currInterval = INTERVAL_DN;
+    return;
+  }
+  unsigned long tp = (unsigned long)t - tEisPoint;
+  if (tp >= eisDur) {
+    if (!virtualRun) eisResult();
+    tEisPoint += eisDur;
+    eisPoint++;
+    if (eisPoint >= e.cycles) {
+      currInterval = INTERVAL_DN;
+      return;
+    }
+    eisSetPoint(eisPoint);
+    tp = (unsigned long)t - tEisPoint;
+  }
+  currInterval = INTERVAL_EXP1;
+  currCycle = eisPoint;
+  tInt = tp;
+}
+
+//DDS phase at time t (us) since start of the frequency point, 2^32 = 1 period
+uint32_t eisPhase(unsigned long t) {
+  return (uint32_t)(((uint64_t)t * eisInc) >> 16);
+}
+
+//Sine of DDS phase (2^32 = 1 period) in Q15, quarter wave table with linear interpolation
+int16_t sinQ15(uint32_t phase) {
+  byte q = phase >> 30;
+  uint32_t x = (phase >> 14) & 0XFFFF; //position in quadrant, 6 bit index, 10 bit fraction
+  if (q & 1) x = 0X10000 - x;
+  byte i = x >> 10;
+  int frac = x & 0X3FF;
+  int16_t s = pgm_read_word(&SINE_Q15[i]);
+  if (frac) s += ((long)((int16_t)pgm_read_word(&SINE_Q15[i + 1]) - s) * frac) >> 10;
+  return (q & 2) ? -s : s;
+}
+
+/* Demodulate ADC sample (PS_adc1_diff_0_1) with the phase of the applied potential at the
+    centre of the conversion, samples in the settling period are skipped
+*/
+void eisSample() {
+  long tc = (long)((unsigned long)(tSample - tExpStart) - tEisPoint) + EIS_ADC_DELAY_US - EIS_DAC_DELAY_US;
+  if (tc < (long)eisSettle) return;
+  uint32_t ph = eisPhase(tc);
+  int16_t s = sinQ15(ph);
+  int16_t c = sinQ15(ph + 0X40000000UL);
+  int16_t code = PS_adc1_diff_0_1;
+  eisN++;
+  eisSum += code;
+  eisS += s;
+  eisC += c;
+  eisSs += (long)code * s;
+  eisSc += (long)code * c;
+}
+
+/* Send result of frequency point: "F,f (mHz),|Z| (ohm),phase (0.1 deg)"
+    current amplitude and phase from the I/Q sums (DC removed), corrected for the
+    averaging of the ADC conversion and the DAC staircase (sinc)
+*/
+void eisResult() {
+  long mag = 0;
+  int phase = 0;
+  if (eisN >= 4) {
+    float mean = (float)eisSum / eisN;
+    float si = (float)eisSs - mean * eisS;
+    float sq = (float)eisSc - mean * eisC;
+    float amp = 2.0 * sqrt(si * si + sq * sq) / eisN / 32768.0; //ADC codes
+    float x1 = PI * eisF * EIS_ADC_CONV_US * 1.0E-6;
+    float x2 = PI * eisF * 1.0 / PLAN_DAC_RATE;
+    amp /= (sin(x1) / x1) * (sin(x2) / x2);
+    float ia = amp * gCal->scale / (float)(1L << gCal->shift); //pA
+    if (ia > 0) mag = min(e.vStart[1] * 1.0E12 / ia, 2.0E9);
+    phase = -atan2(sq, si) * 1800.0 / PI; //potential relative to current
+  }
+  Serial.print(F("F,"));
+  Serial.print((long)(eisF * 1000.0 + 0.5));
+  Serial.print(',');
+  Serial.print(mag);
+  Serial.print(',');
+  Serial.println(phase);
+}
+
+/* Send experiment status / progress frame
+    'Q' expStarted paused currInterval currCycle(2) cycles(2) tExp(6, us) CR, values LSB first
+*/
+void sendStatus() {
+  uint64_t t = expStarted ? (expPaused ? tPause : microsExt()) - tExpStart : 0;
+  Serial.write('Q');
+  Serial.write(expStarted);
+  Serial.write(expPaused);
+  Serial.write(currInterval);
+  Serial.write((uint8_t)(currCycle & 0XFF));
+  Serial.write((uint8_t)(currCycle >> 8));
+  Serial.write((uint8_t)(e.cycles & 0XFF));
+  Serial.write((uint8_t)(e.cycles >> 8));
+  for (byte i = 0; i < 6; i++) {
+    Serial.write((uint8_t)(t >> (8 * i)));
+  }
+  Serial.write(13); //cr
 }
 
 // Action if unexpected error occurs
@@ -1153,6 +3593,9 @@ void clearExp() {
   e.cycles = 0;
   e.syncSamplingEN = false;
   e.tSyncSample = 0UL;
+  e.syncOffset = SYNC_OFFSET;
+  e.tClOn = CL_SW_ON_TIME;
+  e.tClPeriod = CL_SW_ON_TIME + CL_MEASURE_TIME;
 }
 
 //default LSV experiment (debug)
@@ -1173,6 +3616,7 @@ void defLSVExp() {
   e.sampRate = 30;
   e.syncSamplingEN = false;
   e.tSyncSample = 0UL;
+  e.syncOffset = SYNC_OFFSET;
   e.gain = 0;
 }
 //default CV experiment (debug)
@@ -1193,6 +3637,7 @@ void defCVExp() {
   e.sampRate = 10;
   e.syncSamplingEN = false;
   e.tSyncSample = 0UL;
+  e.syncOffset = SYNC_OFFSET;
   e.gain = 2;
 }
 //default DPV experiment (debug)
@@ -1213,42 +3658,72 @@ void defDPVExp() {
   e.sampRate = 30;
   e.syncSamplingEN = true;
   e.tSyncSample = e.tCycle - SYNC_OFFSET;
+  e.syncOffset = SYNC_OFFSET;
   e.gain = 2;
 }
 
 //Print current experiment settings to serial port
 void printExp() {
-  Serial.println(String("tClean: " + String(e.tClean)));
-  Serial.println(String("vClean: " + String(e.vClean)));
-  Serial.println(String("tDep: " + String(e.tDep)));
-  Serial.println(String("vDep: " + String(e.vDep)));
-  Serial.println(String("tSwitch: " + String(e.tSwitch)));
-  Serial.println(String("tOffset: " + String(e.tOffset)));
-  Serial.println(String("vStart[0]: " + String(e.vStart[0])));
-  Serial.println(String("vStart[1]: " + String(e.vStart[1])));
-  Serial.println(String("vSlope[0]*1E9: " + String(e.vSlope[0]*1E9)));
-  Serial.println(String("vSlope[1]*1E9: " + String(e.vSlope[1]*1E9)));
-  Serial.println(String("tCycle: " + String(e.tCycle)));
-  Serial.println(String("offset: " + String(e.offset)));
-  Serial.println(String("cycles: " + String(e.cycles)));
-  Serial.println(String("sampRate: " + String(e.sampRate)));
-  Serial.println(String("syncSamplingEN: " + String(e.syncSamplingEN)));
-  Serial.println(String("tSyncSample: " + String(e.tSyncSample)));
-  Serial.println(String("gain: " + String(e.gain)));
+  Serial.print(F("tClean: "));
+  Serial.println(e.tClean);
+  Serial.print(F("vClean: "));
+  Serial.println(e.vClean);
+  Serial.print(F("tDep: "));
+  Serial.println(e.tDep);
+  Serial.print(F("vDep: "));
+  Serial.println(e.vDep);
+  Serial.print(F("tSwitch: "));
+  Serial.println(e.tSwitch);
+  Serial.print(F("tOffset: "));
+  Serial.println(e.tOffset);
+  Serial.print(F("vStart[0]: "));
+  Serial.println(e.vStart[0]);
+  Serial.print(F("vStart[1]: "));
+  Serial.println(e.vStart[1]);
+  Serial.print(F("vSlope[0]*1E9: "));
+  Serial.println(e.vSlope[0]*1E9);
+  Serial.print(F("vSlope[1]*1E9: "));
+  Serial.println(e.vSlope[1]*1E9);
+  Serial.print(F("tCycle: "));
+  Serial.println(e.tCycle);
+  Serial.print(F("offset: "));
+  Serial.println(e.offset);
+  Serial.print(F("cycles: "));
+  Serial.println(e.cycles);
+  Serial.print(F("sampRate: "));
+  Serial.println(e.sampRate);
+  Serial.print(F("syncSamplingEN: "));
+  Serial.println(e.syncSamplingEN);
+  Serial.print(F("tSyncSample: "));
+  Serial.println(e.tSyncSample);
+  Serial.print(F("gain: "));
+  Serial.println(e.gain);
 }
 
 //WQM FUNCTIONS:
   void startExperimentWQM() {
-    flashLed(4, 150);
-    sendInfo("Starting WQM Experiment");
+    sendInfo(MSG_WQM_START);
     samplingStarted = false;
     e.syncSamplingEN = false;
     e.sampRate = WQM_SAMP_RATE;
+    e.tClOn = CL_SW_ON_TIME;
+    e.tClPeriod = CL_SW_ON_TIME + CL_MEASURE_TIME;
     expStarted = WQM_EXP_RUNNING;
+    switchTimeACC = 0;
+    btCount = 0;
+    btSlotMax = 0;
+    btOut.dropped = 0;
+    resetAggregates();
+    wqmReported = false;
+    resetLogInterval();
+    if (IDLE_SLEEP_EN) resetIdleStats();
+    switchCycle = 0;
+    tSwitchStart = (unsigned long)microsExt();
     startTimerADC();
   }
   void getMeasurementsWQM() {
 
+    tSampleWQM = millis();
     // read from the ADC, and obtain a sixteen bits integer as a result
     if (WQM_Present) {
       WQM_adc1_diff_2_3 = WQM_adc1.readADC_Differential_2_3();
@@ -1258,6 +3733,11 @@ void printExp() {
       WQM_adc1_diff_0_1 = WQM_adc1.readADC_Differential_0_1();
       delay(5);
       WQM_adc2_diff_2_3 =  WQM_adc1_diff_2_3;//WQM_adc2.readADC_Differential_2_3();
+      if (TRACE_EN) {
+        trace(TR_ADC, 0x48 | 0x80, WQM_adc1_diff_2_3);
+        trace(TR_ADC, 0x49, WQM_adc2_diff_0_1);
+        trace(TR_ADC, 0x48, WQM_adc1_diff_0_1);
+      }
 
 
     } else {
@@ -1272,34 +3752,246 @@ void printExp() {
       WQM_adc2_diff_2_3 = 2000 + random(100);
 
     }
-    voltage_pH = WQM_adc1_diff_0_1 * 0.0625; // in mV
-    current_Cl = -WQM_adc1_diff_2_3 * 0.0625 / 0.0255; // in nA, feedback resistor = 500k
-    V_temp = WQM_adc2_diff_0_1 * 0.03125; // in mV
-    voltage_alkalinity = WQM_adc2_diff_2_3 * 0.03125; // in mV
+    //integer conversion to engineering units (LSB 0.0625 mV = 125/2 uV, 0.03125 mV = 125/4 uV)
+    voltage_pH = ((long)WQM_adc1_diff_0_1 * 125) >> 1; // in uV
+    current_Cl = -(long)WQM_adc1_diff_2_3 * CL_PA_PER_CODE; // in pA, feedback resistor = 500k
+    V_temp = ((long)WQM_adc2_diff_0_1 * 125) >> 2; // in uV
+    voltage_alkalinity = ((long)WQM_adc2_diff_2_3 * 125) >> 2; // in uV
+    temperature = lookupTemp(WQM_adc2_diff_0_1);
+    pH = calcPH(voltage_pH, temperature);
   }
 
-  //Send WQM meas. values over serial port
-  void sendValues() {
+  //Thermistor ADC code to temperature (0.01 deg. C), linear interpolation of TEMP_LUT
+  int lookupTemp(int16_t code) {
+    if (code < 0) code = 0;
+    byte i = code >> TEMP_LUT_SHIFT;
+    int t0 = (int16_t)pgm_read_word(&TEMP_LUT[i]);
+    int t1 = (int16_t)pgm_read_word(&TEMP_LUT[i + 1]);
+    int frac = code & ((1 << TEMP_LUT_SHIFT) - 1);
+    return t0 + (((long)(t1 - t0) * frac) >> TEMP_LUT_SHIFT);
+  }
 
-    // Send data to Serial port
-    Serial.print(" ");
-    Serial.print(V_temp, 4);
-    Serial.print(" ");
-    Serial.print(voltage_pH, 4);
-    Serial.print(" ");
-    Serial.print(current_Cl, 4);
-    Serial.print(" ");
-    Serial.print(voltage_alkalinity, 4);  //Make changes in app to read the proper order #TODO
-    Serial.print(" ");
-    Serial.print((float)switchTimeACC / 1000.0, 1);  //Turns off the switch for free chlorine
-    Serial.print(" ");
+  /* Temperature compensated pH (0.001 pH) from electrode potential uV (uV) and temperature t (0.01 deg. C)
+     Nernst: pH = PH_ISO - (uV - PH_E0) / S(T), S(T) = NERNST_SLOPE * T(K)
+     result limited to 0..PH_MAX (electrode out of range / disconnected)
+  */
+  int calcPH(long uV, int t) {
+    long slope = ((t + KELVIN_0C) * NERNST_SLOPE) / 1000; // uV per pH
+    long dE = constrain(uV - PH_E0, -2000000L, 2000000L);
+    long p = PH_ISO - (dE * 1000) / slope;
+    return constrain(p, 0L, (long)PH_MAX);
+  }
+
+  /* Send WQM meas. values to link out (Serial or bluetooth queue), space separated integers:
+     V_temp (uV), voltage_pH (uV), current_Cl (pA), voltage_alkalinity (uV),
+     switch time (ms), Cl switch state (0/1), temperature (0.01 deg. C), pH (0.001 pH),
+     device time of sample (ms since reset, for host clock drift correction)
+  */
+  void sendValues(Print &out) {
+
+    // Send data to link
+    out.print(' ');
+    out.print(V_temp);
+    out.print(' ');
+    out.print(voltage_pH);
+    out.print(' ');
+    out.print(current_Cl);
+    out.print(' ');
+    out.print(voltage_alkalinity);  //Make changes in app to read the proper order #TODO
+    out.print(' ');
+    out.print(switchTimeACC);  //Turns off the switch for free chlorine
+    out.print(' ');
     if (ClSwState) {
-      Serial.print("1");
+      out.print('1');
     } else {
-      Serial.print("0");
+      out.print('0');
+    }
+    out.print(' ');
+    out.print(temperature);
+    out.print(' ');
+    out.print(pH);
+    out.print(' ');
+    out.print(tSampleWQM);
+    out.print(' ');
+    out.print('\n');
+  }
+
+  /* Report WQM sample according to wqmReportMode
+     WQM_REPORT_CHANGE: min/max/sum of every sample are kept, the values line (sendValues()) and an
+     aggregate line (sendAggregates()) are sent when any channel moved more than its deadband from the
+     last reported value, the Cl switch toggled, or wqmHeartbeat expired
+  */
+  void reportWQM() {
+    if (wqmReportMode == WQM_REPORT_ALL) {
+      sendValues(Serial);
+      return;
+    }
+    long v[WQM_NCH] = {V_temp, voltage_pH, current_Cl, voltage_alkalinity, temperature, pH};
+    boolean changed = !wqmReported || (ClSwState != wqmLastSw) ||
+                      (tSampleWQM - tReport >= (unsigned long)wqmHeartbeat * 1000);
+    for (byte i = 0; i < WQM_NCH; i++) {
+      if (v[i] < wqmMin[i]) wqmMin[i] = v[i];
+      if (v[i] > wqmMax[i]) wqmMax[i] = v[i];
+      wqmSum[i] += v[i];
+      if (labs(v[i] - wqmLast[i]) > (long)pgm_read_dword(&WQM_DEADBAND[i])) changed = true;
+    }
+    wqmN++;
+    if (!changed) return;
+    sendValues(Serial);
+    sendAggregates(Serial);
+    for (byte i = 0; i < WQM_NCH; i++) wqmLast[i] = v[i];
+    wqmLastSw = ClSwState;
+    wqmReported = true;
+    tReport = tSampleWQM;
+    resetAggregates();
+  }
+
+  /* Send WQM aggregates since last report, space separated integers:
+     'A' samples, then min max mean for each channel in sendValues() order
+  */
+  void sendAggregates(Print &out) {
+    out.print('A');
+    out.print(' ');
+    out.print(wqmN);
+    for (byte i = 0; i < WQM_NCH; i++) {
+      out.print(' ');
+      out.print(wqmMin[i]);
+      out.print(' ');
+      out.print(wqmMax[i]);
+      out.print(' ');
+      out.print((long)(wqmSum[i] / wqmN));
+    }
+    out.print('\n');
+  }
+
+  //Clear WQM aggregates
+  void resetAggregates() {
+    for (byte i = 0; i < WQM_NCH; i++) {
+      wqmMin[i] = 0X7FFFFFFF;
+      wqmMax[i] = -0X7FFFFFFF;
+      wqmSum[i] = 0;
+    }
+    wqmN = 0;
+  }
+
+  /* Invalidate log and blank written with another EEPROM layout (EE_LAYOUT_ADDR)
+     Records of an older layout would be scanned with the wrong slot count, so the seq run and the
+     pending count are not recoverable, they are dropped (slot seq erased). Cells already erased are
+     not written (EEPROM.update), so a new device only stores the version byte.
+  */
+  void checkEeLayout() {
+    if (EEPROM.read(EE_LAYOUT_ADDR) == EE_LAYOUT) return;
+    for (byte i = 0; i < LOG_SLOTS; i++) EEPROM.update(LOG_EE_ADDR + i * LOG_REC_LEN, 0XFF);
+    for (byte i = 0; i < sizeof(BlankHdr); i++) EEPROM.update(BLANK_EE_ADDR + i, 0XFF);
+    EEPROM.update(EE_LAYOUT_ADDR, EE_LAYOUT);
+  }
+
+  /* Scan log ring for the newest record (seq run ends) and pending records
+     seq increments by 1 per record (0XFE wraps to 0), LOG_SLOTS < 255 so the slot after the
+     newest record never continues the run
+  */
+  void initLog() {
+    logHead = 0;
+    logSeq = 0;
+    logPending = 0;
+    for (byte i = 0; i < LOG_SLOTS; i++) {
+      int addr = LOG_EE_ADDR + i * LOG_REC_LEN;
+      byte seq = EEPROM.read(addr);
+      if (seq == 0XFF) continue;
+      if (EEPROM.read(addr + 1) == LOG_PENDING) logPending++;
+      byte next = seq == 0XFE ? 0 : seq + 1;
+      byte j = i + 1 < LOG_SLOTS ? i + 1 : 0;
+      if (EEPROM.read(LOG_EE_ADDR + j * LOG_REC_LEN) != next) {
+        logHead = j;
+        logSeq = next;
+      }
+    }
+  }
+
+  //Start new log interval (WQM experiment start)
+  void resetLogInterval() {
+    for (byte i = 0; i < 3; i++) logSum[i] = 0;
+    logN = 0;
+    tLog = millis();
+  }
+
+  //Accumulate WQM sample, mean of each logInterval written to EEPROM log while the host link is down
+  void logSample() {
+    logSum[0] += temperature;
+    logSum[1] += pH;
+    logSum[2] += current_Cl / 10000; // pA to 10 nA
+    logN++;
+    if (tSampleWQM - tLog < (unsigned long)logInterval * 1000) return;
+    if (!linkUp) writeLog();
+    resetLogInterval();
+  }
+
+  //Write record to next slot, the oldest record is overwritten when the ring is full
+  void writeLog() {
+    LogRec rec;
+    rec.seq = logSeq;
+    rec.status = LOG_PENDING;
+    rec.tMin = tSampleWQM / 60000;
+    rec.temp = logSum[0] / logN;
+    rec.pH = logSum[1] / logN;
+    rec.cl = constrain(logSum[2] / (long)logN, -32768L, 32767L);
+    EEPROM.put(LOG_EE_ADDR + logHead * LOG_REC_LEN, rec);
+    logHead = logHead + 1 < LOG_SLOTS ? logHead + 1 : 0;
+    logSeq = logSeq == 0XFE ? 0 : logSeq + 1;
+    if (logPending < LOG_SLOTS) logPending++;
+  }
+
+  /* Send pending log records in one binary block at link speed, oldest first
+     'L' n(2) n * [seq tMin(2) temp(2) pH(2) cl(2)] CR, then records are marked LOG_DRAINED
+  */
+  void dumpLog() {
+    byte n = logPending;
+    byte slot = (logHead + LOG_SLOTS - n) % LOG_SLOTS;
+    Serial.write('L');
+    Serial.write(n);
+    Serial.write((uint8_t)0);
+    for (byte k = 0; k < n; k++) {
+      int addr = LOG_EE_ADDR + ((slot + k) % LOG_SLOTS) * LOG_REC_LEN;
+      Serial.write(EEPROM.read(addr)); //seq
+      for (byte b = 2; b < LOG_REC_LEN; b++) Serial.write(EEPROM.read(addr + b));
+    }
+    Serial.write(13); //cr
+    for (byte k = 0; k < n; k++) {
+      EEPROM.update(LOG_EE_ADDR + ((slot + k) % LOG_SLOTS) * LOG_REC_LEN + 1, LOG_DRAINED);
+    }
+    logPending = 0;
+    sendInfo(MSG_LOG_SENT, n);
+  }
+
+  /* BLE module connection notifications (AT+NOTI1), received outside command frames
+     "OK+LOST" = host disconnected, WQM log records are written until the next handshake
+  */
+  void linkNotify(char c) {
+    const char lost[] = "+LOST";
+    iLost = (c == lost[iLost]) ? iLost + 1 : (c == '+');
+    if (iLost == 5) {
+      iLost = 0;
+      linkUp = false;
+    }
+  }
+
+  /* Update time since start of free Cl switch period (switchTimeACC, ms) from extended timebase
+     period start advanced by e.tClPeriod, so long running measurements stay in phase
+     pending live parameter update takes effect at the start of a switch period
+  */
+  void updateSwitchTime() {
+    unsigned long period = e.tClPeriod * 1000UL;
+    unsigned long dt = (unsigned long)microsExt() - tSwitchStart;
+    while (dt >= period) {
+      tSwitchStart += period;
+      dt -= period;
+      switchCycle++;
+      if (eNextPending) {
+        applyUpdate(switchCycle);
+        period = e.tClPeriod * 1000UL;
+      }
     }
-    Serial.print(" ");
-    Serial.print("\n");
+    switchTimeACC = dt / 1000;
   }
 
   //Set free Cl switch ON or OFF
@@ -1,6 +1,21 @@
-#define MCU_ONLY true //for debugging purposes, will not issue commands to external shields TODO: define debugging
-#define PS_STD_MSG true //true = standard msg format (raw data) for transmission to application, false = comma seperated format
+#define MCU_ONLY false //true = debug build without PotStat shield: nominal calibration, experiments run with no ADC read (code 0)
+#define PS_STD_MSG true //true = standard msg format (raw data) for transmission to application, false = comma seperated format (default stream mode)
 //#define CONFIG_COMMS_USB true //true = communicate serial messages over USB and bluetooth
+#define IDLE_SLEEP_EN true //true = CPU sleeps (AVR idle mode) in loop() while no timer event or command is pending
+#define PROF_EN false //debug build: execution time of hot paths, reported as JSON by the B command
+#ifndef BENCH_EN
+#define BENCH_EN false //benchmark build (env:bench): cycles per call of the hot path kernels as JSON at start, then halts
+#endif
+#ifndef TRACE_EN
+#define TRACE_EN false //debug build: binary trace of timer events, I2C transfers and serial rx on Serial (see TR_ types)
+#endif
+#ifndef COADD_EN
+#define COADD_EN false //CV cycle co-addition (%CA:1%) and blank subtraction (%BG:#), -DCOADD_EN=true: 2 * COADD_BINS * 6 bytes SRAM over custom_sram_budget
+#endif
+#define IRCOMP_EN true //positive feedback iR compensation available (%RU:#%)
+#ifndef DUAL_LINK_EN
+#define DUAL_LINK_EN false //true = decimated sample stream on SoftwareSerial bluetooth (Serial_BT), full rate on Serial
+#endif
 
 
 #define WQM_LED 4
@@ -14,6 +29,19 @@
 #define PS_WE_SwEn 10
 #define PS_BrdPresent 12
 
+//Potentiostat channels (shields), descriptors (DAC / ADC address, gain mux pins) in PS_CH[]
+//same waveform and gain on all channels: every DAC update writes all DACs, ADC samples round robin
+//(async sample rate per channel = %SR / channels, sync sampling converts all channels at each point),
+//calibration table per channel (own TIA resistors and ADC offset)
+#ifndef PS_CHANNELS
+#define PS_CHANNELS 1
+#endif
+#if DUAL_LINK_EN && PS_CHANNELS > 1
+#error "DUAL_LINK_EN: Serial_BT uses D2 / D3, the gain mux pins of the 2nd channel"
+#endif
+#define PS_DAC_ADDR 0x1C    //MAX5217 of 1st channel
+#define PS_ADC_ADDR 0x4B    //ADS1115 of 1st channel
+
 #define MB_LED 13
 #define EXT_LED 14
 
@@ -21,12 +49,118 @@
 #define ON 1
 #define OFF 0
 
+//BLE shield (HM-10) configuration, done by bootTask() after reset
+#define BLE_BAUD_DEFAULT 9600 //factory baud rate of BLE module
+#define BLE_BAUD 115200       //baud rate set by AT+BAUD4
+#define BLE_POWERUP 500       //BLE module start up time after reset (ms)
+#define BLE_TIMEOUT 300       //AT command response timeout (ms)
+#define BLE_RETRIES 2         //AT command attempts before giving up
+#define BLE_SWITCH_DELAY 100  //time for BLE module to switch baud rate (ms)
+#define BLE_RX_LEN 16         //AT response buffer length
+
+//SoftwareSerial bluetooth link (DUAL_LINK_EN)
+//transmit is bit-banged with interrupts disabled for each byte (BT_BYTE_US), so bytes are queued and
+//sent by btService() in slots of max BT_SLOT_US after a DAC update, timer ISRs are delayed by at most one byte
+#define BT_BAUD 38400
+#define BT_BYTE_US (10000000UL / BT_BAUD)
+#define BT_SLOT_US 1000    //max transmit time per slot (us)
+#define BT_QUEUE_LEN (DUAL_LINK_EN ? 64 : 1) //output queue (bytes), power of 2, no storage without the link
+#define BT_DECIM 10        //default decimation, 1 sample (average) sent per BT_DECIM samples
+
+//Boot states
+#define BOOT_POWERUP 0  //waiting for BLE module start up
+#define BOOT_PROBE 1    //AT sent, waiting for OK
+#define BOOT_NAME 2     //AT+NAME sent
+#define BOOT_NOTI 3     //AT+NOTI sent (connection notifications "OK+CONN" / "OK+LOST")
+#define BOOT_BAUD 4     //AT+BAUD sent
+#define BOOT_SWITCH 5   //waiting for BLE module to change baud rate
+#define BOOT_DONE 6     //link ready, serial output enabled
+
+//BLE response status
+#define BLE_WAIT 0
+#define BLE_OK 1
+#define BLE_FAIL 2
+
 //Experiment running / started status
 #define PS_EXP_RUNNING 1
 #define WQM_EXP_RUNNING 2
 
+/* Potentiostat sample stream modes, selected with %SM:# in run command
+   STREAM_STD:    'B' CR dac(2) adc(4, sign padded) CR, all values LSB first (no sample time)
+   STREAM_CSV:    dacOut,vOut,iIn,tick text line (tick in us)
+   STREAM_PACKED: delta compressed, sequence numbered records, decoded losslessly by the host.
+     Every record is sent as SLIP frame END record crc END, crc = CRC-8 (poly 0X07, init 0XFF) of the record,
+     END (0XC0) / ESC (0XDB) in record or crc are sent as ESC ESC_END (0XDC) / ESC ESC_ESC (0XDD).
+     (init 0XFF: two frames merged by a lost END do not pass, with init 0 the crc would continue at 0)
+     The host drops frames with a bad crc and bytes outside frames (text messages), a lost or corrupted
+     record shows as a gap in seq and is requested again. Records:
+     'K' seq dac(2) adc(2) tick(4)            keyframe, absolute codes (LSB first), resets decoder
+     'D' seq varint(d2) varint(d) varint(t2)  delta record, d2 = DAC step (mod 2^16) - previous DAC step,
+                                          d = ADC code - previous ADC code,
+                                          t2 = tick step (mod 2^32) - previous tick step (steps 0 after keyframe)
+     'R' seq dac(2) adc(2) tick(4)            retransmitted sample, absolute codes, decoder state unchanged
+     'X' seq                                  requested sample no longer in history
+     'T' us(8)                            sync record, device time since reset (us, LSB first),
+                                          sent every STREAM_SYNC_INTERVAL, host pairs it with its arrival
+                                          time to estimate and correct device clock drift
+     tick = device sample time, us >> STREAM_TICK_SHIFT (low 32 bits)
+     varints are zigzag encoded (0,-1,1,-2.. -> 0,1,2,3..), 7 bits per byte LSB first, bit 7 set if more follow
+     keyframe sent on experiment start and every STREAM_KEY_INTERVAL samples (seq multiple of it)
+     With more than one channel the record starts with the channel tag 'N' ch (same frame).
+     seq = sample sequence number (mod 256), the last STREAM_HIST_LEN samples are kept for retransmission,
+     enough for a request to arrive within the link round trip STREAM_RTT_MS at the max sample rate
+     host requests a missing sample by sending '#' seq, requests are queued (max STREAM_RTX_LEN) and
+     at most one retransmission is sent per live sample, so retransmits cannot starve live data
+*/
+#define STREAM_STD 0
+#define STREAM_CSV 1
+#define STREAM_PACKED 2
+#define STREAM_DEFAULT (PS_STD_MSG ? STREAM_STD : STREAM_CSV) //run command without %SM
+#define STREAM_KEY_INTERVAL 32
+#define STREAM_TICK_SHIFT 4       //tick = 16 us
+#define STREAM_SYNC_INTERVAL 1000 //ms
+#define STREAM_RTT_MS 250         //link round trip, sample sent to retransmission request received (BLE)
+#define STREAM_HIST_LEN 16        //sample history for retransmission, power of 2, >= max rate * STREAM_RTT_MS (64 Hz)
+#define STREAM_RTX_LEN 4          //queued retransmission requests
+
+//SLIP framing of packed stream records
+#define SLIP_END 0XC0
+#define SLIP_ESC 0XDB
+#define SLIP_ESC_END 0XDC
+#define SLIP_ESC_ESC 0XDD
+
+/* Debug trace (TRACE_EN), interleaved with normal output on Serial:
+   'Z' type arg data(2) us(4), LSB first, us = device time of the event (micros(), wraps after 71 min),
+   sent as a SLIP frame with CRC-8 like the packed stream records, so a raw serial capture of the link
+   is the trace file (text and other frames in between are skipped by the reader)
+     TR_ISR   arg = timer (1 = ADC/WQM, 2 = DAC)
+     TR_DAC   arg = I2C address, data = DAC code written
+     TR_ADC   arg = I2C address | 0x80 for channel pair 2_3, data = ADC code read
+     TR_RX    arg = serial byte received
+     TR_DROP  data = records lost, trace queue was full
+   Timer events, ADC codes and rx bytes are the inputs of loop(), so a recorded run can be re-driven
+   in order on a host, DAC records are the outputs to compare against (reader / replay: test/stubs/trace.h).
+   Records are queued in the ISR / at the call site and sent from loop() while the serial tx buffer
+   has room. A record queued outside an ISR first sends (blocking) until the queue is at most half full,
+   so only the ISRs alone filling it between two loop() passes drop records (TR_DROP).
+*/
+#define TR_ISR 1
+#define TR_DAC 2
+#define TR_ADC 3
+#define TR_RX 4
+#define TR_DROP 5
+#define TRACE_LEN 16              //queued records, power of 2
+#define TRACE_FRAME 22            //max bytes per record on Serial (every byte escaped)
+
 //Experiment Commands
-#define MAX_CMD_LENGTH 64
+#define MAX_CMD_LENGTH 128 //frame contents incl. '/' (SRAM buffer), fits a run command with a full %SS series
+#define CMD_TIMEOUT 2000  //max time to receive a command frame (ms)
+#define CMD_POLL_BYTES 8  //max bytes processed per loop() so DAC updates are not delayed
+
+//Command receiver states
+#define CMD_IDLE 0   //waiting for command start char
+#define CMD_FRAME 1  //receiving '<' ... '>' command frame
+#define CMD_RTX 2    //'#' received, waiting for retransmission seq
 
 #define MIN_SAMPLE_RATE 15
 #define MAX_SAMPLE_RATE 120
@@ -37,10 +171,33 @@
 #define WQM_SAMP_RATE 5 //Sample freq (Hz)
 #define CL_SW_ON_TIME 50000 //ms
 #define CL_MEASURE_TIME 50000 //ms
+#define LIMS_CLT   1000, 3600000 //Cl switch on / measure time limits for live update (ms)
+
+//WQM reporting, sampling stays at WQM_SAMP_RATE
+#define WQM_REPORT_ALL 0     //every sample sent (sendValues())
+#define WQM_REPORT_CHANGE 1  //sent when a channel leaves its deadband, Cl switch toggles or heartbeat expires
+#define WQM_NCH 6            //reported channels: V_temp, pH voltage, Cl current, alkalinity voltage, temperature, pH
+#define WQM_HEARTBEAT 60     //default max. time without report (s)
+#define LIMS_HB 1, 3600      //heartbeat limits (s)
+
+//WQM sensor conversion (integer, engineering units)
+#define PH_E0 0L            //pH electrode potential at PH_ISO (uV)
+#define PH_ISO 7000         //pH electrode isopotential point (0.001 pH)
+#define PH_MAX 14000        //pH range 0..PH_MAX (0.001 pH)
+#define NERNST_SLOPE 1984   //Nernst slope per kelvin (0.1 uV/K), 59.16 mV/pH at 25 deg. C
+#define KELVIN_0C 27315L    //0 deg. C (0.01 K)
+#define CL_PA_PER_CODE 2451 //free Cl current per ADC code (pA), 0.0625 mV / 0.0255
+#define TEMP_LUT_SHIFT 10   //thermistor LUT spacing, 2^10 ADC codes
 
 // Experiment types
 #define EXP_CSV 1
 #define EXP_DPV 2
+#define EXP_EIS 3
+
+//Impedance (EXP_EIS), DDS sine on the DAC, I/Q demodulation of the ADC samples per frequency point
+#define EIS_ADC_DELAY_US 4100 //sample timestamp to centre of ADS1115 conversion (I2C start + 1/128 s / 2)
+#define EIS_ADC_CONV_US 7812  //ADS1115 conversion (averaging) time at 128 SPS
+#define EIS_DAC_DELAY_US (500000UL / PLAN_DAC_RATE) //mean delay of the DAC staircase (half update period)
 
 // Experiment intervals
 #define INTERVAL_NA 0
@@ -56,19 +213,191 @@
 // the output voltage changes
 #define SYNC_OFFSET 2250
 
+//Experiment planner (planExperiment()), CPU and link budget estimates
+#define PLAN_ADC_US 8000    //ADS1115 conversion incl. I2C (128 SPS, Adafruit lib conversion delay)
+#define PLAN_DAC_US 300     //DAC update (calcInterval, calcOutput, I2C write)
+#define PLAN_DAC_RATE 500   //DAC update rate, Timer2 (Hz)
+#define VERIFY_STEPS 8      //DAC updates of a verify run per loop() pass (verifyTask())
+#define PLAN_TX_US 150      //sample frame formatting / buffering, non-blocking stream modes
+#define PLAN_CPU_MAX 80     //max CPU load (%)
+#define PLAN_LINK_MAX 80    //max serial link utilization (%)
+
 //dac value corresponding to 1.5V (VG/0V for analog cct)
 #define DACVAL0 32767
 
 
-//TIA feedback R values, in k ohm
+//TIA feedback R values, in k ohm (nominal, used when no calibration stored in EEPROM)
 #define RGAIN1 0.502 //499 ohm Rf + 3 ohm estimated switch resistance = 502 ohms
 #define RGAIN2 10.0
 #define RGAIN3 200.0
 #define RGAIN4 4020.0
 
+//ADC LSB at PGA = 4X, in mV
+#define PS_ADC_LSB 0.03125
 
+//Current calibration table (per gain setting), one per channel, stored in EEPROM
+#define CAL_EE_ADDR 0       //EEPROM address of calibration table of 1st channel
+#define CAL_EE_LEN ((int)sizeof(CalTable)) //bytes per table (43), further channels from CAL_CH_EE_ADDR
+#define CAL_MAGIC 0xCA1B    //marks a valid stored table
+#define CAL_SAMPLES 16      //ADC reads averaged per calibration point
+#define CAL_SETTLE 50       //settling time after gain/potential change (ms)
+#define CAL_V_MAX 1000      //max potential applied across calibration resistor (mV)
+#define CAL_V_MIN 10        //below this the gain setting keeps its nominal scale (mV)
+#define LIMS_CALR   0, 10000000 //calibration resistor (ohm), 0 = offset only
+
+//CV cycle co-addition (COADD_EN), ADC codes summed per potential bin and scan direction
+#define COADD_BIN_MV 10     //bin width (mV), wider if the scan needs more than COADD_BINS bins
+#define COADD_BINS 48       //max bins per scan direction, between the two vertex potentials
+#define COADD_N_MAX 65535   //samples per bin, sum of codes fits 32 bits
+
+//Blank scan background subtraction (COADD_EN), %BG:# run field
+//blank binned like co-addition, mean code per bin stored in EEPROM, subtracted interpolated by DAC code
+#define BG_OFF 0
+#define BG_RECORD 1         //run is a blank, reference stored at the end
+#define BG_SUB 2            //stored reference subtracted from every sample
+#define BLANK_EE_ADDR 824
+#define BLANK_MAGIC 0xB1A4
+
+//iR compensation (IRCOMP_EN), %RU:# run field, i * Ru of the latest TIA sample added to the output
+#define IR_RU_MAX 1000000L  //max Ru (ohm)
+#define IR_CORR_MAX 0.5     //max correction added to the output (V)
+#define IR_LAT_TAU_PCT 100  //age of the compensated current above this % of the measured cell time constant is reported
+#define IR_STEP_MV 50       //potential step of Ru measurement (mV)
+#define IR_SETTLE_MS 500    //settling at the start potential before the step
+#define IR_BASE_SAMPLES 4   //reads averaged for the baseline current
+#define IR_ADC_START_US 200 //step to start of 1st conversion (I2C config write)
+#define IR_R_MIN 0.02       //decay ratio per conversion, transient resolved between IR_R_MIN and IR_R_MAX
+#define IR_R_MAX 0.95
+#define IR_COMP_PCT 85      //share of measured Ru compensated (%), margin against oscillation
+
+//Scan-rate series (CSV), %SS:# run field, segments run back to back after one cleaning / deposition
+#define SERIES_MAX 8        //max slopes per series
+
+//Hot path profiler (PROF_EN), execution time per call from micros() (4 us resolution)
+#define PROF_CALC_INTERVAL 0
+#define PROF_CALC_OUTPUT 1
+#define PROF_SCALE_OUTPUT 2
+#define PROF_WRITE_DAC 3
+#define PROF_DAC_UPDATE 4   //total Timer2 event handling
+#define PROF_SEND_SAMPLE 5  //sample framing and serial write
+#define PROF_PS_SAMPLE 6    //total Timer1 event handling (ADC read and send)
+#define PROF_PARSE_RUN 7
+#define PROF_WQM_MEAS 8
+#define PROF_COUNT 9
+
+/* Hot path benchmark kernels (BENCH_EN on the target under simavr, test/test_bench on the host),
+   each called BENCH_CALLS times per experiment config of BENCH_CMD (CV, LSV, DPV), times spread
+   over the first two cycles (tools/bench.py collects both as JSON per commit)
+*/
+#define BENCH_CALC_INTERVAL 0
+#define BENCH_CALC_OUTPUT 1
+#define BENCH_SCALE_OUTPUT 2
+#define BENCH_PARSE_RUN 3
+#define BENCH_SEND_SAMPLE 4 //sample framing (stream mode of the config) into the serial tx buffer
+#define BENCH_WQM_MEAS 5
+#define BENCH_KERNELS 6
+#define BENCH_CONFIGS 3
+#define BENCH_CALLS 64
+
+//WQM store-and-forward log, ring of LogRec in EEPROM, written while the host link is down
+//EEPROM map: 0..LOG_EE_ADDR-1 calibration table of 1st channel (CalTable, 43 bytes), LOG_EE_ADDR..LOG_EE_END-1 log,
+//CAL_CH_EE_ADDR.. calibration tables of further channels (PS_CHANNELS > 1),
+//BLANK_EE_ADDR..1023 blank scan reference (BlankHdr + 2 * COADD_BINS codes, 200 bytes)
+//EE_LAYOUT_ADDR holds the layout version, log and blank written by another layout are invalidated at start
+#define EE_LAYOUT_ADDR 63   //layout version byte, last byte before the log
+#define EE_LAYOUT (2 + 16 * (PS_CHANNELS - 1)) //log 64..823 and blank from 824, log shortened by the tables of
+                                               //further channels (1: blank of 32 bins from 880, 0XFF: erased / no blank)
+#define LOG_EE_ADDR 64      //first log slot
+#define LOG_EE_END (BLANK_EE_ADDR - (PS_CHANNELS - 1) * CAL_EE_LEN) //end of log
+#define CAL_CH_EE_ADDR LOG_EE_END
+#define LOG_REC_LEN 10      //bytes per record (sizeof(LogRec))
+#define LOG_SLOTS ((LOG_EE_END - LOG_EE_ADDR) / LOG_REC_LEN)
+#define LOG_PENDING 0xA5    //record status, not yet sent to host
+#define LOG_DRAINED 0x00    //record status, sent by bulk dump
+#define LOG_INTERVAL 60     //default log interval (s), record holds the mean of the interval
+#define LIMS_LI 5, 3600     //log interval limits (s)
+
+
+#ifndef LONG_MAX
 #define LONG_MIN -2147483648
 #define LONG_MAX  2147483647
+#endif
+
+//Message catalog codes (index into MSG_TEXT), sent by sendError() / sendInfo()
+//Binary frame: type ('E' = error, 'I' = info), code, value (4 bytes, LSB first), CR
+//one format on the link, binary codes (e.g. 13) would break line based hosts reading text
+#define MSG_BINARY false  //true = send binary message frame, false = catalog text line
+#define MSG_VERBOSE (!MSG_BINARY)  //catalog text line ("Error: ..." / "Info: ...")
+#define MSG_ERROR 'E'
+#define MSG_INFO 'I'
+#define MSG_ERR_DAC_RANGE    0
+#define MSG_ERR_CMD_PARSE    1
+#define MSG_ERR_CMD_UNKNOWN  2
+#define MSG_ERR_CMD_TIMEOUT  3
+#define MSG_ERR_CMD_INVALID  4
+#define MSG_ERR_SR_RANGE     5
+#define MSG_ERR_GAIN_RANGE   6
+#define MSG_ERR_EXP_INVALID  7
+#define MSG_ERR_PAR_MIN      8
+#define MSG_ERR_PAR_MAX      9
+#define MSG_ERR_CALR_RANGE   10
+#define MSG_ERR_CAL          11
+#define MSG_PS_SETUP         12
+#define MSG_PS_NONE          13
+#define MSG_WQM_SETUP        14
+#define MSG_WQM_NONE         15
+#define MSG_EXP_START        16
+#define MSG_EXP_COMPLETE     17
+#define MSG_EXP_STOPPED      18
+#define MSG_WQM_START        19
+#define MSG_CAL_LOADED       20
+#define MSG_CAL_NOMINAL      21
+#define MSG_CAL_START        22
+#define MSG_CAL_DONE         23
+#define MSG_BOOT_LINK        24
+#define MSG_BOOT_NO_BLE      25
+#define MSG_BOOT_SAMPLE      26
+#define MSG_ERR_BUSY         27
+#define MSG_EXP_PAUSED       28
+#define MSG_EXP_RESUMED      29
+#define MSG_UPDATE_APPLIED   30
+#define MSG_ERR_UPDATE       31
+#define MSG_PLAN_TIME        32
+#define MSG_PLAN_SAMPLES     33
+#define MSG_PLAN_BYTES       34
+#define MSG_PLAN_CPU         35
+#define MSG_PLAN_LINK        36
+#define MSG_PLAN_OK          37
+#define MSG_PLAN_USE_PACKED  38
+#define MSG_ERR_PLAN_CPU     39
+#define MSG_ERR_PLAN_LINK    40
+#define MSG_ERR_PLAN_SYNC    41
+#define MSG_ERR_PAR_EXP      42
+#define MSG_BT_SLOT_MAX      43
+#define MSG_BT_DROPPED       44
+#define MSG_IDLE_DUTY        45
+#define MSG_WAKE_MAX         46
+#define MSG_LOG_PENDING      47
+#define MSG_LOG_SENT         48
+#define MSG_VR_DAC           49
+#define MSG_VR_SAMPLES       50
+#define MSG_VR_CRC_DAC       51
+#define MSG_VR_CRC_SAMPLES   52
+#define MSG_COADD_SENT       53
+#define MSG_BLANK_SAVED      54
+#define MSG_ERR_BLANK        55
+#define MSG_IR_RU            56
+#define MSG_IR_TAU           57
+#define MSG_ERR_IR_MEAS      58
+#define MSG_IR_LAT_MAX       59
+#define MSG_IR_LAT_MEAN      60
+#define MSG_IR_SLOW          61
+#define MSG_SERIES_SEG       62
+#define MSG_SERIES_SLOPE     63
+#define MSG_PLAN_CHANNELS    64
+#define MSG_ERR_PLAN_RTX     65
+#define MSG_COADD_FULL       66
+#define MSG_COUNT 67
 
 //String constants
 #define STR_PRE0 "Cleaning time"
@@ -111,6 +440,8 @@
 #define LIMS_CSV4   1, 100
 //Not used
 #define LIMS_CSV5   0, 0
+//Max. time of one scan (us), start to vertex 1 and vertex 1 to vertex 2: the cycle time 2 * scan fits 32 bits
+#define CSV_SCAN_MAX 2000000000UL
 
 //DPV Experiment parameter limits
 
@@ -127,28 +458,128 @@
 //Pulse Period (ms)
 #define LIMS_DPV5   20, 5000
 
+//EIS Experiment parameter limits
+
+//DC potential (mV)
+#define LIMS_EIS0   -1500, 1500
+//Amplitude (mV)
+#define LIMS_EIS1   1, 100
+//Start frequency (mHz)
+#define LIMS_EIS2   100, 20000
+//Stop frequency (mHz)
+#define LIMS_EIS3   100, 20000
+//Points per decade
+#define LIMS_EIS4   1, 20
+//Periods measured per point
+#define LIMS_EIS5   1, 20
+
 //Prototypes:
-    void receiveCmd(void);
+    void pollCmd(void);
+    void runCmd(char *cmd, int ncmd);
     boolean parseRunCmd(char *cmd, int ncmd);
+    boolean parseCalCmd(char *cmd, int ncmd, long * rcal);
+    int parseField(char *cmd, int ncmd, char *key, int nkey, long * v, long vmin, long vmax);
+    boolean parseUpdateCmd(char *cmd, int ncmd);
+    void applyUpdate(int cycle);
     int findSubstring(int start, char *sub, int nsub, char *str, int nstr);
     boolean convInt(long * vptr, char *arr, int startIndex, int stopIndex);
     boolean isNum(char c);
+    long expLimit(byte e, byte i, byte m);
     boolean checkParams (int e, int np, long * par);
     boolean setConfig (int experiment, long * par);
-    size_t sendError(String s);
-    size_t sendInfo(String s);
+    boolean planExperiment(boolean report);
+    size_t sendMsg(char type, byte code, long value, boolean hasValue);
+    size_t sendError(byte code);
+    size_t sendError(byte code, long value);
+    size_t sendInfo(byte code);
+    size_t sendInfo(byte code, long value);
+    void sendSample(void);
+    void resetStream(void);
+    void sendSync(void);
+    void btSample(void);
+    void btService(void);
+    void idleSleep(void);
+    void trackWake(void);
+    void resetIdleStats(void);
+    void checkEeLayout(void);
+    void initLog(void);
+    void logSample(void);
+    void writeLog(void);
+    void dumpLog(void);
+    void resetLogInterval(void);
+    void linkNotify(char c);
+    void profEnd(byte slot, unsigned long t0);
+    void sendProfile(void);
+    boolean benchConfig(byte c);
+    void benchPrep(byte k, byte i);
+    void benchCall(byte k);
+    void benchRun(void);
+    void verifyStart(boolean points);
+    void verifyTask(void);
+    void verifyEnd(boolean complete);
+    void saveRun(void);
+    void restoreRun(void);
+    void setSyncOffset(void);
+    void eisStart(void);
+    void eisSetPoint(byte k);
+    void eisInterval(uint64_t t);
+    void eisSample(void);
+    void eisResult(void);
+    uint32_t eisPhase(unsigned long t);
+    int16_t sinQ15(uint32_t phase);
+    void verifySample(uint16_t code, uint64_t t, boolean points);
+    void coaddInit(void);
+    void coaddSample(void);
+    void sendCoadd(void);
+    void saveBlank(void);
+    boolean checkBlank(void);
+    boolean parseSeries(char *cmd, int ncmd);
+    void seriesApply(byte k);
+    void seriesNext(uint64_t t);
+    unsigned int seriesRate(byte k);
+    boolean measureRu(void);
+    long irRead(void);
+    void irTrack(void);
+    int16_t blankAt(uint16_t dac, byte d);
+    void trace(byte type, byte arg, uint16_t data);
+    void traceFlush(void);
+    void traceSend(void);
+    void sendRetransmit(byte seq);
+
+    void frameStart(void);
+    void frameWrite(uint8_t b);
+    void frameEnd(void);
+    void writeVarint(long n);
     float calcOutput(unsigned long ti, unsigned int c);
     uint16_t scaleOutput(float in);
-    void calcInterval(unsigned long t);
+    uint64_t microsExt(void);
+    void calcInterval(uint64_t t);
     void writeDAC(uint16_t value);
+    void calcTimer1(unsigned int rate, unsigned int * preload, byte * prescale);
     void startTimerADC(void);
     void startTimerDAC(void);
     void stopTimers(void);
     void led(bool b);
     void flashLed(byte n, unsigned int d);
+    void startFlash(byte n, unsigned int d);
+    void flashTask(void);
     void setGain(byte n);
+    void initChannels(void);
+    void selectChannel(byte ch);
+    long convCurrent(int16_t code);
+    void setCalScale(byte ch, byte n, float pA);
+    void defaultCal(byte ch);
+    int calEeAddr(byte ch);
+    boolean loadCal(void);
+    void saveCal(void);
+    uint8_t calChecksum(byte ch);
+    int16_t readAvgADC(void);
+    boolean calibrate(long rcal);
     void startExperiment(void);
     void finishExperiment(void);
+    void pauseExperiment(void);
+    void resumeExperiment(void);
+    void sendStatus(void);
     void programFail(byte code);
     void clearExp(void);
     void defLSVExp(void);
@@ -159,8 +590,21 @@
     //void print(void);
     //void println(void);
     //WQM functions
+    void bootTask(void);
+    void bleSend(const __FlashStringHelper *cmd, byte state);
+    byte bleResponse(void);
+    void setBaud(unsigned long baud);
+    void reportBoot(void);
+    void markFirstSample(void);
+    void psSample(void);
     void startExperimentWQM(void);
     void getMeasurementsWQM(void);
-    void sendValues(void);
+    int lookupTemp(int16_t code);
+    int calcPH(long uV, int t);
+    void sendValues(Print &out);
+    void reportWQM(void);
+    void sendAggregates(Print &out);
+    void resetAggregates(void);
+    void updateSwitchTime(void);
     void setClSw(boolean b);
     void wqm_led(boolean b);
\ No newline at end of file
@@ -0,0 +1,78 @@
+//ADS1115 on the host: single-shot conversion (8 ms at 128 SPS), result from hostAdc() (host.h)
+//Blocking read with the library conversion delay, or started with m_conversionDelay 0 and read
+//by getLastConversionResults() once complete (the previous result before)
+#pragma once
+#include "Arduino.h"
+
+#define HOST_ADS_START_US 200  //config write before the conversion
+#define HOST_ADS_CONV_US 7812  //conversion (averaging) time
+#define HOST_ADS_READ_US 150   //delay rounding of the library and result read
+#define ADS1115_CONVERSIONDELAY 8
+
+typedef enum {
+  GAIN_TWOTHIRDS = 0X0000,
+  GAIN_ONE = 0X0200,
+  GAIN_TWO = 0X0400,
+  GAIN_FOUR = 0X0600,
+  GAIN_EIGHT = 0X0800,
+  GAIN_SIXTEEN = 0X0A00
+} adsGain_t;
+
+class Adafruit_ADS1015 {
+  protected:
+    uint8_t m_i2cAddress;
+    uint8_t m_conversionDelay;
+    adsGain_t m_gain;
+    uint64_t convNs; //centre of the conversion started without wait, 0 = none
+    uint8_t convPair;
+    int16_t last;
+    int16_t code(uint8_t pair, uint64_t ns) {
+      hostAdcNs = ns;
+      last = hostAdc ? hostAdc(m_i2cAddress, pair, m_gain) : 0;
+      return last;
+    }
+    int16_t convert(uint8_t pair) {
+      hostDelayUs(HOST_ADS_START_US);
+      if (!m_conversionDelay) {
+        convNs = hostNs + HOST_ADS_CONV_US / 2 * 1000ULL;
+        convPair = pair;
+        hostDelayUs(HOST_ADS_READ_US);
+        return last;
+      }
+      hostDelayUs(HOST_ADS_CONV_US / 2);
+      int16_t r = code(pair, hostNs);
+      hostDelayUs(HOST_ADS_CONV_US - HOST_ADS_CONV_US / 2 + HOST_ADS_READ_US);
+      return r;
+    }
+  public:
+    Adafruit_ADS1015(uint8_t i2cAddress = 0X48)
+      : m_i2cAddress(i2cAddress), m_conversionDelay(ADS1115_CONVERSIONDELAY), m_gain(GAIN_TWOTHIRDS),
+        convNs(0), convPair(0), last(0) {}
+    void begin() {}
+    int16_t readADC_Differential_0_1() {
+      return convert(0);
+    }
+    int16_t readADC_Differential_2_3() {
+      return convert(1);
+    }
+    int16_t getLastConversionResults() {
+      hostDelayUs(m_conversionDelay * 1000UL);
+      if (convNs && hostNs >= convNs + HOST_ADS_CONV_US / 2 * 1000ULL) {
+        code(convPair, convNs);
+        convNs = 0;
+      }
+      hostDelayUs(HOST_ADS_READ_US);
+      return last;
+    }
+    void setGain(adsGain_t gain) {
+      m_gain = gain;
+    }
+    adsGain_t getGain() {
+      return m_gain;
+    }
+};
+
+class Adafruit_ADS1115 : public Adafruit_ADS1015 {
+  public:
+    Adafruit_ADS1115(uint8_t i2cAddress = 0X48) : Adafruit_ADS1015(i2cAddress) {}
+};
@@ -0,0 +1,179 @@
+//Arduino core API on the host simulator (host.h)
+#pragma once
+#include "host.h"
+#include "avr/io.h"
+#include "avr/pgmspace.h"
+#include "avr/interrupt.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+#define abs(x) ((x) > 0 ? (x) : -(x))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+
+//Time, micros() / millis() wrap at 32 bits as on the target
+inline unsigned long micros() {
+  return (unsigned long)((hostNs / 1000) & 0XFFFFFFFFULL);
+}
+inline unsigned long millis() {
+  return (unsigned long)((hostNs / 1000000) & 0XFFFFFFFFULL);
+}
+inline void delay(unsigned long ms) {
+  hostDelayUs((uint64_t)ms * 1000);
+}
+inline void delayMicroseconds(unsigned int us) {
+  hostDelayUs(us);
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  hostPinMode[pin] = mode;
+}
+inline void digitalWrite(uint8_t pin, uint8_t v) {
+  hostPinOut[pin] = v ? 1 : 0;
+  hostPinWrites[pin]++;
+}
+inline int digitalRead(uint8_t pin) {
+  return hostPinMode[pin] == OUTPUT ? hostPinOut[pin] : hostPinIn[pin];
+}
+
+inline long random(long howbig) {
+  return howbig > 0 ? (long)(hostRand() % (unsigned long)howbig) : 0;
+}
+inline long random(long howsmall, long howbig) {
+  return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+inline void randomSeed(unsigned long seed) {
+  hostRandState = seed;
+}
+
+class Print {
+  public:
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buf, size_t n) {
+      size_t k = 0;
+      while (n--) k += write(*buf++);
+      return k;
+    }
+    size_t write(const char *s) {
+      return write((const uint8_t *)s, strlen(s));
+    }
+    size_t print(const char *s) {
+      return write(s);
+    }
+    size_t print(const __FlashStringHelper *s) {
+      return write((const char *)s);
+    }
+    size_t print(char c) {
+      return write((uint8_t)c);
+    }
+    size_t print(unsigned char v, int base = DEC) {
+      return print((unsigned long)v, base);
+    }
+    size_t print(int v, int base = DEC) {
+      return print((long)v, base);
+    }
+    size_t print(unsigned int v, int base = DEC) {
+      return print((unsigned long)v, base);
+    }
+    size_t print(long v, int base = DEC) {
+      char b[24];
+      snprintf(b, sizeof(b), base == HEX ? "%lX" : "%ld", v);
+      return write(b);
+    }
+    size_t print(unsigned long v, int base = DEC) {
+      char b[24];
+      snprintf(b, sizeof(b), base == HEX ? "%lX" : "%lu", v);
+      return write(b);
+    }
+    size_t print(double v, int digits = 2) {
+      char b[48];
+      if (isnan(v)) return write("nan");
+      if (isinf(v)) return write("inf");
+      snprintf(b, sizeof(b), "%.*f", digits, v);
+      return write(b);
+    }
+    size_t println() {
+      return write("\r\n");
+    }
+    template <class T> size_t println(T v) {
+      size_t n = print(v);
+      return n + println();
+    }
+    template <class T> size_t println(T v, int f) {
+      size_t n = print(v, f);
+      return n + println();
+    }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+};
+
+//Hardware serial port, tx timed at the baud rate, see host.h
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long baud) {
+      hostBaud = baud;
+    }
+    operator bool() {
+      return true;
+    }
+    int available() {
+      hostRxPoll();
+      return hostRx.size();
+    }
+    int read() {
+      hostRxPoll();
+      if (hostRx.empty()) return -1;
+      uint8_t b = hostRx.front();
+      hostRx.pop_front();
+      return b;
+    }
+    int availableForWrite() {
+      return HOST_SERIAL_BUF - 1 - hostTxQueued();
+    }
+    void flush() {
+      hostAdvance(hostTxBusy);
+    }
+    size_t write(uint8_t b) {
+      //buffer full, wait for one byte to be sent
+      if (hostTxQueued() >= HOST_SERIAL_BUF - 1) hostAdvance(hostTxBusy - (HOST_SERIAL_BUF - 2) * hostByteNs());
+      hostTxBusy = (hostTxBusy > hostNs ? hostTxBusy : hostNs) + hostByteNs();
+      hostTx += (char)b;
+      if (hostTxNsEn) hostTxNs.push_back(hostTxBusy);
+      return 1;
+    }
+    inline size_t write(unsigned long n) {
+      return write((uint8_t)n);
+    }
+    inline size_t write(long n) {
+      return write((uint8_t)n);
+    }
+    inline size_t write(unsigned int n) {
+      return write((uint8_t)n);
+    }
+    inline size_t write(int n) {
+      return write((uint8_t)n);
+    }
+    using Print::write;
+};
+
+HardwareSerial Serial;
@@ -0,0 +1,34 @@
+//EEPROM on the host, hostEe[] with write counts per byte and 3.3 ms per write (host.h)
+#pragma once
+#include "Arduino.h"
+
+#define HOST_EE_WRITE_US 3300
+
+struct EEPROMClass {
+  uint8_t read(int addr) {
+    return hostEe[addr];
+  }
+  void write(int addr, uint8_t v) {
+    hostDelayUs(HOST_EE_WRITE_US);
+    hostEe[addr] = v;
+    hostEeWrites[addr]++;
+  }
+  void update(int addr, uint8_t v) {
+    if (hostEe[addr] != v) write(addr, v);
+  }
+  template <class T> T &get(int addr, T &t) {
+    memcpy(&t, &hostEe[addr], sizeof(T));
+    return t;
+  }
+  //written with update(), as the Arduino library does
+  template <class T> const T &put(int addr, const T &t) {
+    const uint8_t *p = (const uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++) update(addr + i, p[i]);
+    return t;
+  }
+  uint16_t length() {
+    return sizeof(hostEe);
+  }
+};
+
+EEPROMClass EEPROM;
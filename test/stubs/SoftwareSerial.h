@@ -0,0 +1,24 @@
+//SoftwareSerial on the host, output captured in hostBt
+//each byte is bit-banged with interrupts disabled: the clock advances by one byte time and timer
+//interrupts due meanwhile run late (hostIsrLate), pending ones run between bytes
+#pragma once
+#include "Arduino.h"
+
+std::string hostBt;
+
+class SoftwareSerial : public Print {
+  public:
+    SoftwareSerial(uint8_t rx, uint8_t tx) : baud(9600) {}
+    void begin(long b) {
+      baud = b;
+    }
+    size_t write(uint8_t b) {
+      hostAdvance(hostNs);
+      hostNs += 10000000000ULL / baud;
+      hostBt += (char)b;
+      return 1;
+    }
+    using Print::write;
+  private:
+    long baud;
+};
@@ -0,0 +1,40 @@
+//I2C master on the host, devices in hostI2c[] acknowledge, MAX5217 writes recorded (host.h)
+#pragma once
+#include "Arduino.h"
+
+#define HOST_I2C_BYTE_US 23 //9 bits at 400 kHz
+
+class TwoWire {
+  public:
+    void begin() {}
+    void setClock(uint32_t f) {}
+    void beginTransmission(uint8_t addr) {
+      txAddr = addr;
+      nTx = 0;
+    }
+    size_t write(uint8_t b) {
+      if (nTx < sizeof(txBuf)) txBuf[nTx++] = b;
+      return 1;
+    }
+    //returns 0 = acknowledged, 2 = no device
+    uint8_t endTransmission(uint8_t sendStop = 1) {
+      hostDelayUs((nTx + 1) * HOST_I2C_BYTE_US);
+      if (!hostI2c[txAddr & 0X7F]) return 2;
+      if (nTx == 3 && txBuf[0] == 0X01) {
+        //MAX5217 code load
+        uint16_t code = (txBuf[1] << 8) | txBuf[2];
+        hostDac[txAddr] = code;
+        if (hostDacLogEn) {
+          HostDacWrite w = {hostNs, txAddr, code};
+          hostDacLog.push_back(w);
+        }
+      }
+      return 0;
+    }
+  private:
+    uint8_t txAddr = 0;
+    uint8_t txBuf[8];
+    uint8_t nTx = 0;
+};
+
+TwoWire Wire;
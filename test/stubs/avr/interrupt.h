@@ -0,0 +1,12 @@
+//Interrupt handlers are registered with the host timer model and run by hostAdvance()
+#pragma once
+#include "../host.h"
+
+#define ISR(vector) \
+  void vector##_handler(void); \
+  HostIsrReg vector##_reg(vector##_num, vector##_handler); \
+  void vector##_handler(void)
+
+//handlers only run between firmware statements (hostAdvance()), so nothing to mask
+#define cli()
+#define sei()
@@ -0,0 +1,24 @@
+//AVR registers used by the firmware, plain variables on the host (see host.h for the timer model)
+#pragma once
+#include <stdint.h>
+
+#define _BV(b) (1 << (b))
+
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1, TCCR2A, TCCR2B, TIMSK2, TCNT2, ADCSRA, ACSR, PRR, SREG;
+volatile uint16_t TCNT1;
+
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define TOIE1 0
+#define TOIE2 0
+#define TOV1 0
+#define ACD 7
+#define PRADC 0
+
+//interrupt vectors, index of the host timer model (host.h)
+#define TIMER1_OVF_vect_num 1
+#define TIMER2_OVF_vect_num 2
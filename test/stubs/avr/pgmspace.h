@@ -0,0 +1,14 @@
+//Flash and SRAM share one address space on the host
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) ((uint8_t)*(p))
+#define pgm_read_word(p) ((uint16_t)*(p))
+#define pgm_read_dword(p) ((uint32_t)*(p))
+#define pgm_read_ptr(p) ((void *)*(p))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
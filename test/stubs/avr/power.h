@@ -0,0 +1,6 @@
+#pragma once
+#include "io.h"
+
+inline void power_adc_disable() {
+  PRR |= _BV(PRADC);
+}
@@ -0,0 +1,15 @@
+//Sleep: sleep_cpu() advances the virtual clock to the next wake up event (timer interrupt, rx byte,
+//millis() tick), so the firmware's sleep time accounting sees the idle time
+#pragma once
+#include "../host.h"
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
+
+inline void set_sleep_mode(int mode) {}
+inline void sleep_enable() {}
+inline void sleep_disable() {}
+inline void sleep_cpu() {
+  hostIdle(hostSleepEnd);
+  hostSlept = true;
+}
@@ -0,0 +1,84 @@
+/*
+ * Host side clock drift correction for the packed stream (STREAM_PACKED): every 'T' sync record
+ * (device us) paired with its arrival time on the host clock, offset and skew from the line below all
+ * arrivals with the least total delay (link delay only adds, the earliest arrivals carry the clock).
+ * Sample ticks (us >> STREAM_TICK_SHIFT, low 32 bits) are unwrapped against the last sync record and
+ * mapped to host time. Only the packed stream carries ticks and sync records, the 'B' frame has no
+ * sample time. driftSync() per 'T' record, driftFit(), then driftHostUs() per sample.
+ */
+#pragma once
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+
+struct DriftPoint {
+  uint64_t dev; //device time (us)
+  double host;  //arrival on the host clock (us)
+};
+
+std::vector<DriftPoint> driftPts;
+double driftOffset = 0; //host time (us) at device time driftPts[0].dev
+double driftSkew = 1;   //host us per device us
+
+void driftReset() {
+  driftPts.clear();
+  driftOffset = 0;
+  driftSkew = 1;
+}
+
+void driftSync(uint64_t devUs, double hostUs) {
+  DriftPoint p = {devUs, hostUs};
+  driftPts.push_back(p);
+}
+
+//Record i relative to the first: device us, host us
+double driftX(size_t i) {
+  return (double)(driftPts[i].dev - driftPts[0].dev);
+}
+
+double driftY(size_t i) {
+  return driftPts[i].host - driftPts[0].host;
+}
+
+/* Fit offset and skew, false with less than two sync records
+    Link delay only adds (queued bytes, connection interval), so the line is taken below every record
+    with the least total delay: the lower convex hull edge spanning the mean device time.
+*/
+bool driftFit() {
+  size_t n = driftPts.size();
+  if (n < 2) return false;
+  //lower hull, records in device time order
+  std::vector<size_t> h;
+  double xm = 0;
+  for (size_t i = 0; i < n; i++) {
+    xm += driftX(i) / n;
+    while (h.size() >= 2) {
+      size_t a = h[h.size() - 2], b = h.back();
+      double cross = (driftX(b) - driftX(a)) * (driftY(i) - driftY(a)) - (driftY(b) - driftY(a)) * (driftX(i) - driftX(a));
+      if (cross > 0) break;
+      h.pop_back();
+    }
+    h.push_back(i);
+  }
+  size_t k = 0;
+  while (k + 2 < h.size() && driftX(h[k + 1]) < xm) k++;
+  size_t a = h[k], b = h[k + 1];
+  if (driftX(b) <= driftX(a)) return false;
+  driftSkew = (driftY(b) - driftY(a)) / (driftX(b) - driftX(a));
+  driftOffset = driftPts[0].host + driftY(a) - driftSkew * driftX(a);
+  return true;
+}
+
+//Device time (us) of a sample tick, unwrapped to the 2^32 tick period nearest the last sync record
+uint64_t driftTickUs(uint32_t tick) {
+  uint64_t ref = driftPts.empty() ? 0 : driftPts.back().dev >> STREAM_TICK_SHIFT;
+  uint64_t t = (ref & ~0XFFFFFFFFULL) | tick;
+  if (t + 0X80000000ULL < ref) t += 1ULL << 32;
+  else if (t > ref + 0X80000000ULL && t >= (1ULL << 32)) t -= 1ULL << 32;
+  return t << STREAM_TICK_SHIFT;
+}
+
+//Host time (us) of a sample tick
+double driftHostUs(uint32_t tick) {
+  return driftOffset + driftSkew * ((double)driftTickUs(tick) - (double)driftPts[0].dev);
+}
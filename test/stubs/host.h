@@ -0,0 +1,214 @@
+/*
+ * Host simulator for the native test environment (pio test -e native)
+ *
+ * Replaces the Arduino core and the peripherals used by the firmware:
+ * - virtual clock (ns), advanced by delay(), blocking peripherals and the test driver
+ * - Timer1 / Timer2 overflow interrupts from the AVR registers (prescaler, preload in TCNTn)
+ * - Serial: tx captured in hostTx and timed at the baud rate (64 byte buffer, write blocks when full),
+ *   rx bytes arrive at the baud rate (64 byte buffer, overflow dropped)
+ * - pins, I2C devices (ack, MAX5217 codes), ADS1115 conversions (hostAdc callback), EEPROM (wear counted)
+ *
+ * Each test program is one translation unit (test_main.cpp includes the firmware source),
+ * so the simulator state is defined in the headers.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include "avr/io.h"
+
+#define HOST_F_CPU 16000000ULL
+#define HOST_SERIAL_BUF 64      //HardwareSerial rx / tx buffer (bytes)
+#define HOST_IDLE_NS 1000000ULL //max idle step of hostRun(), millis() tick wakes the CPU
+
+void setup(void);
+void loop(void);
+
+uint64_t hostNs = 0; //virtual time since reset (ns)
+
+//Interrupt handlers, registered by ISR() (avr/interrupt.h), index = timer
+typedef void (*HostIsr)(void);
+HostIsr hostIsr[3];
+struct HostIsrReg {
+  HostIsrReg(int n, HostIsr f) {
+    hostIsr[n] = f;
+  }
+};
+uint64_t hostTimerNext[3]; //next overflow (ns), 0 = not scheduled
+uint64_t hostIsrLate[3]; //longest delay of a handler after its overflow (ns), interrupts disabled
+
+//Timer clock prescaler from the clock select bits, 0 = stopped
+inline unsigned hostPrescale(int n) {
+  static const unsigned T1[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  static const unsigned T2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+  return n == 1 ? T1[TCCR1B & 7] : T2[TCCR2B & 7];
+}
+
+inline bool hostTimerOn(int n) {
+  return hostPrescale(n) && (n == 1 ? (TIMSK1 & _BV(TOIE1)) : (TIMSK2 & _BV(TOIE2)));
+}
+
+//Schedule overflows of running timers from their count (preload written by the firmware / ISR)
+inline void hostSchedule() {
+  for (int n = 1; n <= 2; n++) {
+    if (!hostTimerOn(n)) {
+      hostTimerNext[n] = 0;
+    } else if (hostTimerNext[n] == 0) {
+      uint64_t ticks = n == 1 ? 65536 - TCNT1 : 256 - TCNT2;
+      hostTimerNext[n] = hostNs + ticks * hostPrescale(n) * 1000000000ULL / HOST_F_CPU;
+    }
+  }
+}
+
+//Advance virtual time to t (ns), timer interrupts due on the way are run in order
+inline void hostAdvance(uint64_t t) {
+  while (true) {
+    hostSchedule();
+    int n = 0;
+    for (int k = 1; k <= 2; k++) {
+      if (hostTimerNext[k] && hostTimerNext[k] <= t && (!n || hostTimerNext[k] < hostTimerNext[n])) n = k;
+    }
+    if (!n) break;
+    if (hostTimerNext[n] > hostNs) hostNs = hostTimerNext[n];
+    if (hostNs - hostTimerNext[n] > hostIsrLate[n]) hostIsrLate[n] = hostNs - hostTimerNext[n];
+    hostTimerNext[n] = 0;
+    if (hostIsr[n]) hostIsr[n]();
+  }
+  if (t > hostNs) hostNs = t;
+}
+
+inline void hostDelayUs(uint64_t us) {
+  hostAdvance(hostNs + us * 1000);
+}
+
+//Serial link
+std::string hostTx; //bytes written by the firmware
+std::deque<uint8_t> hostRx; //received, not yet read
+std::deque<std::pair<uint64_t, uint8_t> > hostRxPending; //arrival time (ns), byte
+unsigned long hostBaud = 9600;
+uint64_t hostTxBusy = 0; //tx buffer empty at (ns)
+unsigned long hostRxDropped = 0; //rx buffer overflows
+bool hostTxNsEn = false; //log the wire time of every byte written
+std::vector<uint64_t> hostTxNs; //end of each byte on the wire (ns), parallel to hostTx
+
+inline uint64_t hostByteNs() {
+  return 10000000000ULL / hostBaud;
+}
+
+//Bytes waiting in the tx buffer
+inline unsigned hostTxQueued() {
+  if (hostTxBusy <= hostNs) return 0;
+  return (hostTxBusy - hostNs + hostByteNs() - 1) / hostByteNs();
+}
+
+//Host sends s, bytes arrive at the baud rate after the last pending byte
+inline void hostSend(const std::string &s) {
+  uint64_t t = hostRxPending.empty() ? hostNs : hostRxPending.back().first;
+  for (size_t i = 0; i < s.size(); i++) {
+    t += hostByteNs();
+    hostRxPending.push_back(std::make_pair(t, (uint8_t)s[i]));
+  }
+}
+
+//Move arrived bytes into the rx buffer
+inline void hostRxPoll() {
+  while (!hostRxPending.empty() && hostRxPending.front().first <= hostNs) {
+    if (hostRx.size() < HOST_SERIAL_BUF - 1) {
+      hostRx.push_back(hostRxPending.front().second);
+    } else {
+      hostRxDropped++;
+    }
+    hostRxPending.pop_front();
+  }
+}
+
+//Take captured output
+inline std::string hostTake() {
+  std::string s;
+  s.swap(hostTx);
+  hostTxNs.clear();
+  return s;
+}
+
+//Pins: output latch, writes per pin, input level (default high, pull-up)
+uint8_t hostPinOut[32];
+unsigned long hostPinWrites[32];
+uint8_t hostPinMode[32];
+uint8_t hostPinIn[32] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                         1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+
+//I2C devices: acknowledge, last code written to each MAX5217 (and every write if hostDacLogEn)
+struct HostDacWrite {
+  uint64_t ns;
+  uint8_t addr;
+  uint16_t code;
+};
+bool hostI2c[128];
+uint16_t hostDac[128];
+bool hostDacLogEn = false;
+std::vector<HostDacWrite> hostDacLog;
+
+//ADS1115 conversion result: address, pair (0 = 0_1, 1 = 2_3), PGA gain, centre of the conversion in hostAdcNs
+//(called at that time for blocking reads, at the result read for conversions started without wait)
+int16_t (*hostAdc)(uint8_t addr, uint8_t pair, uint16_t gain) = 0;
+uint64_t hostAdcNs = 0;
+
+//EEPROM, erased (0XFF) at start, writes per byte counted (wear)
+uint8_t hostEe[1024];
+unsigned long hostEeWrites[1024];
+struct HostEeInit {
+  HostEeInit() {
+    memset(hostEe, 0XFF, sizeof(hostEe));
+  }
+} hostEeInit;
+
+//Idle until the next timer event, rx byte or millis() tick (CPU asleep / polling), not beyond end
+inline void hostIdle(uint64_t end) {
+  uint64_t t = hostNs + HOST_IDLE_NS;
+  hostSchedule();
+  for (int n = 1; n <= 2; n++) {
+    if (hostTimerNext[n] && hostTimerNext[n] < t) t = hostTimerNext[n];
+  }
+  if (!hostRxPending.empty() && hostRxPending.front().first < t) t = hostRxPending.front().first;
+  if (t > end) t = end;
+  if (t <= hostNs) t = hostNs + 1;
+  hostAdvance(t);
+}
+
+//CPU asleep in sleep_cpu() (avr/sleep.h) until the next wake up event, not beyond hostSleepEnd
+uint64_t hostSleepEnd = ~0ULL;
+bool hostSlept = false;
+
+//One loop() pass, then idle (polling) until the next event unless loop() slept
+inline void hostStep(uint64_t end) {
+  hostSleepEnd = end;
+  hostSlept = false;
+  loop();
+  if (!hostSlept) hostIdle(end);
+}
+
+//Run loop() for us microseconds of virtual time
+inline void hostRun(uint64_t us) {
+  uint64_t end = hostNs + us * 1000;
+  while (hostNs < end) hostStep(end);
+}
+
+//Run loop() until cond() is true or us microseconds passed, returns cond()
+template <class F> bool hostRunUntil(F cond, uint64_t us) {
+  uint64_t end = hostNs + us * 1000;
+  while (!cond() && hostNs < end) hostStep(end);
+  return cond();
+}
+
+//Deterministic random(), same sequence every run
+uint32_t hostRandState = 1;
+inline uint32_t hostRand() {
+  hostRandState = hostRandState * 1103515245UL + 12345UL;
+  return hostRandState >> 1;
+}
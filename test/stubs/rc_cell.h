@@ -0,0 +1,66 @@
+/*
+ * RC dummy cell for the host simulator: Ru in series with Rct || Cdl between the working electrode
+ * potential (PS DAC) and the TIA. Cell state integrated exactly over the DAC staircase (hostDacLog),
+ * ADC code the mean current of the conversion window (delta-sigma averaging of the ADS1115),
+ * nominal current scale of the selected gain. rcStart() before the run, hostAdc = rcAdc.
+ */
+#pragma once
+#include <math.h>
+#include "host.h"
+
+double rcRu = 1000.0;   //ohm
+double rcRct = 10000.0; //ohm
+double rcCdl = 10.0E-6; //F
+
+//Cell state: voltage across Rct || Cdl at rcT, DAC writes integrated up to rcDac,
+//integral of the drop across Ru (V s)
+double rcV = 0;
+double rcQ = 0;
+double rcE = 0; //applied potential (V)
+uint64_t rcT = 0;
+size_t rcDac = 0;
+
+//Cell time constant (s)
+double rcTau() {
+  return rcCdl * rcRu * rcRct / (rcRu + rcRct);
+}
+
+//Cell discharged at the present DAC code, DAC writes logged from now on
+void rcStart() {
+  hostDacLog.clear();
+  hostDacLogEn = true;
+  rcDac = 0;
+  rcT = hostNs;
+  rcE = hostDac[PS_DAC_ADDR] / 21845.0 - 1.5;
+  rcV = rcE * rcRct / (rcRu + rcRct);
+  rcQ = 0;
+}
+
+//Integrate the cell up to t (ns), potential constant between DAC writes
+void rcTo(uint64_t t) {
+  const double tau = rcTau();
+  const double k = rcRct / (rcRu + rcRct);
+  while (rcT < t) {
+    uint64_t tn = t;
+    if (rcDac < hostDacLog.size() && hostDacLog[rcDac].ns < tn) tn = hostDacLog[rcDac].ns;
+    double vInf = rcE * k;
+    double dt = (tn - rcT) * 1.0E-9;
+    double x = exp(-dt / tau);
+    rcQ += (rcE - vInf) * dt - (rcV - vInf) * tau * (1 - x);
+    rcV = vInf + (rcV - vInf) * x;
+    rcT = tn;
+    if (rcDac < hostDacLog.size() && hostDacLog[rcDac].ns <= rcT) {
+      if (hostDacLog[rcDac].addr == PS_DAC_ADDR) rcE = hostDacLog[rcDac].code / 21845.0 - 1.5;
+      rcDac++;
+    }
+  }
+}
+
+//TIA code of the mean cell current over the conversion (centre at hostAdcNs)
+int16_t rcAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  rcTo(hostAdcNs - HOST_ADS_CONV_US * 500ULL);
+  double q0 = rcQ;
+  rcTo(hostAdcNs + HOST_ADS_CONV_US * 500ULL);
+  double pA = (rcQ - q0) / (HOST_ADS_CONV_US * 1.0E-6) / rcRu * 1.0E12;
+  return (int16_t)constrain(lround(pA * (double)(1L << gCal->shift) / gCal->scale), -32768L, 32767L);
+}
@@ -0,0 +1,98 @@
+/*
+ * Electrochemical cell for the host simulator: Randles circuit (Rs, Cdl) with a reversible,
+ * diffusion limited redox couple, reduced form in solution, between the working electrode potential
+ * (PS DAC writes, hostDacLog) and the TIA. The double layer charges through Rs towards the DAC
+ * potential less the faradaic iR drop, the surface concentration follows Nernst at the double layer
+ * voltage and the faradaic current is the diffusion flux at the surface (explicit finite difference,
+ * fixed step SIM_DT_NS, grid deep enough for ~25 s of diffusion). ADC code the mean current of the
+ * conversion window, nominal current scale of the selected gain. simStart() before the run,
+ * hostAdc = simAdc.
+ */
+#pragma once
+#include <math.h>
+#include <vector>
+#include "host.h"
+
+#define SIM_DT_NS 200000ULL //grid time step
+#define SIM_LAMBDA 0.45     //D dt / dx^2, explicit scheme stable below 0.5
+#define SIM_NODES 1500      //diffusion grid points, last = bulk
+#define FARADAY 96485.0     //C/mol
+#define F_RT 38.92          //F / RT at 25 deg. C (1/V)
+
+double simE0 = 0.2;     //formal potential (V)
+double simConc = 1.0;   //bulk concentration (mM)
+double simArea = 0.071; //electrode area (cm^2), 3 mm disk
+double simD = 7.6E-6;   //diffusion coefficient (cm^2/s)
+double simN = 1;        //electrons transferred
+double simRs = 100.0;   //solution resistance (ohm)
+double simCdl = 1.4E-6; //double layer capacitance (F)
+
+//Cell state: reduced form concentration / bulk on the grid from the surface, double layer voltage,
+//faradaic current, charge passed (A s), integrated up to simT, DAC writes applied up to simDac
+std::vector<double> simR;
+double simVc = 0;
+double simIF = 0;
+double simQ = 0;
+double simE = 0; //applied potential (V)
+uint64_t simT = 0;
+size_t simDac = 0;
+
+//Randles-Sevcik peak current (A) of a reversible couple at scan rate v (V/s), 25 deg. C
+double simPeak(double v) {
+  return 0.4463 * simN * FARADAY * simArea * simConc * 1.0E-6 * sqrt(simN * v * simD * F_RT);
+}
+
+//Solution at bulk concentration, double layer charged to the present DAC potential, DAC writes logged
+void simStart() {
+  hostDacLog.clear();
+  hostDacLogEn = true;
+  simDac = 0;
+  simT = hostNs;
+  simE = hostDac[PS_DAC_ADDR] / 21845.0 - 1.5;
+  simR.assign(SIM_NODES, 1.0);
+  simVc = simE;
+  simIF = 0;
+  simQ = 0;
+}
+
+//One grid step at the applied potential
+void simStep() {
+  const double dt = SIM_DT_NS * 1.0E-9;
+  const double dx = sqrt(simD * dt / SIM_LAMBDA);
+  double vInf = simE - simIF * simRs;
+  double vc = vInf + (simVc - vInf) * exp(-dt / (simRs * simCdl));
+  double iC = simCdl * (vc - simVc) / dt;
+  simVc = vc;
+  simR[0] = 1.0 / (1.0 + exp((vc - simE0) * simN * F_RT));
+  double prev = simR[0];
+  for (size_t i = 1; i < SIM_NODES - 1; i++) {
+    double r = simR[i];
+    simR[i] = r + SIM_LAMBDA * (simR[i + 1] - 2.0 * r + prev);
+    prev = r;
+  }
+  //n F A C D dR/dx at the surface (2nd order), C in mol/cm^3, oxidation current positive
+  simIF = simN * FARADAY * simArea * simConc * 1.0E-6 * simD * (-3.0 * simR[0] + 4.0 * simR[1] - simR[2]) / (2.0 * dx);
+  simQ += (simIF + iC) * dt;
+}
+
+//Integrate the cell up to t (ns), DAC writes take effect at the next grid step
+void simTo(uint64_t t) {
+  while (simT + SIM_DT_NS <= t) {
+    while (simDac < hostDacLog.size() && hostDacLog[simDac].ns <= simT) {
+      if (hostDacLog[simDac].addr == PS_DAC_ADDR) simE = hostDacLog[simDac].code / 21845.0 - 1.5;
+      simDac++;
+    }
+    simStep();
+    simT += SIM_DT_NS;
+  }
+}
+
+//TIA code of the mean cell current over the conversion (centre at hostAdcNs)
+int16_t simAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  simTo(hostAdcNs - HOST_ADS_CONV_US * 500ULL);
+  double q0 = simQ;
+  uint64_t t0 = simT;
+  simTo(hostAdcNs + HOST_ADS_CONV_US * 500ULL);
+  double pA = (simQ - q0) / ((simT - t0) * 1.0E-9) * 1.0E12;
+  return (int16_t)constrain(lround(pA * (double)(1L << gCal->shift) / gCal->scale), -32768L, 32767L);
+}
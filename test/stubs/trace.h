@@ -0,0 +1,211 @@
+/*
+ * Trace capture reader and replay for the host simulator (TRACE_EN builds)
+ *
+ * A capture is the raw serial output of a TRACE_EN build, from the device or from host.h:
+ * trace records are SLIP frames 'Z' type arg data(2) us(4) + CRC-8 (TR_ types in WQM_PotStat_Shield.h),
+ * text and other frames in between are skipped. Captures are memory mapped and read as a stream,
+ * so long captures are not loaded into memory.
+ *
+ * Replay re-drives loop() from the inputs of a capture: ADC codes (hostAdc) in recorded order and
+ * serial bytes at the time they were read. Timer events come from the simulated timers, timer and
+ * DAC records of the replayed firmware are compared against the capture.
+ */
+#pragma once
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "host.h"
+#include "util/crc16.h"
+
+struct TraceEvent {
+  uint8_t type;
+  uint8_t arg;
+  uint16_t data;
+  uint64_t us; //device time, unwrapped
+};
+
+//Incremental SLIP / CRC-8 decoder of trace records
+struct TraceFrames {
+  uint8_t frame[12];
+  uint8_t n;
+  bool esc, over;
+  uint32_t usLast;
+  uint64_t usHi;
+  unsigned long records, skipped; //trace records, other frames / text / corrupt
+
+  TraceFrames() : n(0), esc(false), over(false), usLast(0), usHi(0), records(0), skipped(0) {}
+
+  //Feed one byte, true when c completes a trace record
+  bool push(uint8_t c, TraceEvent &ev) {
+    if (c == SLIP_END) {
+      bool ok = !over && n == 10 && frame[0] == 'Z';
+      if (ok) {
+        uint8_t crc = 0XFF;
+        for (int i = 0; i < 9; i++) crc = _crc8_ccitt_update(crc, frame[i]);
+        ok = crc == frame[9];
+      }
+      if (!ok && (n || over)) skipped++;
+      n = 0;
+      esc = over = false;
+      if (!ok) return false;
+      uint32_t us = frame[5] | (frame[6] << 8) | (frame[7] << 16) | ((uint32_t)frame[8] << 24);
+      if (us < usLast && usLast - us > 0X80000000UL) usHi += 0X100000000ULL;
+      usLast = us;
+      ev.type = frame[1];
+      ev.arg = frame[2];
+      ev.data = frame[3] | (frame[4] << 8);
+      ev.us = usHi + us;
+      records++;
+      return true;
+    }
+    if (esc) {
+      c = c == SLIP_ESC_END ? SLIP_END : c == SLIP_ESC_ESC ? SLIP_ESC : c;
+      esc = false;
+    } else if (c == SLIP_ESC) {
+      esc = true;
+      return false;
+    }
+    if (n < sizeof(frame)) {
+      frame[n++] = c;
+    } else {
+      over = true;
+    }
+    return false;
+  }
+};
+
+//Streaming reader over a memory mapped capture file
+struct TraceReader {
+  const uint8_t *p;
+  size_t len, pos;
+  TraceFrames dec;
+
+  TraceReader() : p(0), len(0), pos(0) {}
+  ~TraceReader() {
+    if (p) munmap((void *)p, len);
+  }
+
+  bool open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+    if (ok) {
+      len = st.st_size;
+      void *m = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+      ok = m != MAP_FAILED;
+      if (ok) p = (const uint8_t *)m;
+    }
+    ::close(fd);
+    return ok;
+  }
+
+  //Next trace record, false at the end of the capture
+  bool next(TraceEvent &ev) {
+    while (pos < len) {
+      if (dec.push(p[pos++], ev)) return true;
+    }
+    return false;
+  }
+
+  //Next record of type t
+  bool next(uint8_t t, TraceEvent &ev) {
+    while (next(ev)) {
+      if (ev.type == t) return true;
+    }
+    return false;
+  }
+};
+
+/* Replay of a capture, one cursor per stream of the capture:
+   rx bytes scheduled at their read time, ADC codes returned in order, timer / DAC records compared
+   with the records of the replayed firmware (output decoded from hostTx).
+   Replay starts from reset like the capture (same setup() and link state), so device time of the
+   capture is host time. Rx bytes are replayed at the us of the capture, so record times match within
+   TRACE_REPLAY_US (micros() resolution of the target is 4 us).
+*/
+#define TRACE_REPLAY_US 4
+struct TraceReplay {
+  TraceReader rx, adc, ref;
+  TraceFrames out;
+  bool refMore;
+  TraceEvent refNext;
+  unsigned long compared, mismatches, adcMisses;
+  int64_t maxDev; //largest time difference of matching records (us)
+  TraceEvent firstBad, firstBadRef;
+
+  TraceReplay() : refMore(false), compared(0), mismatches(0), adcMisses(0), maxDev(0) {}
+
+  static TraceReplay *active;
+
+  static bool output(uint8_t t) {
+    return t == TR_ISR || t == TR_DAC;
+  }
+
+  bool open(const char *path) {
+    if (!rx.open(path) || !adc.open(path) || !ref.open(path)) return false;
+    active = this;
+    hostAdc = adcCode;
+    refMore = nextRef();
+    scheduleRx();
+    return true;
+  }
+
+  bool nextRef() {
+    while (ref.next(refNext)) {
+      if (output(refNext.type)) return true;
+    }
+    return false;
+  }
+
+  static int16_t adcCode(uint8_t addr, uint8_t pair, uint16_t gain) {
+    TraceEvent ev;
+    if (!active->adc.next(TR_ADC, ev)) {
+      active->adcMisses++;
+      return 0;
+    }
+    if (ev.arg != (addr | (pair ? 0x80 : 0))) active->adcMisses++;
+    return (int16_t)ev.data;
+  }
+
+  //Rx bytes of the capture, arrival at the recorded read time
+  void scheduleRx() {
+    TraceEvent ev;
+    while (rx.next(TR_RX, ev)) hostRxPending.push_back(std::make_pair(ev.us * 1000ULL, ev.arg));
+  }
+
+  //Compare records of the replayed firmware with the capture
+  void compare() {
+    std::string s = hostTake();
+    TraceEvent ev;
+    for (size_t i = 0; i < s.size(); i++) {
+      if (!out.push((uint8_t)s[i], ev) || !output(ev.type)) continue;
+      if (!refMore) {
+        if (!mismatches++) firstBad = ev;
+        continue;
+      }
+      int64_t dev = llabs((int64_t)ev.us - (int64_t)refNext.us);
+      if (ev.type != refNext.type || ev.arg != refNext.arg || ev.data != refNext.data || dev > TRACE_REPLAY_US) {
+        if (!mismatches++) {
+          firstBad = ev;
+          firstBadRef = refNext;
+        }
+      }
+      if (dev > maxDev) maxDev = dev;
+      compared++;
+      refMore = nextRef();
+    }
+  }
+
+  //Run loop() until every record of the capture is replayed or us microseconds passed
+  bool run(uint64_t us) {
+    uint64_t end = hostNs + us * 1000;
+    while (hostNs < end && refMore) {
+      hostStep(end);
+      compare();
+    }
+    return !refMore;
+  }
+};
+TraceReplay *TraceReplay::active = 0;
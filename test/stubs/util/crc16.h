@@ -0,0 +1,19 @@
+//CRC updates of avr-libc (util/crc16.h), same results as on the target
+#pragma once
+#include <stdint.h>
+
+inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data) {
+  crc = crc ^ ((uint16_t)data << 8);
+  for (int i = 0; i < 8; i++) {
+    crc = (crc & 0X8000) ? (crc << 1) ^ 0X1021 : crc << 1;
+  }
+  return crc;
+}
+
+inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data) {
+  uint8_t d = crc ^ data;
+  for (int i = 0; i < 8; i++) {
+    d = (d & 0X80) ? (d << 1) ^ 0X07 : d << 1;
+  }
+  return d;
+}
@@ -0,0 +1,92 @@
+/*
+ * Host benchmark of the hot path kernels (benchConfig() / benchPrep() / benchCall(), same kernels
+ * as the BENCH_EN target build under simavr): monotonic clock per call, BENCH_ROUNDS sweeps per kernel
+ * and config, JSON line per kernel and config (ns) on stdout or in the file BENCH_JSON (tools/bench.py)
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+#include <time.h>
+
+#define BENCH_ROUNDS 50
+
+double nowNs() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1.0E9 + t.tv_nsec;
+}
+
+struct BenchResult {
+  double min, max, sum;
+  unsigned long n;
+};
+BenchResult benchRes[BENCH_CONFIGS][BENCH_KERNELS];
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_configs(void) {
+  for (byte c = 0; c < BENCH_CONFIGS; c++) {
+    TEST_ASSERT_TRUE(benchConfig(c));
+    TEST_ASSERT_EQUAL(c == 2 ? EXP_DPV : EXP_CSV, expType);
+    TEST_ASSERT_EQUAL(c == 2, e.syncSamplingEN);
+    //kernel calls spread over the active region
+    benchPrep(BENCH_CALC_OUTPUT, 0);
+    TEST_ASSERT_TRUE(currInterval == INTERVAL_EXP1 || currInterval == INTERVAL_EXP2);
+    benchPrep(BENCH_CALC_OUTPUT, BENCH_CALLS - 1);
+    TEST_ASSERT_TRUE(currInterval == INTERVAL_EXP1 || currInterval == INTERVAL_EXP2);
+  }
+}
+
+void test_bench(void) {
+  for (byte c = 0; c < BENCH_CONFIGS; c++) {
+    for (byte k = 0; k < BENCH_KERNELS; k++) {
+      BenchResult &r = benchRes[c][k];
+      r.min = 1.0E30;
+      r.max = 0;
+      r.sum = 0;
+      r.n = 0;
+      for (int round = 0; round < BENCH_ROUNDS; round++) {
+        TEST_ASSERT_TRUE(benchConfig(c));
+        for (byte i = 0; i < BENCH_CALLS; i++) {
+          benchPrep(k, i);
+          double t0 = nowNs();
+          benchCall(k);
+          double ns = nowNs() - t0;
+          if (ns < r.min) r.min = ns;
+          if (ns > r.max) r.max = ns;
+          r.sum += ns;
+          r.n++;
+        }
+        hostTake();
+      }
+      TEST_ASSERT_EQUAL(BENCH_ROUNDS * BENCH_CALLS, r.n);
+    }
+  }
+}
+
+//Report in the format of the target build, times in ns
+void test_report(void) {
+  const char *path = getenv("BENCH_JSON");
+  FILE *f = path ? fopen(path, "w") : stdout;
+  TEST_ASSERT_NOT_NULL(f);
+  for (byte c = 0; c < BENCH_CONFIGS; c++) {
+    for (byte k = 0; k < BENCH_KERNELS; k++) {
+      BenchResult &r = benchRes[c][k];
+      fprintf(f, "{\"fn\":\"%s\",\"exp\":\"%s\",\"n\":%lu,\"min\":%.0f,\"max\":%.0f,\"mean\":%.1f}\n",
+              BENCH_NAME[k], BENCH_EXP[c], r.n, r.min, r.max, r.sum / r.n);
+    }
+  }
+  if (path) fclose(f);
+}
+
+int main(int argc, char **argv) {
+  setup();
+  bootState = BOOT_DONE;
+  setBaud(BLE_BAUD);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_configs);
+  RUN_TEST(test_bench);
+  RUN_TEST(test_report);
+  return UNITY_END();
+}
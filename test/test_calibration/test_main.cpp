@@ -0,0 +1,124 @@
+/*
+ * Current conversion (convCurrent(), setCalScale()) and self calibration (calibrate())
+ * against float reference results, PotStat shield simulated by a TIA model on the ADS1115
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+
+//TIA model: feedback resistors off nominal, offset per gain setting (codes), resistor on the cell
+const float R_NOM[4] = {502.0, 10000.0, 200000.0, 4020000.0};
+const float R_ERR[4] = {1.006, 0.985, 1.020, 0.992};
+long rCell = 10000; //ohm
+
+//Feedback resistor selected by the gain mux pins
+float tiaR() {
+  return R_NOM[hostPinOut[PS_MUX1] * 2 + hostPinOut[PS_MUX0]] * R_ERR[hostPinOut[PS_MUX1] * 2 + hostPinOut[PS_MUX0]];
+}
+
+float adcLsb(uint16_t gain) {
+  return gain == GAIN_SIXTEEN ? 7.8125E-6 : 31.25E-6; //V
+}
+
+int16_t tiaOffset(uint16_t gain) {
+  return 23 + 7 * hostPinOut[PS_MUX0] - 11 * hostPinOut[PS_MUX1] + (gain == GAIN_SIXTEEN ? 40 : 0);
+}
+
+//True cell current (A): DAC potential across rCell while the WE switch is closed
+float cellCurrent() {
+  if (!hostPinOut[PS_WE_SwEn]) return 0.0;
+  return (hostDac[PS_DAC_ADDR] / 21845.0 - 1.5) / rCell;
+}
+
+int16_t tiaAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  float code = cellCurrent() * tiaR() / adcLsb(gain) + tiaOffset(gain);
+  return constrain(lround(code), -32768L, 32767L);
+}
+
+//Nominal current per code (pA) of gain setting n
+float nominalPA(byte n) {
+  return PS_ADC_LSB * 1.0E6 / (R_NOM[n / 2] / 1000.0) / ((n % 2) ? 4.0 : 1.0);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_set_cal_scale(void) {
+  //normalized to 16 bits, scale / 2^shift within half an LSB of the scale
+  for (float pA = 1.0E-3; pA < 6.0E4; pA *= 1.37) {
+    setCalScale(0, 0, pA);
+    TEST_ASSERT_GREATER_OR_EQUAL(32768, cal[0].g[0].scale);
+    float ref = cal[0].g[0].scale / (float)(1UL << cal[0].g[0].shift);
+    TEST_ASSERT_FLOAT_WITHIN(pA / 65536.0, pA, ref);
+  }
+  //above 16 bits saturates
+  setCalScale(0, 0, 1.0E6);
+  TEST_ASSERT_EQUAL(65535, cal[0].g[0].scale);
+  TEST_ASSERT_EQUAL(0, cal[0].g[0].shift);
+}
+
+void test_conv_current_nominal(void) {
+  const int16_t codes[] = {-32768, -20000, -1001, -1, 0, 1, 7, 123, 4567, 32767};
+  defaultCal(0);
+  for (byte n = 0; n <= MAX_GAIN; n++) {
+    setGain(n);
+    for (byte k = 0; k < sizeof(codes) / sizeof(codes[0]); k++) {
+      double ref = codes[k] * (double)nominalPA(n);
+      //fixed point: 2^-16 relative scale error, truncation of the shift (1 pA)
+      TEST_ASSERT_FLOAT_WITHIN(fabs(ref) / 32768.0 + 1.0, ref, (double)convCurrent(codes[k]));
+    }
+  }
+}
+
+void test_conv_current_offset(void) {
+  defaultCal(0);
+  cal[0].g[3].offset = 57;
+  setGain(3);
+  TEST_ASSERT_EQUAL(0, convCurrent(57));
+  double ref = 1000 * (double)nominalPA(3);
+  TEST_ASSERT_FLOAT_WITHIN(ref / 32768.0 + 1.0, ref, (double)convCurrent(1057));
+  //difference beyond the code range is clamped
+  cal[0].g[3].offset = -100;
+  ref = 32767 * (double)nominalPA(3);
+  TEST_ASSERT_FLOAT_WITHIN(ref / 32768.0 + 1.0, ref, (double)convCurrent(32767));
+  defaultCal(0);
+}
+
+void test_calibrate(void) {
+  TEST_ASSERT_TRUE(PS_Present);
+  TEST_ASSERT_TRUE(calibrate(rCell));
+  for (byte n = 0; n <= MAX_GAIN; n++) {
+    setGain(n);
+    uint16_t gain = n % 2 ? GAIN_SIXTEEN : GAIN_FOUR;
+    //offset measured on every gain setting
+    TEST_ASSERT_INT_WITHIN(0, tiaOffset(gain), cal[0].g[n].offset);
+    TEST_ASSERT_EQUAL(0, convCurrent(tiaOffset(gain)));
+    //scale calibrated where the test potential reaches CAL_V_MIN, nominal otherwise
+    float pAcode = adcLsb(gain) / tiaR() * 1.0E12;
+    float mV = min(32767 * nominalPA(n) * 0.5E-9 * rCell, (float)CAL_V_MAX);
+    float ref = mV >= CAL_V_MIN ? pAcode : nominalPA(n);
+    for (long code = -30000; code <= 30000; code += 7500) {
+      double i = (double)ref * code;
+      TEST_ASSERT_FLOAT_WITHIN(fabs(i) * 2.0E-3 + 2.0 * ref, i, (double)convCurrent(code + tiaOffset(gain)));
+    }
+  }
+  //stored table loads
+  cal[0].g[4].scale = 0;
+  TEST_ASSERT_TRUE(loadCal());
+  TEST_ASSERT_GREATER_THAN(0, cal[0].g[4].scale);
+}
+
+int main(int argc, char **argv) {
+  //PotStat shield: board present pin low, DAC and ADC on I2C
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  hostAdc = tiaAdc;
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_set_cal_scale);
+  RUN_TEST(test_conv_current_nominal);
+  RUN_TEST(test_conv_current_offset);
+  RUN_TEST(test_calibrate);
+  return UNITY_END();
+}
@@ -0,0 +1,74 @@
+/*
+ * CV on the simulated electrochemical cell (stubs/sim_cell.h): anodic peak current against the
+ * Randles-Sevcik equation, peak potential of a reversible couple, square root scan rate dependence
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+#include "sim_cell.h"
+
+//Anodic peak of a CSV run: current (pA) and DAC code
+struct Peak {
+  long iIn;
+  long dac;
+};
+
+Peak cvPeak(const char *cmd) {
+  Peak pk = {0, 0};
+  hostTake();
+  hostSend(cmd);
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  simStart();
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted != PS_EXP_RUNNING; }, 40000000));
+  std::string s = hostTake();
+  size_t p = 0;
+  while (p < s.size()) {
+    size_t e = s.find('\n', p);
+    if (e == std::string::npos) break;
+    long dac, iIn;
+    float vOut;
+    unsigned long t;
+    if (sscanf(s.c_str() + p, "%ld,%f,%ld,%lu", &dac, &vOut, &iIn, &t) == 4 && iIn > pk.iIn) {
+      pk.iIn = iIn;
+      pk.dac = dac;
+    }
+    p = e + 1;
+  }
+  return pk;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+//-200 .. 600 mV at 100 mV/s: ip = 0.4463 n F A C sqrt(n F v D / RT) within 5 % (grid ~1.5 % low,
+//the DAC holds during the blocking conversion, the current decays by ~2 % more),
+//Ep = E0 + 1.109 RT / nF (28.5 mV) within a sample step and the iR drop
+void test_randles_sevcik(void) {
+  Peak pk = cvPeak("<R%SR:40%G:2%E:1%SM:1%EP:0,0,0,0,-200,-200,600,100,1,%/>");
+  double ip = simPeak(0.1) * 1.0E12;
+  TEST_ASSERT_FLOAT_WITHIN(ip * 0.05, ip, (double)pk.iIn);
+  double ep = (pk.dac / 21845.0 - 1.5) * 1000.0;
+  TEST_ASSERT_FLOAT_WITHIN(6.0, simE0 * 1000.0 + 28.5, ep);
+}
+
+//Peak current proportional to the square root of the scan rate
+void test_scan_rate(void) {
+  Peak fast = cvPeak("<R%SR:40%G:2%E:1%SM:1%EP:0,0,0,0,-200,-200,600,100,1,%/>");
+  Peak slow = cvPeak("<R%SR:20%G:2%E:1%SM:1%EP:0,0,0,0,-200,-200,600,50,1,%/>");
+  TEST_ASSERT_FLOAT_WITHIN(0.02, sqrt(2.0), (double)fast.iIn / slow.iIn);
+}
+
+int main(int argc, char **argv) {
+  //PotStat shield: board present pin low, DAC and ADC on I2C, the simulated cell on the ADC
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  hostAdc = simAdc;
+  setup();
+  bootState = BOOT_DONE;
+  setBaud(BLE_BAUD);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_randles_sevcik);
+  RUN_TEST(test_scan_rate);
+  return UNITY_END();
+}
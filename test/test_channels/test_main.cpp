@@ -0,0 +1,227 @@
+/*
+ * Two potentiostat channels (PS_CHANNELS 2): per-channel calibration, round robin sampling with
+ * channel tags ('N' ch, CSV channel field) and the planner load of both channels,
+ * each shield simulated by its own TIA model (resistor error, ADC offset)
+ */
+#define PS_CHANNELS 2
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+
+//TIA model per channel: feedback resistors off nominal, offset per gain setting (codes), resistor on the cell
+const float R_NOM[4] = {502.0, 10000.0, 200000.0, 4020000.0};
+const float R_ERR[2][4] = {{1.006, 0.985, 1.020, 0.992}, {0.991, 1.012, 0.978, 1.009}};
+const int16_t OFFSET[2] = {23, -61};
+long rCell = 10000; //ohm
+
+byte chOf(uint8_t addr) {
+  return addr == PS_ADC_ADDR ? 0 : 1;
+}
+
+//Feedback resistor selected by the gain mux pins of channel ch
+float tiaR(byte ch) {
+  byte r = hostPinOut[pgm_read_byte(&PS_CH[ch].mux1)] * 2 + hostPinOut[pgm_read_byte(&PS_CH[ch].mux0)];
+  return R_NOM[r] * R_ERR[ch][r];
+}
+
+float adcLsb(uint16_t gain) {
+  return gain == GAIN_SIXTEEN ? 7.8125E-6 : 31.25E-6; //V
+}
+
+int16_t tiaOffset(byte ch, uint16_t gain) {
+  return OFFSET[ch] + 7 * hostPinOut[pgm_read_byte(&PS_CH[ch].mux0)] + (gain == GAIN_SIXTEEN ? 40 : 0);
+}
+
+//True cell current (A): DAC potential of the channel across rCell while the WE switch is closed
+float cellCurrent(byte ch) {
+  if (!hostPinOut[PS_WE_SwEn]) return 0.0;
+  return (hostDac[pgm_read_byte(&PS_CH[ch].dac)] / 21845.0 - 1.5) / rCell;
+}
+
+int16_t tiaAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  byte ch = chOf(addr);
+  float code = cellCurrent(ch) * tiaR(ch) / adcLsb(gain) + tiaOffset(ch, gain);
+  return constrain(lround(code), -32768L, 32767L);
+}
+
+//Samples of a CSV run: channel field and current per line
+struct CsvSample {
+  long dac, iIn;
+  unsigned long t;
+  int ch;
+};
+
+std::vector<CsvSample> parseCsv(const std::string &s) {
+  std::vector<CsvSample> v;
+  size_t p = 0;
+  while (p < s.size()) {
+    size_t e = s.find('\n', p);
+    if (e == std::string::npos) break;
+    CsvSample c;
+    float vOut;
+    if (sscanf(s.c_str() + p, "%ld,%f,%ld,%lu,%d", &c.dac, &vOut, &c.iIn, &c.t, &c.ch) == 5) v.push_back(c);
+    p = e + 1;
+  }
+  return v;
+}
+
+//Value of info message text in output
+long infoValue(const std::string &out, const char *text) {
+  size_t p = out.find(text);
+  if (p == std::string::npos) return -1;
+  return atol(out.c_str() + p + strlen(text));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+//2nd shield found by its DAC / ADC acknowledge, its calibration table after the log
+void test_channels_present(void) {
+  TEST_ASSERT_EQUAL(2, psChannels);
+  TEST_ASSERT_EQUAL(BLANK_EE_ADDR, calEeAddr(1) + CAL_EE_LEN);
+  TEST_ASSERT_LESS_OR_EQUAL(calEeAddr(1), LOG_EE_ADDR + LOG_SLOTS * LOG_REC_LEN);
+  TEST_ASSERT_FALSE(calStored);
+}
+
+//Each channel calibrated against its own TIA, same current reads the same on both channels
+void test_calibrate(void) {
+  TEST_ASSERT_TRUE(calibrate(rCell));
+  for (byte n = 0; n <= MAX_GAIN; n++) {
+    uint16_t gain = n % 2 ? GAIN_SIXTEEN : GAIN_FOUR;
+    float mV = min(32767 * (float)(PS_ADC_LSB * 1.0E6 / (R_NOM[n / 2] / 1000.0) / ((n % 2) ? 4.0 : 1.0))
+                   * 0.5E-9 * rCell, (float)CAL_V_MAX);
+    for (byte ch = 0; ch < 2; ch++) {
+      selectChannel(ch);
+      setGain(n);
+      TEST_ASSERT_EQUAL(tiaOffset(ch, gain), cal[ch].g[n].offset);
+      if (mV < CAL_V_MIN) continue;
+      //current giving 20000 codes on channel 0
+      float pAcode = adcLsb(gain) / tiaR(ch) * 1.0E12;
+      float pA = 20000 * adcLsb(gain) / tiaR(0) * 1.0E12;
+      long code = lround(pA / pAcode) + tiaOffset(ch, gain);
+      TEST_ASSERT_FLOAT_WITHIN(pA * 2.0E-3 + 2.0 * pAcode, pA, (double)convCurrent(code));
+    }
+  }
+  selectChannel(0);
+  setGain(e.gain);
+  TEST_ASSERT_TRUE(cal[0].g[2].scale != cal[1].g[2].scale);
+
+  //both tables stored, a corrupt table of the 2nd channel falls back to nominal values
+  CalTable ref = cal[1];
+  cal[0].g[2].scale = 0;
+  cal[1].g[2].scale = 0;
+  TEST_ASSERT_TRUE(loadCal());
+  TEST_ASSERT_EQUAL(ref.g[2].scale, cal[1].g[2].scale);
+  TEST_ASSERT_GREATER_THAN(0, cal[0].g[2].scale);
+  hostEe[calEeAddr(1) + 4]++;
+  TEST_ASSERT_FALSE(loadCal());
+  TEST_ASSERT_EQUAL(0, cal[1].g[2].offset);
+  TEST_ASSERT_EQUAL(tiaOffset(0, GAIN_FOUR), cal[0].g[2].offset);
+  hostEe[calEeAddr(1) + 4]--;
+  TEST_ASSERT_TRUE(loadCal());
+}
+
+//CV, CSV stream: both DACs follow the waveform, channels sampled in turn, currents of both calibrated
+void test_round_robin_csv(void) {
+  hostTake();
+  hostSend("<R%SR:20%G:2%E:1%SM:1%EP:0,0,0,0,0,-200,600,400,1,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  hostRun(1500000);
+  TEST_ASSERT_EQUAL(hostDac[PS_DAC_ADDR], hostDac[0x1D]);
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted != PS_EXP_RUNNING; }, 10000000));
+  std::vector<CsvSample> v = parseCsv(hostTake());
+  TEST_ASSERT_GREATER_THAN(50, v.size());
+  for (size_t i = 0; i < v.size(); i++) {
+    TEST_ASSERT_EQUAL(i % 2, v[i].ch);
+    //async sampling, the channels share %SR
+    if (i) TEST_ASSERT_INT_WITHIN(1000, 50000, v[i].t - v[i - 1].t);
+    double pA = (v[i].dac / 21845.0 - 1.5) / rCell * 1.0E12;
+    TEST_ASSERT_FLOAT_WITHIN(fabs(pA) * 2.0E-3 + 2000.0, pA, (double)v[i].iIn);
+  }
+}
+
+//Std stream: every frame preceded by its channel tag
+void test_std_tags(void) {
+  hostTake();
+  hostSend("<R%SR:20%G:2%E:1%SM:0%EP:0,0,0,0,0,-200,600,400,1,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted != PS_EXP_RUNNING; }, 10000000));
+  std::string s = hostTake();
+  int n[2] = {0, 0};
+  int frames = 0;
+  int last = 1;
+  for (size_t p = s.find("B\r"); p != std::string::npos; p = s.find("B\r", p + 1)) {
+    if (p < 2 || s[p - 2] != 'N') continue;
+    frames++;
+    int ch = s[p - 1];
+    TEST_ASSERT_TRUE(ch == 0 || ch == 1);
+    TEST_ASSERT_TRUE(ch != last);
+    last = ch;
+    n[ch]++;
+  }
+  TEST_ASSERT_GREATER_THAN(50, frames);
+  TEST_ASSERT_INT_WITHIN(1, n[0], n[1]);
+}
+
+//DPV, sync sampling converts both channels per point: CPU load of the 2nd ADC / DAC counted,
+//a pulse rate within budget for one channel exceeds it for two
+void test_plan_sync(void) {
+  const char *cmd = "<D%SR:30%G:2%E:2%SM:2%EP:0,0,0,0,-200,600,5,50,20,40,%/>";
+  hostTake();
+  hostSend(cmd);
+  hostRun(200000);
+  std::string two = hostTake();
+  psChannels = 1;
+  hostSend(cmd);
+  hostRun(200000);
+  std::string one = hostTake();
+  psChannels = 2;
+  TEST_ASSERT_EQUAL(2, infoValue(two, "Plan: channels "));
+  TEST_ASSERT_EQUAL(1, infoValue(one, "Plan: channels "));
+  long cpu1 = infoValue(one, "Plan: CPU load (%) ");
+  long cpu2 = infoValue(two, "Plan: CPU load (%) ");
+  TEST_ASSERT_GREATER_THAN(0, cpu1);
+  TEST_ASSERT_LESS_OR_EQUAL(PLAN_CPU_MAX, cpu1);
+  TEST_ASSERT_GREATER_THAN(PLAN_CPU_MAX, cpu2);
+  TEST_ASSERT_EQUAL(std::string::npos, one.find("budget exceeded"));
+  TEST_ASSERT_TRUE(two.find("budget exceeded") != std::string::npos);
+}
+
+//DPV run with sync sampling: both channels converted back to back at every point
+void test_sync_pairs(void) {
+  hostTake();
+  hostSend("<R%SR:30%G:2%E:2%SM:1%EP:0,0,0,0,-200,600,5,50,50,100,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  hostRun(3000000);
+  finishExperiment();
+  std::vector<CsvSample> v = parseCsv(hostTake());
+  TEST_ASSERT_GREATER_THAN(20, v.size());
+  size_t i0 = v[0].ch;
+  for (size_t i = i0 + 1; i < v.size(); i += 2) {
+    TEST_ASSERT_EQUAL(0, v[i - 1].ch);
+    TEST_ASSERT_EQUAL(1, v[i].ch);
+    TEST_ASSERT_EQUAL(v[i - 1].dac, v[i].dac);
+    TEST_ASSERT_INT_WITHIN(PLAN_ADC_US + 2000, PLAN_ADC_US, v[i].t - v[i - 1].t);
+  }
+}
+
+int main(int argc, char **argv) {
+  //two PotStat shields: board present pin low, DAC and ADC of both on I2C
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  hostI2c[0x1D] = true;
+  hostI2c[0x4A] = true;
+  hostAdc = tiaAdc;
+  setup();
+  bootState = BOOT_DONE;
+  setBaud(BLE_BAUD);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_channels_present);
+  RUN_TEST(test_calibrate);
+  RUN_TEST(test_round_robin_csv);
+  RUN_TEST(test_std_tags);
+  RUN_TEST(test_plan_sync);
+  RUN_TEST(test_sync_pairs);
+  return UNITY_END();
+}
@@ -0,0 +1,137 @@
+/*
+ * CV cycle co-addition (%CA:1): bins sized by potential, every cycle weighted equally, full bins reported
+ * Blank subtraction (%BG:#): stored blank removes the background, the ADC offset is removed once
+ */
+#include <unity.h>
+#define COADD_EN true
+#include "../../src/WQM_PotStat_Shield.cpp"
+
+char buf[128];
+
+//Parse run command s (frame contents without '<' '>')
+boolean parseRun(const char *s) {
+  strcpy(buf, s);
+  return parseRunCmd(buf, strlen(buf));
+}
+
+//Cell current steps up each cycle, the co-added mean is the mean over all cycles
+int16_t cycleAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  return 1000 + 100 * (currCycle < 0 ? 0 : currCycle);
+}
+
+//Background proportional to the potential on top of the ADC offset, signal added when on
+#define BG_OFFSET 50
+#define BG_SIGNAL 200
+bool bgSignal = false;
+int16_t bgAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  return BG_OFFSET + ((int32_t)hostDac[PS_DAC_ADDR] - 32768) / 16 + (bgSignal ? BG_SIGNAL : 0);
+}
+
+//Currents (pA) of the CSV sample lines in s
+std::vector<long> csvCurrents(const std::string &s) {
+  std::vector<long> v;
+  size_t p = 0;
+  while (p < s.size()) {
+    size_t e = s.find('\n', p);
+    if (e == std::string::npos) break;
+    long dac, i;
+    float vOut;
+    unsigned long t;
+    if (sscanf(s.c_str() + p, "%ld,%f,%ld,%lu", &dac, &vOut, &i, &t) == 4) v.push_back(i);
+    p = e + 1;
+  }
+  return v;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_bins_by_mv(void) {
+  TEST_ASSERT_TRUE(parseRun("R%SR:60%G:2%E:1%CA:1%EP:0,0,0,0,0,-200,100,100,3,%/"));
+  coaddInit();
+  TEST_ASSERT_EQUAL(300 / COADD_BIN_MV, coBins);
+  //wide scan: max bins, wider than COADD_BIN_MV
+  TEST_ASSERT_TRUE(parseRun("R%SR:60%G:2%E:1%CA:1%EP:0,0,0,0,-500,-500,500,100,3,%/"));
+  coaddInit();
+  TEST_ASSERT_EQUAL(COADD_BINS, coBins);
+}
+
+//37 Hz, 10 mV bins, 5 mV/s: 74 samples per bin and direction per cycle, 4 cycles
+void test_every_cycle(void) {
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  hostAdc = cycleAdc;
+  setup();
+  bootState = BOOT_DONE;
+  hostTake();
+  hostSend("<R%SR:37%G:2%E:1%CA:1%EP:0,0,0,0,-100,-100,100,5,4,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 400000000));
+  std::string out = hostTake();
+  TEST_ASSERT_TRUE(out.find("Co-added points sent") != std::string::npos);
+  TEST_ASSERT_EQUAL(std::string::npos, out.find("co-add bins full"));
+  int filled = 0;
+  for (byte d = 0; d < 2; d++) {
+    for (byte b = 0; b < coBins; b++) {
+      if (coN[d][b] < 4 * 60) continue;
+      TEST_ASSERT_GREATER_THAN(255, coN[d][b]);
+      TEST_ASSERT_INT_WITHIN(10, 1150, coSum[d][b] / coN[d][b]);
+      filled++;
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(2 * coBins - 6, filled);
+}
+
+void test_full_reported(void) {
+  TEST_ASSERT_TRUE(parseRun("R%SR:60%G:2%E:1%CA:1%EP:0,0,0,0,0,-200,100,100,3,%/"));
+  coaddInit();
+  coN[0][3] = COADD_N_MAX - 1;
+  coSum[0][3] = 0;
+  currInterval = INTERVAL_EXP1;
+  dacOut = coLo + (3 * ((long)coHi - coLo)) / coBins + 1;
+  PS_adc1_diff_0_1 = 100;
+  coaddSample();
+  coaddSample();
+  TEST_ASSERT_EQUAL(COADD_N_MAX, coN[0][3]);
+  TEST_ASSERT_EQUAL(100, coSum[0][3]);
+  hostTake();
+  sendCoadd();
+  TEST_ASSERT_TRUE(hostTake().find("Warning: co-add bins full, later samples dropped, bins 1") != std::string::npos);
+  currInterval = INTERVAL_NA;
+}
+
+//Background subtracted current is the current of the signal codes alone
+void test_blank_subtract(void) {
+  hostAdc = bgAdc;
+  cal[0].g[2].offset = BG_OFFSET;
+  bgSignal = false;
+  hostTake();
+  hostSend("<R%SR:37%G:2%E:1%BG:1%EP:0,0,0,0,-100,-100,100,100,2,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 20000000));
+  TEST_ASSERT_TRUE(hostTake().find("Blank stored") != std::string::npos);
+  bgSignal = true;
+  hostSend("<R%SR:30%G:2%E:1%SM:1%BG:2%EP:0,0,0,0,-100,-100,100,100,2,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 20000000));
+  std::vector<long> i = csvCurrents(hostTake());
+  TEST_ASSERT_GREATER_THAN(100, i.size());
+  long ref = ((long)BG_SIGNAL * cal[0].g[2].scale) >> cal[0].g[2].shift;
+  //interpolation between bin centres near the vertices within 5 %, the offset is 25 % of the signal
+  for (size_t k = 0; k < i.size(); k++) TEST_ASSERT_INT_WITHIN(ref / 20, ref, i[k]);
+  cal[0].g[2].offset = 0;
+  hostAdc = 0;
+}
+
+int main(int argc, char **argv) {
+  setup();
+  bootState = BOOT_DONE;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_bins_by_mv);
+  RUN_TEST(test_every_cycle);
+  RUN_TEST(test_full_reported);
+  RUN_TEST(test_blank_subtract);
+  return UNITY_END();
+}
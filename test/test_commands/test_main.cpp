@@ -0,0 +1,294 @@
+/*
+ * Command parsing: run command fields, state of rejected / later commands, command channel timing
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+
+char buf[256];
+
+//Parse run command s (frame contents without '<' '>')
+boolean parseRun(const char *s) {
+  strcpy(buf, s);
+  return parseRunCmd(buf, strlen(buf));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_stream_mode_default(void) {
+  TEST_ASSERT_TRUE(parseRun("R%SR:60%G:2%E:1%SM:2%EP:100,100,0,0,0,-200,800,100,3,%/"));
+  TEST_ASSERT_EQUAL(STREAM_PACKED, streamMode);
+  //not kept by the next run command
+  TEST_ASSERT_TRUE(parseRun("R%SR:60%G:2%E:1%EP:100,100,0,0,0,-200,800,100,3,%/"));
+  TEST_ASSERT_EQUAL(STREAM_DEFAULT, streamMode);
+  TEST_ASSERT_FALSE(parseRun("R%SR:60%G:2%E:1%SM:3%EP:100,100,0,0,0,-200,800,100,3,%/"));
+}
+
+//BLE module answers every AT command with "OK", the reply arrives while loop() samples the WQM board
+//(ADC conversion), it must reach bootTask(), not the command parser
+bool bleReply = false;
+int16_t replyAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  if (bleReply) hostSend("OK");
+  bleReply = false;
+  return 0;
+}
+
+void test_boot_ble_replies(void) {
+  bootState = BOOT_POWERUP;
+  bleTries = 0;
+  setBaud(BLE_BAUD_DEFAULT);
+  WQM_Present = true;
+  hostAdc = replyAdc;
+  startExperimentWQM();
+  hostTake();
+  std::string out;
+  TEST_ASSERT_TRUE(hostRunUntil([&out] {
+    std::string s = hostTake();
+    out += s;
+    if (s.find("AT") != std::string::npos) bleReply = true;
+    return bootState == BOOT_DONE;
+  }, 20000000));
+  finishExperiment();
+  WQM_Present = false;
+  hostAdc = 0;
+  TEST_ASSERT_TRUE(out.find("AT+NOTI1") != std::string::npos);
+  TEST_ASSERT_TRUE(out.find("AT+BAUD4") != std::string::npos);
+  TEST_ASSERT_EQUAL(std::string::npos, out.find("Info: No BLE module response"));
+  TEST_ASSERT_EQUAL(BLE_BAUD, bleBaud);
+  hostTake();
+}
+
+//Experiment end flashes the LED without blocking the command channel
+void test_finish_nonblocking(void) {
+  hostSend("<R%SR:30%G:2%E:1%EP:0,0,0,0,0,-200,600,400,3,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  hostRun(100000);
+  uint8_t state = hostPinOut[MB_LED];
+  uint64_t t0 = hostNs;
+  hostSend("x");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 2000000));
+  TEST_ASSERT_LESS_THAN(20000000ULL, hostNs - t0);
+  //2 flashes (4 toggles, 300 ms) from loop()
+  int toggles = 0;
+  for (int i = 0; i < 1500; i++) {
+    if (hostPinOut[MB_LED] != state) toggles++;
+    state = hostPinOut[MB_LED];
+    hostRun(1000);
+  }
+  TEST_ASSERT_EQUAL(4, toggles);
+  hostTake();
+}
+
+//Experiment start flashes the LED without delaying the first sample, reported time (virtual clock)
+//within one sample period and a conversion of the command
+void test_start_nonblocking(void) {
+  if (expStarted) finishExperiment();
+  hostRun(1500000);
+  hostTake();
+  tFirstSample = 0;
+  //LED off after a command
+  led(OFF);
+  uint8_t state = OFF;
+  const char *cmd = "<R%SR:30%G:2%E:1%EP:0,0,0,0,0,-200,600,400,3,%/>";
+  //command complete (ms)
+  unsigned long tCmd = (hostNs + strlen(cmd) * hostByteNs()) / 1000000;
+  hostSend(cmd);
+  TEST_ASSERT_TRUE(hostRunUntil([] { return tFirstSample != 0; }, 2000000));
+  hostRun(1000);
+  std::string out = hostTake();
+  TEST_ASSERT_TRUE(out.find("Info: Starting Experiment") != std::string::npos);
+  size_t p = out.find("Info: First sample (ms since reset) ");
+  TEST_ASSERT_TRUE(p != std::string::npos);
+  unsigned long tFirst = atol(out.c_str() + p + 36);
+  TEST_ASSERT_EQUAL(tFirstSample, tFirst);
+  TEST_ASSERT_GREATER_OR_EQUAL(tCmd, tFirst);
+  TEST_ASSERT_LESS_OR_EQUAL(tCmd + 1000 / 30 + PLAN_ADC_US / 1000 + 2, tFirst);
+  //4 flashes (8 toggles, 150 ms) from loop() while sampling
+  int toggles = 0;
+  for (int i = 0; i < 1500; i++) {
+    if (hostPinOut[MB_LED] != state) toggles++;
+    state = hostPinOut[MB_LED];
+    hostRun(1000);
+  }
+  TEST_ASSERT_EQUAL(8, toggles);
+  TEST_ASSERT_EQUAL(PS_EXP_RUNNING, expStarted);
+  finishExperiment();
+  hostRun(1500000);
+  hostTake();
+}
+
+//Longest interval between DAC updates of a CV (us), commands from cmds sent in turn every 40 ms,
+//intervals with a pause in between skipped, output in runOut
+std::string runOut;
+unsigned long dacIntervalMax(const char *const *cmds, int nCmds) {
+  if (expStarted) finishExperiment();
+  hostRun(1500000);
+  hostSend("<R%SR:30%G:2%E:1%EP:0,0,0,0,0,-200,600,400,2,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  hostRun(100000);
+  hostTake();
+  hostDacLog.clear();
+  hostDacLogEn = true;
+  std::vector<uint64_t> paused;
+  for (int i = 0; expStarted == PS_EXP_RUNNING; i++) {
+    if (nCmds && i % 40 == 0) hostSend(cmds[(i / 40) % nCmds]);
+    hostRun(1000);
+    if (expPaused) paused.push_back(hostNs);
+  }
+  hostDacLogEn = false;
+  runOut = hostTake();
+  unsigned long dtMax = 0;
+  size_t k = 0;
+  for (size_t i = 1; i < hostDacLog.size(); i++) {
+    uint64_t t0 = hostDacLog[i - 1].ns, t1 = hostDacLog[i].ns;
+    while (k < paused.size() && paused[k] < t0) k++;
+    if (k < paused.size() && paused[k] < t1) continue;
+    unsigned long dt = (t1 - t0) / 1000;
+    if (dt > dtMax) dtMax = dt;
+  }
+  TEST_ASSERT_GREATER_THAN(1000, hostDacLog.size());
+  return dtMax;
+}
+
+//Command bytes received during a CV (status, updates, pause / resume, rejected and retransmission
+//requests) do not delay DAC updates beyond those of a quiet run
+void test_commands_dac_jitter(void) {
+  const char *const cmds[] = {"<Q/>", "<U%G:3%/>", "<U%SR:20%/>", "<Q/>", "<P/>", "<G/>", "<U%SR:999%/>",
+                              "#\x05", "<Z/>", "<U%CN:500%CM:500%/>", "<Q/>", "<U%G:2%SR:30%/>"};
+  unsigned long quiet = dacIntervalMax(0, 0);
+  unsigned long busy = dacIntervalMax(cmds, sizeof(cmds) / sizeof(cmds[0]));
+  TEST_ASSERT_TRUE(runOut.find("Info: Experiment paused") != std::string::npos);
+  TEST_ASSERT_TRUE(runOut.find("Info: Experiment resumed") != std::string::npos);
+  TEST_ASSERT_TRUE(runOut.find("Info: Parameter update applied at cycle") != std::string::npos);
+  TEST_ASSERT_TRUE(runOut.find("Error: Parameter update invalid") != std::string::npos);
+  TEST_ASSERT_TRUE(runOut.find("Q\x01") != std::string::npos);
+  //one DAC period plus a blocking ADC read
+  TEST_ASSERT_LESS_OR_EQUAL(1000000UL / PLAN_DAC_RATE + PLAN_ADC_US + 1000, quiet);
+  TEST_ASSERT_LESS_OR_EQUAL(quiet + 200, busy);
+}
+
+//Sample rate update of a running experiment is planned like a run command
+void test_update_rate_planned(void) {
+  hostSend("<R%SR:20%G:2%E:1%EP:0,0,0,0,0,-200,600,400,3,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  hostTake();
+  hostSend("<U%SR:110%/>");
+  hostRun(100000);
+  std::string out = hostTake();
+  TEST_ASSERT_TRUE(out.find("budget exceeded") != std::string::npos);
+  TEST_ASSERT_TRUE(out.find("Error: Parameter update invalid") != std::string::npos);
+  TEST_ASSERT_FALSE(eNextPending);
+  //within budget, applied at the next cycle
+  hostSend("<U%SR:30%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return e.sampRate == 30; }, 5000000));
+  finishExperiment();
+  hostTake();
+}
+
+//Rejected update (rate over budget) leaves the pending update of an earlier command unchanged
+void test_update_rejected_keeps_pending(void) {
+  hostSend("<R%SR:20%G:2%E:1%EP:0,0,0,0,0,-200,600,400,3,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING && currCycle == 0; }, 2000000));
+  hostSend("<U%G:3%SR:25%/>");
+  hostRun(100000);
+  TEST_ASSERT_TRUE(eNextPending);
+  ExpUpdate pending = eNext;
+  hostTake();
+  hostSend("<U%G:5%CN:2000%SR:110%/>");
+  hostRun(100000);
+  TEST_ASSERT_TRUE(hostTake().find("Error: Parameter update invalid") != std::string::npos);
+  TEST_ASSERT_TRUE(eNextPending);
+  TEST_ASSERT_EQUAL_MEMORY(&pending, &eNext, sizeof(ExpUpdate));
+  //invalid field
+  hostSend("<U%G:4%SR:9%/>");
+  hostRun(100000);
+  TEST_ASSERT_EQUAL_MEMORY(&pending, &eNext, sizeof(ExpUpdate));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return !eNextPending; }, 5000000));
+  TEST_ASSERT_EQUAL(3, e.gain);
+  TEST_ASSERT_EQUAL(25, e.sampRate);
+  finishExperiment();
+  hostTake();
+}
+
+//Run command with a full scan-rate series (SERIES_MAX slopes) received and parsed, one more rejected
+void test_series_full(void) {
+  if (expStarted) finishExperiment();
+  const char *cmd = "<R%SR:15%G:2%E:1%SS:10,12,14,16,18,20,22,24,%EP:0,0,0,0,0,-200,600,10,1,%/>";
+  TEST_ASSERT_GREATER_THAN(64, strlen(cmd));
+  hostSend(cmd);
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  TEST_ASSERT_EQUAL(SERIES_MAX, seriesN);
+  const int slopes[SERIES_MAX] = {10, 12, 14, 16, 18, 20, 22, 24};
+  for (byte k = 0; k < SERIES_MAX; k++) TEST_ASSERT_EQUAL(slopes[k], seriesSlope[k]);
+  TEST_ASSERT_EQUAL(36, seriesRate(SERIES_MAX - 1));
+  finishExperiment();
+  hostTake();
+  TEST_ASSERT_FALSE(parseRun("R%SR:15%G:2%E:1%SS:10,12,14,16,18,20,22,24,24,%EP:0,0,0,0,0,-200,600,10,1,%/"));
+}
+
+//Update received in the last cycle of a series segment: gain applied, the next segment keeps its
+//slope, scan times and sample rate
+void test_series_update(void) {
+  if (expStarted) finishExperiment();
+  hostSend("<R%SR:15%G:2%E:1%SS:100,120,%EP:0,0,0,0,0,-100,100,100,1,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING && currCycle == 0; }, 2000000));
+  hostRun(1000000);
+  hostSend("<U%G:3%/>");
+  hostRun(200000);
+  TEST_ASSERT_TRUE(eNextPending);
+  TEST_ASSERT_TRUE(hostRunUntil([] { return seriesSeg == 1; }, 10000000));
+  hostRun(200000);
+  TEST_ASSERT_FALSE(eNextPending);
+  TEST_ASSERT_EQUAL(3, e.gain);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 120.0, e.vSlope[0] * 1.0E9);
+  TEST_ASSERT_EQUAL(2 * (unsigned long)(2000000 * 100.0 / 120 + 0.5), e.tCycle);
+  TEST_ASSERT_EQUAL(seriesRate(1), e.sampRate);
+  unsigned int preload;
+  byte prescale;
+  calcTimer1(seriesRate(1), &preload, &prescale);
+  TEST_ASSERT_EQUAL(preload, timer1_preload);
+  finishExperiment();
+  hostTake();
+}
+
+//WQM start command applies its fields only if all are valid
+void test_wqm_fields_atomic(void) {
+  if (expStarted) finishExperiment();
+  hostSend("<W%RM:1%HB:300%LI:2%/>");
+  hostRun(100000);
+  TEST_ASSERT_TRUE(hostTake().find("Error: Could not parse command") != std::string::npos);
+  TEST_ASSERT_EQUAL(0, expStarted);
+  TEST_ASSERT_EQUAL(WQM_REPORT_ALL, wqmReportMode);
+  TEST_ASSERT_EQUAL(WQM_HEARTBEAT, wqmHeartbeat);
+  TEST_ASSERT_EQUAL(LOG_INTERVAL, logInterval);
+  hostSend("<W%RM:1%HB:300%LI:20%/>");
+  hostRun(100000);
+  TEST_ASSERT_EQUAL(WQM_EXP_RUNNING, expStarted);
+  TEST_ASSERT_EQUAL(WQM_REPORT_CHANGE, wqmReportMode);
+  TEST_ASSERT_EQUAL(300, wqmHeartbeat);
+  TEST_ASSERT_EQUAL(20, logInterval);
+  finishExperiment();
+  hostTake();
+}
+
+int main(int argc, char **argv) {
+  //PotStat shield: board present pin low, DAC and ADC on I2C
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  setup();
+  bootState = BOOT_DONE;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_stream_mode_default);
+  RUN_TEST(test_boot_ble_replies);
+  RUN_TEST(test_finish_nonblocking);
+  RUN_TEST(test_start_nonblocking);
+  RUN_TEST(test_commands_dac_jitter);
+  RUN_TEST(test_update_rate_planned);
+  RUN_TEST(test_update_rejected_keeps_pending);
+  RUN_TEST(test_series_full);
+  RUN_TEST(test_series_update);
+  RUN_TEST(test_wqm_fields_atomic);
+  return UNITY_END();
+}
@@ -0,0 +1,63 @@
+/*
+ * Dual link (DUAL_LINK_EN): decimated stream on the bluetooth link, statistics reported per experiment,
+ * transmit slots (SoftwareSerial bytes with interrupts disabled) against the timer periods
+ */
+#define DUAL_LINK_EN true
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_stats_per_experiment(void) {
+  //left over from an earlier experiment / WQM idle time
+  btSlotMax = 9999;
+  btOut.dropped = 77;
+  hostSend("<R%SR:30%G:2%E:1%EP:0,0,0,0,0,-200,600,400,3,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  hostRun(500000);
+  hostTake();
+  hostSend("x");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 1000000));
+  std::string out = hostTake();
+  TEST_ASSERT_TRUE(out.find("BT link: bytes dropped 0\r\n") != std::string::npos);
+  TEST_ASSERT_EQUAL(std::string::npos, out.find("BT link: max transmit slot (us) 9999"));
+}
+
+//Slots end before the next DAC tick, timer interrupts delayed by at most one byte
+void test_slots(void) {
+  //slot fits the Timer2 (DAC) period and the Timer1 (sampling) period at the max. rate
+  TEST_ASSERT_LESS_THAN(1000000UL / PLAN_DAC_RATE, BT_SLOT_US + BT_BYTE_US);
+  TEST_ASSERT_LESS_THAN(1000000UL / MAX_SAMPLE_RATE, BT_SLOT_US + BT_BYTE_US);
+  setBaud(BLE_BAUD);
+  hostSend("<R%SR:60%G:2%E:1%BD:1%EP:0,0,0,0,0,-200,600,400,1,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  memset(hostIsrLate, 0, sizeof(hostIsrLate));
+  size_t bt = hostBt.size();
+  hostRun(3000000);
+  hostTake();
+  TEST_ASSERT_EQUAL(PS_EXP_RUNNING, expStarted);
+  //all samples queued and sent in slots of several bytes
+  TEST_ASSERT_INT_WITHIN(30, 180 * 9, hostBt.size() - bt);
+  TEST_ASSERT_EQUAL(0, btOut.dropped);
+  TEST_ASSERT_GREATER_OR_EQUAL(2 * BT_BYTE_US, btSlotMax);
+  TEST_ASSERT_LESS_OR_EQUAL(BT_SLOT_US, btSlotMax);
+  TEST_ASSERT_LESS_OR_EQUAL(BT_BYTE_US * 1000UL, hostIsrLate[1]);
+  TEST_ASSERT_LESS_OR_EQUAL(BT_BYTE_US * 1000UL, hostIsrLate[2]);
+  hostSend("x");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 1000000));
+}
+
+int main(int argc, char **argv) {
+  //PotStat shield: board present pin low, DAC and ADC on I2C
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  setup();
+  bootState = BOOT_DONE;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_stats_per_experiment);
+  RUN_TEST(test_slots);
+  return UNITY_END();
+}
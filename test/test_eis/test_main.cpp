@@ -0,0 +1,68 @@
+/*
+ * Impedance scan (E:3) against the RC dummy cell (stubs/rc_cell.h), |Z| and phase compared with the
+ * analytic impedance Ru + Rct || Cdl
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+#include "rc_cell.h"
+
+struct EisPoint {
+  long mHz, mag;
+  int phase;
+};
+
+//"F,f,|Z|,phase" result lines
+std::vector<EisPoint> results(const std::string &s) {
+  std::vector<EisPoint> v;
+  size_t p = 0;
+  while ((p = s.find("F,", p)) != std::string::npos) {
+    EisPoint r;
+    if (sscanf(s.c_str() + p, "F,%ld,%ld,%d", &r.mHz, &r.mag, &r.phase) == 3) v.push_back(r);
+    p += 2;
+  }
+  return v;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+//0.2 Hz to 5 Hz, 2 points per decade, 10 mV amplitude around 0 V, corner of Rct || Cdl at 1.6 Hz
+void test_rc_cell(void) {
+  hostTake();
+  rcStart();
+  hostSend("<R%SR:30%G:2%E:3%EP:0,0,0,0,0,10,200,5000,2,2,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 60000000));
+  hostDacLogEn = false;
+  std::vector<EisPoint> r = results(hostTake());
+  //sine updated during the conversions (no blocking read)
+  uint64_t gap = 0;
+  for (size_t k = 1; k < hostDacLog.size(); k++) {
+    if (hostDacLog[k].ns - hostDacLog[k - 1].ns > gap) gap = hostDacLog[k].ns - hostDacLog[k - 1].ns;
+  }
+  TEST_ASSERT_LESS_THAN(4000000, gap);
+  TEST_ASSERT_EQUAL(4, r.size());
+  for (size_t k = 0; k < r.size(); k++) {
+    double w = 2 * PI * r[k].mHz / 1000.0;
+    //Z = Ru + Rct / (1 + j w Rct Cdl)
+    double wrc = w * rcRct * rcCdl;
+    double re = rcRu + rcRct / (1 + wrc * wrc), im = -wrc * rcRct / (1 + wrc * wrc);
+    double mag = sqrt(re * re + im * im);
+    double phase = atan2(im, re) * 1800.0 / PI;
+    TEST_ASSERT_FLOAT_WITHIN(0.01 * mag, mag, r[k].mag);
+    TEST_ASSERT_FLOAT_WITHIN(10, phase, r[k].phase);
+  }
+}
+
+int main(int argc, char **argv) {
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  hostAdc = rcAdc;
+  setup();
+  bootState = BOOT_DONE;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_rc_cell);
+  return UNITY_END();
+}
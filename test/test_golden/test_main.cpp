@@ -0,0 +1,430 @@
+/*
+ * Golden traces: canonical CV, LSV, DPV, EIS and WQM runs on the simulator (virtual clock) diffed
+ * against the stored traces test_golden/<name>.golden, verify runs (V command) of the same configs
+ *
+ * Trace records, one per line:
+ *   D us code          DAC write of the 1st channel, us since the command was sent
+ *   A us code          ADC conversion of the 1st channel (cell model below)
+ *   S tick dac v i     CSV sample line (dacOut, vOut, iIn, tick)
+ *   V tick dac         verify sample point (%VP:1)
+ *   T text             any other output line (info, results, WQM reports)
+ * GOLDEN_UPDATE=1 writes the traces of this build as the new golden traces.
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+#include <sys/wait.h>
+#include <math.h>
+
+#define GOLDEN_US 8      //time tolerance (us), 2 * micros() resolution of the target
+#define GOLDEN_LSB 1     //DAC / ADC code tolerance
+#define GOLDEN_REL 0.001 //relative tolerance of computed values (potential, current), plus the last printed digit
+#define WQM_ADC1_ADDR 0x48
+#define WQM_ADC2_ADDR 0x49
+
+struct GoldenRec {
+  char tag;
+  std::vector<double> v;
+  std::vector<int> digits; //decimals printed per value (S)
+  std::string text;
+};
+typedef std::vector<GoldenRec> GoldenTrace;
+
+//Cell: capacitive background plus an oxidation peak at 120 mV, WQM sensors drift slowly
+int16_t cellAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  if (addr == PS_ADC_ADDR) {
+    double x = ((double)hostDac[PS_DAC_ADDR] - 32768.0) / 1000.0;
+    return (int16_t)floor(x * 40.0 + 3000.0 * exp(-(x - 2.6) * (x - 2.6)) + 0.5);
+  }
+  double s = hostNs * 1.0E-9;
+  return (int16_t)(addr == WQM_ADC1_ADDR ? (pair ? 9000 + s * 20 : 14000 - s * 10) : (pair ? -3000 + s * 5 : 6000));
+}
+
+std::vector<std::pair<uint64_t, int16_t> > adcLog;
+int16_t loggedAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  int16_t c = cellAdc(addr, pair, gain);
+  if (addr == PS_ADC_ADDR) adcLog.push_back(std::make_pair(hostAdcNs, c));
+  return c;
+}
+
+//Decimals of a printed number
+int decimals(const std::string &s) {
+  size_t p = s.find('.');
+  return p == std::string::npos ? 0 : (int)(s.size() - p - 1);
+}
+
+//Lines of s, CR / LF stripped, empty lines skipped
+std::vector<std::string> lines(const std::string &s) {
+  std::vector<std::string> v;
+  size_t p = 0;
+  while (p < s.size()) {
+    size_t e = s.find('\n', p);
+    if (e == std::string::npos) e = s.size();
+    std::string line = s.substr(p, e - p);
+    if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+    if (!line.empty()) v.push_back(line);
+    p = e + 1;
+  }
+  return v;
+}
+
+//Words of a text line
+std::vector<std::string> words(const std::string &s) {
+  std::vector<std::string> v;
+  size_t p = 0;
+  while ((p = s.find_first_not_of(' ', p)) != std::string::npos) {
+    size_t e = s.find(' ', p);
+    if (e == std::string::npos) e = s.size();
+    v.push_back(s.substr(p, e - p));
+    p = e;
+  }
+  return v;
+}
+
+std::string readFile(const std::string &path) {
+  std::string s;
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f) return s;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) s.append(buf, n);
+  fclose(f);
+  return s;
+}
+
+bool writeFile(const std::string &path, const std::string &s) {
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f) return false;
+  bool ok = fwrite(s.data(), 1, s.size(), f) == s.size();
+  return fclose(f) == 0 && ok;
+}
+
+//Trace records of output lines
+void parseOutput(const std::string &out, GoldenTrace &tr) {
+  std::vector<std::string> ls = lines(out);
+  for (size_t k = 0; k < ls.size(); k++) {
+    const std::string &line = ls[k];
+    GoldenRec r;
+    char f[4][24];
+    unsigned long tick, dac;
+    if (sscanf(line.c_str(), "%23[^,],%23[^,],%23[^,],%23[^,\n]", f[0], f[1], f[2], f[3]) == 4 &&
+        line.find(',', line.find(',', line.find(',') + 1) + 1) == line.rfind(',') && line[0] != 'F') {
+      r.tag = 'S';
+      r.v.push_back(atof(f[3]));
+      r.v.push_back(atof(f[0]));
+      r.v.push_back(atof(f[1]));
+      r.v.push_back(atof(f[2]));
+      r.digits.push_back(0);
+      r.digits.push_back(0);
+      r.digits.push_back(decimals(f[1]));
+      r.digits.push_back(decimals(f[2]));
+    } else if (sscanf(line.c_str(), "V,%lu,%lu", &tick, &dac) == 2) {
+      r.tag = 'V';
+      r.v.push_back(tick);
+      r.v.push_back(dac);
+    } else {
+      r.tag = 'T';
+      r.text = line;
+    }
+    tr.push_back(r);
+  }
+}
+
+//DAC / ADC records since t0 (ns)
+void logRecords(uint64_t t0, GoldenTrace &tr) {
+  for (size_t k = 0; k < hostDacLog.size(); k++) {
+    if (hostDacLog[k].addr != PS_DAC_ADDR || hostDacLog[k].ns < t0) continue;
+    GoldenRec r;
+    r.tag = 'D';
+    r.v.push_back((double)((hostDacLog[k].ns - t0) / 1000));
+    r.v.push_back(hostDacLog[k].code);
+    tr.push_back(r);
+  }
+  for (size_t k = 0; k < adcLog.size(); k++) {
+    if (adcLog[k].first < t0) continue;
+    GoldenRec r;
+    r.tag = 'A';
+    r.v.push_back((double)((adcLog[k].first - t0) / 1000));
+    r.v.push_back(adcLog[k].second);
+    tr.push_back(r);
+  }
+}
+
+std::string formatTrace(const GoldenTrace &tr) {
+  std::string s;
+  char buf[96];
+  for (size_t k = 0; k < tr.size(); k++) {
+    const GoldenRec &r = tr[k];
+    if (r.tag == 'T') {
+      s += "T " + r.text + "\n";
+      continue;
+    }
+    snprintf(buf, sizeof(buf), "%c", r.tag);
+    s += buf;
+    for (size_t i = 0; i < r.v.size(); i++) {
+      snprintf(buf, sizeof(buf), " %.*f", r.digits.empty() ? 0 : r.digits[i], r.v[i]);
+      s += buf;
+    }
+    s += "\n";
+  }
+  return s;
+}
+
+GoldenTrace loadTrace(const std::string &text) {
+  GoldenTrace tr;
+  std::vector<std::string> ls = lines(text);
+  for (size_t k = 0; k < ls.size(); k++) {
+    if (ls[k].size() < 2) continue;
+    GoldenRec r;
+    r.tag = ls[k][0];
+    if (r.tag == 'T') {
+      r.text = ls[k].substr(2);
+    } else {
+      std::vector<std::string> w = words(ls[k].substr(2));
+      for (size_t i = 0; i < w.size(); i++) {
+        r.v.push_back(atof(w[i].c_str()));
+        r.digits.push_back(decimals(w[i]));
+      }
+    }
+    tr.push_back(r);
+  }
+  return tr;
+}
+
+//Value i of a record within tolerance: times GOLDEN_US, codes GOLDEN_LSB, computed values GOLDEN_REL
+bool within(const GoldenRec &g, size_t i, double v) {
+  double ref = g.v[i];
+  double tol;
+  if (i == 0) {
+    tol = GOLDEN_US;
+  } else if (g.tag != 'S' || i == 1) {
+    tol = GOLDEN_LSB;
+  } else {
+    tol = GOLDEN_REL * fabs(ref) + pow(10.0, -g.digits[i]) * 1.001;
+  }
+  return fabs(v - ref) <= tol;
+}
+
+//Numeric words of text lines within one unit of their last printed digit
+bool sameText(const std::string &a, const std::string &b) {
+  std::vector<std::string> wa = words(a), wb = words(b);
+  if (wa.size() != wb.size()) return false;
+  for (size_t i = 0; i < wa.size(); i++) {
+    if (wa[i] == wb[i]) continue;
+    char *ea, *eb;
+    double va = strtod(wa[i].c_str(), &ea), vb = strtod(wb[i].c_str(), &eb);
+    if (*ea || *eb || ea == wa[i].c_str() || eb == wb[i].c_str()) return false;
+    if (fabs(va - vb) > pow(10.0, -decimals(wb[i])) * 1.001) return false;
+  }
+  return true;
+}
+
+std::string goldenPath(const char *name) {
+  std::string dir(__FILE__);
+  dir = dir.substr(0, dir.rfind('/') + 1);
+  return dir + name + ".golden";
+}
+
+//Compare trace with the stored golden trace (or store it, GOLDEN_UPDATE=1)
+void checkGolden(const char *name, const GoldenTrace &tr) {
+  std::string path = goldenPath(name);
+  const char *upd = getenv("GOLDEN_UPDATE");
+  if (upd && upd[0] == '1') {
+    TEST_ASSERT_TRUE(writeFile(path, formatTrace(tr)));
+    return;
+  }
+  std::string text = readFile(path);
+  TEST_ASSERT_TRUE_MESSAGE(!text.empty(), ("missing golden trace " + path + ", GOLDEN_UPDATE=1 writes it").c_str());
+  GoldenTrace g = loadTrace(text);
+  char msg[160];
+  size_t n = g.size() < tr.size() ? g.size() : tr.size();
+  for (size_t k = 0; k < n; k++) {
+    bool ok = g[k].tag == tr[k].tag && g[k].v.size() == tr[k].v.size();
+    if (ok && g[k].tag == 'T') ok = sameText(g[k].text, tr[k].text);
+    for (size_t i = 0; ok && i < g[k].v.size(); i++) ok = within(g[k], i, tr[k].v[i]);
+    if (!ok) {
+      snprintf(msg, sizeof(msg), "%s line %u: \"%s\" expected \"%s\"", name, (unsigned)k + 1,
+               formatTrace(GoldenTrace(1, tr[k])).c_str(), formatTrace(GoldenTrace(1, g[k])).c_str());
+      TEST_FAIL_MESSAGE(msg);
+    }
+  }
+  snprintf(msg, sizeof(msg), "%s: %u records, golden %u", name, (unsigned)tr.size(), (unsigned)g.size());
+  TEST_ASSERT_EQUAL_MESSAGE(g.size(), tr.size(), msg);
+}
+
+//Reset state: PotStat shield (and WQM board), link up at BLE_BAUD
+void boot(boolean wqm) {
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  hostI2c[WQM_ADC1_ADDR] = wqm;
+  hostI2c[WQM_ADC2_ADDR] = wqm;
+  hostAdc = loggedAdc;
+  setup();
+  bootState = BOOT_DONE;
+  setBaud(BLE_BAUD);
+  hostRun(50000);
+  hostTake();
+}
+
+//Run command cmd from reset until the experiment ends (or for us), trace of DAC / ADC / output
+GoldenTrace record(const char *cmd, uint64_t us, boolean wqm) {
+  boot(wqm);
+  uint64_t t0 = hostNs;
+  hostDacLog.clear();
+  adcLog.clear();
+  hostDacLogEn = true;
+  hostSend(cmd);
+  std::string out;
+  hostRunUntil([] { return expStarted != 0; }, 1000000);
+  hostRunUntil([&out] {
+    out += hostTake();
+    return expStarted == 0;
+  }, us);
+  if (expStarted) finishExperiment();
+  hostRun(200000);
+  out += hostTake();
+  hostDacLogEn = false;
+  GoldenTrace tr;
+  logRecords(t0, tr);
+  parseOutput(out, tr);
+  return tr;
+}
+
+//Run command cmd in a child process from reset, trace compared with golden trace name
+void golden(const char *name, const char *cmd, uint64_t us, boolean wqm) {
+  char path[] = "/tmp/wqm_goldenXXXXXX";
+  int fd = mkstemp(path);
+  close(fd);
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(writeFile(path, formatTrace(record(cmd, us, wqm))) ? 0 : 1);
+  }
+  int st;
+  waitpid(pid, &st, 0);
+  TEST_ASSERT_TRUE(WIFEXITED(st) && WEXITSTATUS(st) == 0);
+  GoldenTrace tr = loadTrace(readFile(path));
+  unlink(path);
+  TEST_ASSERT_GREATER_THAN(10, tr.size());
+  checkGolden(name, tr);
+}
+
+#define CMD_CV  "<R%SR:20%G:2%E:1%SM:1%EP:9000,9,9000,-9,0,-200,300,500,2,%/>"
+#define CMD_LSV "<R%SR:30%G:2%E:1%SM:1%EP:0,0,0,0,-500,-500,500,500,1,%/>"
+#define CMD_DPV "<R%SR:30%G:2%E:2%SM:1%EP:0,0,0,0,-200,0,10,50,50,100,%/>"
+#define CMD_EIS "<R%SR:60%G:2%E:3%EP:0,0,0,0,0,10,5000,2000,2,2,%/>"
+
+//Verify command of run command cmd (V instead of R, %VP:1 inserted)
+std::string verifyCmd(const char *cmd) {
+  std::string v(cmd);
+  v[1] = 'V';
+  v.insert(2, "%VP:1");
+  return v;
+}
+
+//Output of a verify run of cmd
+std::string verify(const char *cmd) {
+  hostTake();
+  hostSend(verifyCmd(cmd));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return vrActive; }, 1000000));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return !vrActive; }, 60000000));
+  hostRun(100000);
+  return hostTake();
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_cv(void) {
+  golden("cv", CMD_CV, 10000000, false);
+}
+
+void test_lsv(void) {
+  golden("lsv", CMD_LSV, 10000000, false);
+}
+
+void test_dpv(void) {
+  golden("dpv", CMD_DPV, 10000000, false);
+}
+
+void test_eis(void) {
+  golden("eis", CMD_EIS, 10000000, false);
+}
+
+void test_wqm(void) {
+  golden("wqm", "<W%/>", 3000000, true);
+}
+
+//Verify runs: sample points of every config
+void test_verify(void) {
+  const char *cmds[] = {CMD_CV, CMD_LSV, CMD_DPV, CMD_EIS};
+  const char *names[] = {"verify_cv", "verify_lsv", "verify_dpv", "verify_eis"};
+  boot(false);
+  for (byte k = 0; k < 4; k++) {
+    GoldenTrace tr;
+    parseOutput(verify(cmds[k]), tr);
+    checkGolden(names[k], tr);
+  }
+}
+
+//Same verify results after boot and after a run (sync window of the run, not of the last run)
+void test_verify_deterministic(void) {
+  boot(false);
+  std::string a = verify(CMD_DPV);
+  TEST_ASSERT_TRUE(a.find("Verify: samples") != std::string::npos);
+  hostSend("<R%SR:30%G:2%E:1%EP:0,0,0,0,0,-200,300,500,1,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 1000000));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 10000000));
+  TEST_ASSERT_EQUAL_STRING(a.c_str(), verify(CMD_DPV).c_str());
+}
+
+//Impedance scan generates its sine on the virtual clock
+void test_verify_eis(void) {
+  boot(false);
+  std::string out = verify(CMD_EIS);
+  unsigned long n = 0;
+  size_t p = out.find("Verify: DAC updates");
+  TEST_ASSERT_TRUE(p != std::string::npos);
+  sscanf(out.c_str() + p, "Verify: DAC updates %lu", &n);
+  //2 points, 3 periods each at 5 Hz and 2 Hz
+  TEST_ASSERT_INT_WITHIN(PLAN_DAC_RATE / 10, (3 / 5.0 + 3 / 2.0) * PLAN_DAC_RATE, n);
+  TEST_ASSERT_EQUAL(std::string::npos, out.find("F,"));
+}
+
+//Long verify run: commands read meanwhile (busy / abort), nothing dropped, config of the last run kept
+void test_verify_background(void) {
+  boot(false);
+  hostSend("<R%SR:30%G:2%E:1%EP:0,0,0,0,0,-200,300,500,1,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 1000000));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 10000000));
+  unsigned long tCycle = e.tCycle;
+  unsigned long dropped = hostRxDropped;
+  hostTake();
+  hostSend("<V%SR:30%G:2%E:1%EP:900000000,0,0,0,0,-200,300,500,1,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return vrActive; }, 1000000));
+  hostRun(100000);
+  hostSend("<R%SR:30%G:2%E:1%EP:0,0,0,0,0,-200,300,500,1,%/>");
+  hostRun(200000);
+  TEST_ASSERT_TRUE(vrActive);
+  TEST_ASSERT_EQUAL(0, expStarted);
+  std::string out = hostTake();
+  TEST_ASSERT_TRUE(out.find("Error: Experiment running") != std::string::npos);
+  hostSend("<X/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return !vrActive; }, 1000000));
+  TEST_ASSERT_EQUAL(dropped, hostRxDropped);
+  TEST_ASSERT_EQUAL(tCycle, e.tCycle);
+  TEST_ASSERT_EQUAL(std::string::npos, hostTake().find("Verify:"));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_cv);
+  RUN_TEST(test_lsv);
+  RUN_TEST(test_dpv);
+  RUN_TEST(test_eis);
+  RUN_TEST(test_wqm);
+  RUN_TEST(test_verify);
+  RUN_TEST(test_verify_deterministic);
+  RUN_TEST(test_verify_eis);
+  RUN_TEST(test_verify_background);
+  return UNITY_END();
+}
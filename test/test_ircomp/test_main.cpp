@@ -0,0 +1,80 @@
+/*
+ * iR compensation (%RU:#) against the RC dummy cell (stubs/rc_cell.h): Ru and cell time constant
+ * measured by current interrupt, age of the compensated current (conversion start to DAC write,
+ * up to one sample period) reported and checked against the time constant
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+#include "rc_cell.h"
+
+//Value of the info message starting with text, -1 if not sent
+long infoValue(const std::string &s, const char *text) {
+  size_t p = s.find(std::string("Info: ") + text);
+  if (p == std::string::npos) return -1;
+  return atol(s.c_str() + p + 6 + strlen(text));
+}
+
+//CV -100..100 mV at 20 Hz, Ru measured before the start, output of the run
+std::string run(const char *cmd) {
+  hostTake();
+  rcStart();
+  hostSend(cmd);
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 5000000));
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == 0; }, 20000000));
+  hostDacLogEn = false;
+  return hostTake();
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+//Fast cell (9 ms): current up to one 50 ms sample period old, warning sent
+void test_fast_cell(void) {
+  rcCdl = 10.0E-6;
+  std::string out = run("<R%SR:20%G:2%E:1%RU:-1%EP:0,0,0,0,-100,-100,100,100,1,%/>");
+  TEST_ASSERT_FLOAT_WITHIN(0.1 * rcRu * IR_COMP_PCT / 100, rcRu * IR_COMP_PCT / 100, infoValue(out, "iR comp.: Ru (ohm)"));
+  long tau = infoValue(out, "iR comp.: cell time constant (us)");
+  TEST_ASSERT_FLOAT_WITHIN(0.15 * rcTau() * 1.0E6, rcTau() * 1.0E6, tau);
+  //age: from the conversion (8 ms) up to the next conversion start, one sample period
+  long ageMax = infoValue(out, "iR comp.: max age of the compensated current (us)");
+  long ageMean = infoValue(out, "iR comp.: mean age of the compensated current (us)");
+  TEST_ASSERT_INT_WITHIN(3000, 50000, ageMax);
+  TEST_ASSERT_INT_WITHIN(3000, (50000 + PLAN_ADC_US) / 2, ageMean);
+  long age = infoValue(out, "Warning: iR comp. current older than the cell time constant, may oscillate, age (us)");
+  TEST_ASSERT_GREATER_THAN(tau, age);
+}
+
+//Slow cell (91 ms): 33 ms sample period, no warning
+void test_slow_cell(void) {
+  rcCdl = 100.0E-6;
+  std::string out = run("<R%SR:30%G:2%E:1%RU:-1%EP:0,0,0,0,-100,-100,100,100,1,%/>");
+  long tau = infoValue(out, "iR comp.: cell time constant (us)");
+  TEST_ASSERT_FLOAT_WITHIN(0.15 * rcTau() * 1.0E6, rcTau() * 1.0E6, tau);
+  TEST_ASSERT_LESS_THAN(tau, infoValue(out, "iR comp.: max age of the compensated current (us)"));
+  TEST_ASSERT_EQUAL(std::string::npos, out.find("Warning: iR comp."));
+}
+
+//Ru given: time constant unknown, age reported, no warning
+void test_ru_given(void) {
+  rcCdl = 10.0E-6;
+  std::string out = run("<R%SR:20%G:2%E:1%RU:500%EP:0,0,0,0,-100,-100,100,100,1,%/>");
+  TEST_ASSERT_EQUAL(-1, infoValue(out, "iR comp.: cell time constant (us)"));
+  TEST_ASSERT_INT_WITHIN(3000, 50000, infoValue(out, "iR comp.: max age of the compensated current (us)"));
+  TEST_ASSERT_EQUAL(std::string::npos, out.find("Warning: iR comp."));
+}
+
+int main(int argc, char **argv) {
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  hostAdc = rcAdc;
+  setup();
+  bootState = BOOT_DONE;
+  setBaud(BLE_BAUD);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_fast_cell);
+  RUN_TEST(test_slow_cell);
+  RUN_TEST(test_ru_given);
+  return UNITY_END();
+}
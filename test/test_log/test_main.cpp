@@ -0,0 +1,135 @@
+/*
+ * WQM store-and-forward log in EEPROM: layout migration, ring wrap, wear and dump throughput
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+
+//Log record k (temperature / pH / Cl of the interval)
+void writeRec(long k) {
+  logSum[0] = 2000 + k % 1000;
+  logSum[1] = 7000 - k % 1000;
+  logSum[2] = k % 30000;
+  logN = 1;
+  tSampleWQM = k * 60000UL;
+  writeLog();
+}
+
+//Parsed 'L' block of dumpLog(), returns record count, -1 if malformed
+int parseDump(const std::string &s, std::vector<std::vector<uint8_t> > &recs) {
+  if (s.size() < 4 || s[0] != 'L') return -1;
+  int n = (uint8_t)s[1] | ((uint8_t)s[2] << 8);
+  if (s.size() < (size_t)(4 + n * (LOG_REC_LEN - 1)) || s[3 + n * (LOG_REC_LEN - 1)] != 13) return -1;
+  for (int k = 0; k < n; k++) {
+    const uint8_t *p = (const uint8_t *)s.data() + 3 + k * (LOG_REC_LEN - 1);
+    recs.push_back(std::vector<uint8_t>(p, p + LOG_REC_LEN - 1));
+  }
+  return n;
+}
+
+unsigned long eeWrites() {
+  unsigned long n = 0;
+  for (int i = 0; i < 1024; i++) n += hostEeWrites[i];
+  return n;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+//Log of the previous layout (96 slots up to 1023, no blank) dropped at start, blank area invalid
+void test_layout_migration(void) {
+  TEST_ASSERT_EQUAL(EE_LAYOUT, hostEe[EE_LAYOUT_ADDR]);
+  TEST_ASSERT_EQUAL(0, logPending);
+  for (int i = 0; i < LOG_SLOTS; i++) TEST_ASSERT_EQUAL(0XFF, hostEe[LOG_EE_ADDR + i * LOG_REC_LEN]);
+  BlankHdr h;
+  EEPROM.get(BLANK_EE_ADDR, h);
+  TEST_ASSERT_TRUE(h.magic != BLANK_MAGIC);
+  //once only
+  unsigned long n = eeWrites();
+  checkEeLayout();
+  TEST_ASSERT_EQUAL(n, eeWrites());
+}
+
+void test_log_wrap(void) {
+  //seq wraps (0XFE -> 0) and the ring wraps several times
+  const long N = 300;
+  for (long k = 0; k < N; k++) writeRec(k);
+  initLog();
+  TEST_ASSERT_EQUAL(N % 255, logSeq);
+  TEST_ASSERT_EQUAL(N % LOG_SLOTS, logHead);
+  TEST_ASSERT_EQUAL(LOG_SLOTS, logPending);
+  //oldest first, consecutive
+  hostTake();
+  dumpLog();
+  std::vector<std::vector<uint8_t> > recs;
+  TEST_ASSERT_EQUAL(LOG_SLOTS, parseDump(hostTake(), recs));
+  for (int i = 0; i < LOG_SLOTS; i++) {
+    long k = N - LOG_SLOTS + i;
+    TEST_ASSERT_EQUAL(k % 255, recs[i][0]);
+    TEST_ASSERT_EQUAL(k, recs[i][1] | (recs[i][2] << 8)); //tMin
+    TEST_ASSERT_EQUAL(2000 + k % 1000, (int16_t)(recs[i][3] | (recs[i][4] << 8)));
+  }
+  //drained records are not sent again after a reset
+  initLog();
+  TEST_ASSERT_EQUAL(0, logPending);
+  TEST_ASSERT_EQUAL(N % 255, logSeq);
+}
+
+//Every slot written once per ring pass, no byte more often than its record
+void test_log_wear(void) {
+  unsigned long before[1024];
+  memcpy(before, hostEeWrites, sizeof(before));
+  const int passes = 10;
+  for (long k = 0; k < passes * LOG_SLOTS; k++) writeRec(k);
+  for (int i = 0; i < 1024; i++) {
+    unsigned long d = hostEeWrites[i] - before[i];
+    if (i < LOG_EE_ADDR || i >= LOG_EE_ADDR + LOG_SLOTS * LOG_REC_LEN) {
+      TEST_ASSERT_EQUAL(0, d);
+    } else if ((i - LOG_EE_ADDR) % LOG_REC_LEN == 0) {
+      TEST_ASSERT_EQUAL(passes, d); //seq
+    } else {
+      TEST_ASSERT_LESS_OR_EQUAL(passes, d);
+    }
+  }
+}
+
+//Full ring dumped at link speed, then one status write per record
+void test_dump_throughput(void) {
+  setBaud(BLE_BAUD);
+  for (long k = 0; k < LOG_SLOTS; k++) writeRec(k);
+  TEST_ASSERT_EQUAL(LOG_SLOTS, logPending);
+  hostTake();
+  uint64_t t0 = hostNs;
+  dumpLog();
+  Serial.flush();
+  uint64_t t = hostNs - t0;
+  std::string out = hostTake();
+  std::vector<std::vector<uint8_t> > recs;
+  TEST_ASSERT_EQUAL(LOG_SLOTS, parseDump(out, recs));
+  uint64_t txNs = out.size() * hostByteNs();
+  uint64_t eeNs = LOG_SLOTS * HOST_EE_WRITE_US * 1000ULL;
+  TEST_ASSERT_LESS_OR_EQUAL(txNs + eeNs + 2000000ULL, t);
+  TEST_ASSERT_EQUAL(0, logPending);
+}
+
+int main(int argc, char **argv) {
+  //EEPROM of the previous layout: log ring 64..1023 (96 slots) full of pending records
+  for (int i = 0; i < 96; i++) {
+    int addr = LOG_EE_ADDR + i * LOG_REC_LEN;
+    hostEe[addr] = (i + 40) % 96;
+    hostEe[addr + 1] = LOG_PENDING;
+    for (int b = 2; b < LOG_REC_LEN; b++) hostEe[addr + b] = i + b;
+  }
+  hostEe[BLANK_EE_ADDR] = BLANK_MAGIC & 0XFF;
+  hostEe[BLANK_EE_ADDR + 1] = BLANK_MAGIC >> 8;
+  setup();
+  bootState = BOOT_DONE;
+  linkUp = true;
+  if (expStarted) finishExperiment();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_layout_migration);
+  RUN_TEST(test_log_wrap);
+  RUN_TEST(test_log_wear);
+  RUN_TEST(test_dump_throughput);
+  return UNITY_END();
+}
@@ -0,0 +1,105 @@
+/*
+ * Experiment planner: CPU / link budget of run and dry run (D) commands, a dry run or a rejected run
+ * command leaves the experiment config and the gain mux unchanged
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+
+//Value of message text in output, -1 if not found
+long msgValue(const std::string &out, const char *text) {
+  size_t p = out.find(text);
+  if (p == std::string::npos) return -1;
+  return atol(out.c_str() + p + strlen(text));
+}
+
+//Send command, output of its processing
+std::string command(const char *cmd) {
+  hostTake();
+  hostSend(cmd);
+  hostRun(200000);
+  return hostTake();
+}
+
+//Gain mux pin writes since reset
+unsigned long muxWrites() {
+  return hostPinWrites[PS_MUX0] + hostPinWrites[PS_MUX1];
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+//Std stream waits for each frame at the baud rate, max. rate from the CPU budget
+void test_cpu_reject(void) {
+  setBaud(BLE_BAUD);
+  std::string out = command("<D%SR:100%G:2%E:1%SM:0%EP:0,0,0,0,0,-200,600,400,1,%/>");
+  float sampleUs = PLAN_ADC_US + PLAN_FRAME_BYTES[STREAM_STD] * 1.0E7 / BLE_BAUD;
+  long rMax = (PLAN_CPU_MAX * 1.0E4 - (float)PLAN_DAC_RATE * PLAN_DAC_US) / sampleUs;
+  TEST_ASSERT_EQUAL(74, rMax);
+  TEST_ASSERT_GREATER_THAN(PLAN_CPU_MAX, msgValue(out, "Plan: CPU load (%) "));
+  TEST_ASSERT_EQUAL(rMax, msgValue(out, "Error: CPU budget exceeded, max sample rate "));
+  TEST_ASSERT_EQUAL(std::string::npos, out.find("Plan accepted"));
+  //the max. rate fits
+  out = command("<D%SR:74%G:2%E:1%SM:0%EP:0,0,0,0,0,-200,600,400,1,%/>");
+  TEST_ASSERT_LESS_OR_EQUAL(PLAN_CPU_MAX, msgValue(out, "Plan: CPU load (%) "));
+  TEST_ASSERT_TRUE(out.find("Plan accepted") != std::string::npos);
+}
+
+//CSV frames over the link budget at the factory baud rate, packed records (9 bytes) would fit
+void test_link_reject(void) {
+  setBaud(BLE_BAUD_DEFAULT);
+  std::string out = command("<D%SR:40%G:2%E:1%SM:1%EP:0,0,0,0,0,-200,600,400,1,%/>");
+  long linkMax = BLE_BAUD_DEFAULT / 10 * PLAN_LINK_MAX / 100;
+  TEST_ASSERT_EQUAL(std::string::npos, out.find("CPU budget exceeded"));
+  TEST_ASSERT_EQUAL(linkMax / PLAN_FRAME_BYTES[STREAM_CSV], msgValue(out, "Error: Link budget exceeded, max sample rate "));
+  TEST_ASSERT_EQUAL(STREAM_PACKED, msgValue(out, "Plan: fits link with stream mode "));
+  out = command("<D%SR:40%G:2%E:1%SM:2%EP:0,0,0,0,0,-200,600,400,1,%/>");
+  TEST_ASSERT_TRUE(out.find("Plan accepted") != std::string::npos);
+  //same rate as a run command: not started
+  out = command("<R%SR:40%G:2%E:1%SM:1%EP:0,0,0,0,0,-200,600,400,1,%/>");
+  TEST_ASSERT_TRUE(out.find("Error: Link budget exceeded") != std::string::npos);
+  TEST_ASSERT_FALSE(expStarted);
+  setBaud(BLE_BAUD);
+}
+
+//Dry run with another gain and waveform: config of the last run and the gain mux untouched
+void test_dry_run_keeps_state(void) {
+  TEST_ASSERT_EQUAL(std::string::npos, command("<R%SR:20%G:6%E:1%EP:0,0,0,0,0,-100,100,400,1,%/>").find("Error"));
+  TEST_ASSERT_EQUAL(PS_EXP_RUNNING, expStarted);
+  command("<X/>");
+  TEST_ASSERT_FALSE(expStarted);
+  Experiment last = e;
+  GainCal *g = gCal;
+  byte m0 = hostPinOut[PS_MUX0], m1 = hostPinOut[PS_MUX1];
+  unsigned long writes = muxWrites();
+  TEST_ASSERT_EQUAL(1, m1);
+
+  std::string out = command("<D%SR:30%G:1%E:1%SM:2%EP:0,0,0,0,0,-500,500,100,2,%/>");
+  TEST_ASSERT_TRUE(out.find("Plan accepted") != std::string::npos);
+  TEST_ASSERT_EQUAL_MEMORY(&last, &e, sizeof(Experiment));
+  TEST_ASSERT_TRUE(g == gCal);
+  TEST_ASSERT_EQUAL(writes, muxWrites());
+  TEST_ASSERT_EQUAL(m0, hostPinOut[PS_MUX0]);
+  TEST_ASSERT_EQUAL(m1, hostPinOut[PS_MUX1]);
+
+  //rejected run command (over the CPU budget)
+  out = command("<R%SR:110%G:0%E:1%SM:0%EP:0,0,0,0,0,-500,500,100,2,%/>");
+  TEST_ASSERT_TRUE(out.find("CPU budget exceeded") != std::string::npos);
+  TEST_ASSERT_FALSE(expStarted);
+  TEST_ASSERT_EQUAL_MEMORY(&last, &e, sizeof(Experiment));
+  TEST_ASSERT_EQUAL(writes, muxWrites());
+}
+
+int main(int argc, char **argv) {
+  //PotStat shield: board present pin low, DAC and ADC on I2C
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  setup();
+  bootState = BOOT_DONE;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_cpu_reject);
+  RUN_TEST(test_link_reject);
+  RUN_TEST(test_dry_run_keeps_state);
+  return UNITY_END();
+}
@@ -0,0 +1,380 @@
+/*
+ * Packed sample stream (STREAM_PACKED): SLIP / CRC-8 framing, lossless decoding on a lossy link
+ * with retransmission requests, decoded by a host side reference decoder; sample ticks corrected
+ * to a skewed host clock from the sync records (stubs/drift.h)
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+#include "drift.h"
+#include <map>
+
+struct Sample {
+  uint16_t dac;
+  int16_t adc;
+  uint32_t tick;
+  bool operator==(const Sample &s) const {
+    return dac == s.dac && adc == s.adc && tick == s.tick;
+  }
+};
+
+//Host decoder: SLIP frames, crc, seq gaps requested by '#' seq, records after a gap held until it is filled
+struct Decoder {
+  bool request; //send retransmission requests
+  std::vector<uint8_t> frame;
+  bool esc;
+  unsigned long bad; //frames dropped (crc / length)
+  unsigned long text; //text lines
+  unsigned long lost; //'X' records
+  unsigned long syncs;
+  std::vector<uint64_t> syncUs; //device time of 'T' records
+  std::vector<uint64_t> syncNs; //wire time of their last byte (feed with hostTxNs)
+  uint64_t byteNs;
+  unsigned long requests;
+  long hiIdx; //highest sample index seen, -1 = none
+  long nextIdx; //next sample index to decode
+  std::map<long, std::vector<uint8_t> > live; //'K' / 'D' records waiting to be decoded
+  std::map<long, Sample> rtx; //'R' records waiting
+  std::map<long, uint64_t> asked; //request time (ns)
+  std::vector<Sample> out;
+  Sample last;
+  int32_t dacStep;
+  uint32_t tickStep;
+
+  Decoder(bool req) : request(req), esc(false), bad(0), text(0), lost(0), syncs(0), requests(0),
+    hiIdx(-1), nextIdx(0), dacStep(0), tickStep(0) {}
+
+  void feed(const std::string &s, const std::vector<uint64_t> &ns = std::vector<uint64_t>()) {
+    for (size_t i = 0; i < s.size(); i++) {
+      byteNs = i < ns.size() ? ns[i] : hostNs;
+      byte_((uint8_t)s[i]);
+    }
+    decode();
+  }
+
+  void byte_(uint8_t c) {
+    if (c == SLIP_END) {
+      if (!frame.empty()) record();
+      frame.clear();
+      esc = false;
+    } else if (esc) {
+      frame.push_back(c == SLIP_ESC_END ? SLIP_END : c == SLIP_ESC_ESC ? SLIP_ESC : c);
+      esc = false;
+    } else if (c == SLIP_ESC) {
+      esc = true;
+    } else {
+      frame.push_back(c);
+    }
+  }
+
+  static uint32_t le(const uint8_t *p, int n) {
+    uint32_t v = 0;
+    for (int i = n - 1; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+  }
+
+  static bool varint(const uint8_t *&p, const uint8_t *end, long &v) {
+    uint32_t z = 0;
+    for (int sh = 0; p < end && sh < 35; sh += 7) {
+      uint8_t b = *p++;
+      z |= (uint32_t)(b & 0x7F) << sh;
+      if (!(b & 0x80)) {
+        v = (long)(int32_t)((z >> 1) ^ (0 - (z & 1)));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //Delta record body is exactly three varints
+  static bool deltas(const uint8_t *p, const uint8_t *end) {
+    long v;
+    return varint(p, end, v) && varint(p, end, v) && varint(p, end, v) && p == end;
+  }
+
+  long index(uint8_t seq) {
+    if (hiIdx < 0) return seq;
+    return hiIdx + (int8_t)(seq - (uint8_t)hiIdx);
+  }
+
+  void record() {
+    uint8_t crc = 0XFF;
+    for (size_t i = 0; i + 1 < frame.size(); i++) crc = _crc8_ccitt_update(crc, frame[i]);
+    if (frame.size() < 2 || crc != frame.back()) {
+      //text lines between frames (messages, cycle marks) are skipped
+      if (frame.back() == '\n') {
+        text++;
+      } else {
+        bad++;
+      }
+      return;
+    }
+    const uint8_t *p = &frame[0];
+    size_t n = frame.size() - 1;
+    if (n >= 2 && p[0] == 'N') {
+      p += 2;
+      n -= 2;
+    }
+    char type = p[0];
+    if (type == 'T' && n == 9) {
+      syncs++;
+      syncUs.push_back(((uint64_t)le(p + 5, 4) << 32) | le(p + 1, 4));
+      syncNs.push_back(byteNs);
+    } else if (type == 'X' && n == 2) {
+      lost++;
+    } else if ((type == 'K' || type == 'R') && n == 10 && (type == 'R' || p[1] % STREAM_KEY_INTERVAL == 0)) {
+      long idx = index(p[1]);
+      if (type == 'K') {
+        live[idx] = std::vector<uint8_t>(p, p + n);
+      } else {
+        Sample s = {(uint16_t)le(p + 2, 2), (int16_t)le(p + 4, 2), le(p + 6, 4)};
+        rtx[idx] = s;
+      }
+      if (idx > hiIdx) hiIdx = idx;
+    } else if (type == 'D' && n >= 5 && deltas(p + 2, p + n)) {
+      long idx = index(p[1]);
+      live[idx] = std::vector<uint8_t>(p, p + n);
+      if (idx > hiIdx) hiIdx = idx;
+    } else {
+      bad++;
+    }
+  }
+
+  //Decode in sequence as far as received, request missing samples
+  void decode() {
+    while (true) {
+      Sample s;
+      if (live.count(nextIdx)) {
+        const std::vector<uint8_t> &r = live[nextIdx];
+        if (r[0] == 'K') {
+          s.dac = le(&r[2], 2);
+          s.adc = le(&r[4], 2);
+          s.tick = le(&r[6], 4);
+          dacStep = 0;
+          tickStep = 0;
+        } else {
+          const uint8_t *p = &r[2], *end = &r[0] + r.size();
+          long d2, d, t2;
+          TEST_ASSERT_TRUE(varint(p, end, d2) && varint(p, end, d) && varint(p, end, t2));
+          dacStep = (int16_t)(dacStep + d2);
+          tickStep += (uint32_t)t2;
+          s.dac = last.dac + dacStep;
+          s.adc = last.adc + d;
+          s.tick = last.tick + tickStep;
+        }
+      } else if (rtx.count(nextIdx)) {
+        s = rtx[nextIdx];
+        //keyframes restart the step prediction
+        dacStep = nextIdx % STREAM_KEY_INTERVAL ? (int16_t)(s.dac - last.dac) : 0;
+        tickStep = nextIdx % STREAM_KEY_INTERVAL ? s.tick - last.tick : 0;
+      } else {
+        break;
+      }
+      live.erase(nextIdx);
+      rtx.erase(nextIdx);
+      out.push_back(s);
+      last = s;
+      nextIdx++;
+    }
+    if (!request) return;
+    for (long k = nextIdx; k < hiIdx; k++) {
+      if (live.count(k) || rtx.count(k)) continue;
+      //again if the request or the answer was lost
+      if (asked.count(k) && hostNs - asked[k] < STREAM_RTT_MS * 1000000ULL) continue;
+      asked[k] = hostNs;
+      std::string req("#");
+      req += (char)(uint8_t)k;
+      hostSend(req);
+      requests++;
+    }
+  }
+};
+
+//Lossy link: bytes dropped / bit flipped, own generator (device random() unchanged)
+uint32_t linkRand = 7;
+unsigned long linkDrops = 0, linkFlips = 0;
+std::string lossy(const std::string &s, unsigned perDrop, unsigned perFlip) {
+  std::string r;
+  for (size_t i = 0; i < s.size(); i++) {
+    linkRand ^= linkRand << 13;
+    linkRand ^= linkRand >> 17;
+    linkRand ^= linkRand << 5;
+    unsigned x = linkRand;
+    if (x % perDrop == 0) {
+      linkDrops++;
+    } else if (x % perFlip == 1) {
+      r += (char)(s[i] ^ (1 << (x % 8)));
+      linkFlips++;
+    } else {
+      r += s[i];
+    }
+  }
+  return r;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_frame_escape(void) {
+  const uint8_t rec[] = {'K', 32, SLIP_END, SLIP_ESC, 0, SLIP_ESC_END, 0XFF, SLIP_END, 1, 2};
+  hostTake();
+  frameStart();
+  for (byte i = 0; i < sizeof(rec); i++) frameWrite(rec[i]);
+  frameEnd();
+  std::string s = hostTake();
+  //END only as delimiter, payload and crc unescape to the record
+  TEST_ASSERT_EQUAL(SLIP_END, (uint8_t)s[0]);
+  TEST_ASSERT_EQUAL(s.size() - 1, s.find((char)SLIP_END, 1));
+  Decoder d(false);
+  for (size_t i = 0; i < s.size() - 1; i++) d.byte_((uint8_t)s[i]);
+  TEST_ASSERT_EQUAL(sizeof(rec) + 1, d.frame.size());
+  TEST_ASSERT_EQUAL_MEMORY(rec, &d.frame[0], sizeof(rec));
+  d.record();
+  TEST_ASSERT_EQUAL(0, d.bad);
+  TEST_ASSERT_EQUAL(1, d.live.size());
+  //any single bit error rejected
+  for (size_t i = 1; i < s.size() - 1; i++) {
+    for (byte b = 0; b < 8; b++) {
+      Decoder c(false);
+      std::string t = s;
+      t[i] ^= 1 << b;
+      c.feed(t);
+      TEST_ASSERT_TRUE(c.live.empty());
+    }
+  }
+}
+
+void test_lossy_link(void) {
+  Decoder ref(false), host(true);
+  hostSend("<R%SR:30%G:2%E:1%SM:2%EP:0,0,0,0,0,-200,600,400,3,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 1000000));
+  hostTake();
+  //link errors during the first 9 s of the 12 s run
+  uint64_t tLossEnd = hostNs + 9000000000ULL;
+  while (expStarted == PS_EXP_RUNNING) {
+    hostRun(2000);
+    std::string s = hostTake();
+    ref.feed(s);
+    host.feed(hostNs < tLossEnd ? lossy(s, 200, 400) : s);
+  }
+  TEST_ASSERT_GREATER_THAN(2, linkDrops);
+  TEST_ASSERT_GREATER_THAN(2, host.bad);
+  TEST_ASSERT_GREATER_THAN(2, host.requests);
+  TEST_ASSERT_EQUAL(0, ref.bad);
+  TEST_ASSERT_GREATER_THAN(0, ref.text);
+  TEST_ASSERT_EQUAL(0, host.lost);
+  TEST_ASSERT_GREATER_OR_EQUAL(11, ref.syncs);
+  //every sample recovered
+  TEST_ASSERT_INT_WITHIN(3, 360, ref.out.size());
+  TEST_ASSERT_EQUAL(ref.out.size(), host.out.size());
+  for (size_t k = 0; k < ref.out.size(); k++) {
+    TEST_ASSERT_TRUE(ref.out[k] == host.out[k]);
+  }
+  //decoded stream matches the device history
+  for (size_t k = ref.out.size() - STREAM_HIST_LEN; k < ref.out.size(); k++) {
+    StreamSample *h = &streamHist[k & (STREAM_HIST_LEN - 1)];
+    TEST_ASSERT_EQUAL(h->dac, ref.out[k].dac);
+    TEST_ASSERT_EQUAL(h->adc, ref.out[k].adc);
+    TEST_ASSERT_EQUAL((uint32_t)h->tick, ref.out[k].tick);
+  }
+}
+
+//Full scale DAC / ADC jumps (steps beyond +-32767) decode losslessly, delta records stay short
+void test_large_steps(void) {
+  const uint16_t dac[] = {0, 65535, 0, 40000, 1000, 65535, 32768, 0, 65535, 65534, 1, 32767, 65535, 0, 0, 65535};
+  const int16_t adc[] = {-32768, 32767, -32768, 0, 32767, -32768, 1, -1, 32767, -32767, 0, -32768, 32767, 2, -2, 0};
+  Decoder d(false);
+  byte mode = streamMode;
+  streamMode = STREAM_PACKED;
+  resetStream();
+  hostTake();
+  for (byte k = 0; k < 3 * STREAM_KEY_INTERVAL; k++) {
+    dacOut = dac[k % 16];
+    PS_adc1_diff_0_1 = adc[(k * 5) % 16];
+    tSample = microsExt();
+    sendSample();
+    std::string s = hostTake();
+    //'D' seq, three varints of at most 3 bytes, crc, END delimiters and escapes
+    if (k % STREAM_KEY_INTERVAL) TEST_ASSERT_LESS_OR_EQUAL(28, s.size());
+    d.feed(s);
+    hostRun(20000);
+  }
+  streamMode = mode;
+  TEST_ASSERT_EQUAL(0, d.bad);
+  TEST_ASSERT_EQUAL(3 * STREAM_KEY_INTERVAL, d.out.size());
+  for (byte k = 0; k < d.out.size(); k++) {
+    TEST_ASSERT_EQUAL(dac[k % 16], d.out[k].dac);
+    TEST_ASSERT_EQUAL(adc[(k * 5) % 16], d.out[k].adc);
+  }
+}
+
+//Host clock of the drift test: device crystal off by ppm, arbitrary epoch
+double hostClockUs(uint64_t devUs, long ppm) {
+  return devUs / (1.0 + ppm * 1.0E-6) + 5.0E9;
+}
+
+/* Device clock skewed against the host clock by ppm, 'T' records arrive after their last byte is on
+   the wire (hostTxNs) plus a random link delay (0..10 ms, BLE connection interval): sample ticks
+   corrected by the fitted offset / skew are within 3 ms of the host time they were taken at (the
+   minimum link delay of ~1 ms included), uncorrected ticks drift away by ppm * run time
+*/
+void driftRun(long ppm) {
+  Decoder d(false);
+  driftReset();
+  hostTxNsEn = true;
+  hostSend("<R%SR:30%G:2%E:1%SM:2%EP:0,0,0,0,0,-200,600,40,2,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 1000000));
+  hostTake();
+  uint32_t r = 11;
+  while (expStarted == PS_EXP_RUNNING) {
+    hostRun(2000);
+    size_t n = d.syncUs.size();
+    std::vector<uint64_t> ns(hostTxNs);
+    d.feed(hostTake(), ns);
+    for (size_t k = n; k < d.syncUs.size(); k++) {
+      r = r * 1664525 + 1013904223;
+      driftSync(d.syncUs[k], hostClockUs(d.syncNs[k] / 1000, ppm) + (r >> 8) % 10000);
+    }
+  }
+  hostTxNsEn = false;
+  TEST_ASSERT_GREATER_OR_EQUAL(75, driftPts.size());
+  TEST_ASSERT_TRUE(driftFit());
+  TEST_ASSERT_FLOAT_WITHIN(30.0E-6, 1.0 / (1.0 + ppm * 1.0E-6), driftSkew);
+  TEST_ASSERT_INT_WITHIN(3, 2400, d.out.size());
+  double errMax = 0, rawMax = 0;
+  for (size_t k = 0; k < d.out.size(); k++) {
+    uint64_t us = driftTickUs(d.out[k].tick);
+    double err = driftHostUs(d.out[k].tick) - hostClockUs(us, ppm);
+    //offset of the first record only
+    double raw = driftPts[0].host + (double)us - (double)driftPts[0].dev - hostClockUs(us, ppm);
+    errMax = max(errMax, fabs(err));
+    rawMax = max(rawMax, fabs(raw));
+  }
+  TEST_ASSERT_LESS_THAN(3000, errMax);
+  TEST_ASSERT_GREATER_THAN(10000, rawMax);
+}
+
+void test_drift_fast(void) {
+  driftRun(200);
+}
+
+void test_drift_slow(void) {
+  driftRun(-200);
+}
+
+int main(int argc, char **argv) {
+  //PotStat shield: board present pin low, DAC and ADC on I2C
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  setup();
+  bootState = BOOT_DONE;
+  setBaud(BLE_BAUD);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_frame_escape);
+  RUN_TEST(test_lossy_link);
+  RUN_TEST(test_large_steps);
+  RUN_TEST(test_drift_fast);
+  RUN_TEST(test_drift_slow);
+  return UNITY_END();
+}
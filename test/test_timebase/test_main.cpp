@@ -0,0 +1,108 @@
+/*
+ * Extended timebase: microsExt() across micros() wraps (~71.6 min) while idle and during a long CV,
+ * CV scan time bounded so the 32 bit cycle time tracked by calcInterval() cannot overflow
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+
+const uint64_t WRAP_US = 1ULL << 32;
+
+//CSV samples: DAC code and device time (us, low 32 bits)
+struct CsvSample {
+  long dac;
+  unsigned long t;
+};
+
+std::vector<CsvSample> parseCsv(const std::string &s) {
+  std::vector<CsvSample> v;
+  size_t p = 0;
+  while (p < s.size()) {
+    size_t e = s.find('\n', p);
+    if (e == std::string::npos) break;
+    CsvSample c;
+    float vOut;
+    long iIn;
+    if (sscanf(s.c_str() + p, "%ld,%f,%ld,%lu", &c.dac, &vOut, &iIn, &c.t) == 4) v.push_back(c);
+    p = e + 1;
+  }
+  return v;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+//CV scan beyond CSV_SCAN_MAX rejected, also by a slower slope of a scan-rate series
+void test_scan_bound(void) {
+  hostTake();
+  hostSend("<R%SR:15%G:2%E:1%SM:1%EP:0,0,0,0,-1500,-1500,1500,1,1,%/>");
+  hostRun(200000);
+  TEST_ASSERT_TRUE(hostTake().find("Error") != std::string::npos);
+  TEST_ASSERT_EQUAL(0, expStarted);
+  hostSend("<R%SR:15%G:2%E:1%SM:1%SS:10,1,%EP:0,0,0,0,-1500,-1500,1500,10,1,%/>");
+  hostRun(200000);
+  TEST_ASSERT_TRUE(hostTake().find("Error") != std::string::npos);
+  TEST_ASSERT_EQUAL(0, expStarted);
+}
+
+//Idle over 3 wraps: loop() keeps the extension current without an experiment
+void test_idle_wraps(void) {
+  uint64_t us0 = hostNs / 1000;
+  uint64_t t0 = microsExt();
+  for (int i = 0; i < 35; i++) {
+    hostRun(WRAP_US / 10);
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(3, (hostNs / 1000 - us0) / WRAP_US);
+  TEST_ASSERT_TRUE(microsExt() - t0 == hostNs / 1000 - us0);
+}
+
+//CV of 4 scans, 2000 s per scan (CSV_SCAN_MAX, cycle time just below 2^32 us), 3.7 wraps:
+//experiment time, cycle count and DAC follow the virtual clock, sample times step by 1 / SR
+void test_cv_wraps(void) {
+  hostTake();
+  hostSend("<R%SR:15%G:2%E:1%SM:1%EP:0,0,0,0,-1000,-1000,1000,1,4,%/>");
+  TEST_ASSERT_TRUE(hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000));
+  TEST_ASSERT_EQUAL(4000000000UL, e.tCycle);
+  const uint64_t t0 = tExpStart;
+  uint64_t tFull = 0;
+  unsigned long tLast = 0;
+  long n = 0;
+  while (expStarted == PS_EXP_RUNNING) {
+    hostRun(100000000);
+    if (expStarted == PS_EXP_RUNNING) {
+      uint64_t t = hostNs / 1000 - t0;
+      TEST_ASSERT_TRUE(tExp <= t && t - tExp < 20000);
+      TEST_ASSERT_EQUAL(t / e.tCycle, currCycle);
+    }
+    std::vector<CsvSample> v = parseCsv(hostTake());
+    for (size_t i = 0; i < v.size(); i++, n++) {
+      //device time unwrapped from its low 32 bits
+      if (n == 0) tFull = (t0 & ~(WRAP_US - 1)) | v[i].t;
+      else {
+        TEST_ASSERT_INT_WITHIN(200, 66667, (uint32_t)(v[i].t - tLast));
+        tFull += (uint32_t)(v[i].t - tLast);
+      }
+      tLast = v[i].t;
+      uint64_t tInt = (tFull - t0) % 4000000000ULL;
+      double mV = tInt < 2000000000ULL ? -1000.0 + tInt / 1.0E6 : 3000.0 - tInt / 1.0E6;
+      TEST_ASSERT_INT_WITHIN(50, lround((mV / 1000.0 + 1.5) * 21845.0), v[i].dac);
+    }
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(3, (tFull - t0) / WRAP_US);
+  TEST_ASSERT_INT_WITHIN(100, 16000L * 15, n);
+}
+
+int main(int argc, char **argv) {
+  //PotStat shield: board present pin low, DAC and ADC on I2C
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  setup();
+  bootState = BOOT_DONE;
+  setBaud(BLE_BAUD);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_scan_bound);
+  RUN_TEST(test_idle_wraps);
+  RUN_TEST(test_cv_wraps);
+  return UNITY_END();
+}
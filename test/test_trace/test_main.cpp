@@ -0,0 +1,174 @@
+/*
+ * Debug trace (TRACE_EN): lossless capture of a run, memory mapped reader and deterministic replay
+ * of the capture from reset (test/stubs/trace.h)
+ *
+ * The capture is recorded by a child process from reset and replayed by this process from reset.
+ * TRACE_FILE=<capture> replays an existing capture instead (e.g. the serial log of a device run).
+ */
+#define TRACE_EN true
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+#include "trace.h"
+#include <sys/wait.h>
+
+const char *tracePath;
+char tracePathBuf[] = "/tmp/wqm_traceXXXXXX";
+
+//Cell: current follows the DAC potential plus a slow drift, not reproducible without the capture
+int16_t cellAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  return (int16_t)((int32_t)hostDac[PS_DAC_ADDR] - 32768) / 4 + hostRand() % 97;
+}
+
+//Reset state of both processes: PotStat shield, link up at BLE_BAUD
+void boot() {
+  hostPinIn[PS_BrdPresent] = 0;
+  hostI2c[PS_DAC_ADDR] = true;
+  hostI2c[PS_ADC_ADDR] = true;
+  setup();
+  bootState = BOOT_DONE;
+  setBaud(BLE_BAUD);
+}
+
+//Host sends s, arrival times on whole us (trace time resolution), so reads of the replay happen at the same ns
+void sendUs(const std::string &s) {
+  hostSend(s);
+  for (size_t i = 0; i < hostRxPending.size(); i++) {
+    hostRxPending[i].first = (hostRxPending[i].first + 999) / 1000 * 1000;
+  }
+}
+
+//CV run with a command sent during the run, whole serial output written to path
+void record(const char *path) {
+  hostAdc = cellAdc;
+  boot();
+  std::string cap;
+  hostRun(50000);
+  sendUs("<R%SR:20%G:2%E:1%EP:0,0,0,0,0,-200,600,400,2,%/>");
+  hostRunUntil([] { return expStarted == PS_EXP_RUNNING; }, 2000000);
+  hostRun(1500000);
+  sendUs("<U%SR:10%/>");
+  hostRunUntil([] { return expStarted != PS_EXP_RUNNING; }, 20000000);
+  hostRun(200000);
+  Serial.flush();
+  cap = hostTake();
+  FILE *f = fopen(path, "wb");
+  fwrite(cap.data(), 1, cap.size(), f);
+  fclose(f);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+//Single bit errors and foreign frames skipped, device time unwrapped past 2^32 us
+void test_reader(void) {
+  hostTake();
+  unsigned long t[2] = {0XFFFFFF00UL, 0X10UL};
+  std::string s("text\n");
+  for (int k = 0; k < 2; k++) {
+    frameStart();
+    frameWrite('Z');
+    frameWrite(TR_DAC);
+    frameWrite(PS_DAC_ADDR);
+    frameWrite(0XC0);
+    frameWrite(0XDB);
+    for (byte i = 0; i < 4; i++) frameWrite((uint8_t)(t[k] >> (8 * i)));
+    frameEnd();
+  }
+  s += hostTake();
+  TraceFrames d;
+  TraceEvent ev[2];
+  int n = 0;
+  for (size_t i = 0; i < s.size(); i++) {
+    if (d.push((uint8_t)s[i], ev[n])) n++;
+  }
+  TEST_ASSERT_EQUAL(2, n);
+  TEST_ASSERT_EQUAL(1, d.skipped);
+  TEST_ASSERT_EQUAL(0XDBC0, ev[0].data);
+  TEST_ASSERT_TRUE(ev[1].us == 0X100000010ULL);
+  for (size_t i = 6; i < s.size() - 1; i++) {
+    for (byte b = 0; b < 8; b++) {
+      std::string c = s;
+      c[i] ^= 1 << b;
+      TraceFrames e;
+      TraceEvent x;
+      int m = 0;
+      for (size_t j = 0; j < c.size(); j++) m += e.push((uint8_t)c[j], x);
+      TEST_ASSERT_LESS_OR_EQUAL(1, m);
+    }
+  }
+}
+
+//Every record of the run in the capture: inputs complete, nothing dropped
+void test_capture(void) {
+  TraceReader r;
+  TEST_ASSERT_TRUE(r.open(tracePath));
+  TraceEvent ev;
+  unsigned long n[TR_DROP + 1] = {0};
+  while (r.next(ev)) n[ev.type < TR_DROP ? ev.type : TR_DROP]++;
+  TEST_ASSERT_EQUAL(0, n[TR_DROP]);
+  TEST_ASSERT_GREATER_THAN(1000, n[TR_ISR]);
+  TEST_ASSERT_GREATER_THAN(100, n[TR_ADC]);
+  TEST_ASSERT_GREATER_THAN(100, n[TR_DAC]);
+  TEST_ASSERT_GREATER_THAN(50, n[TR_RX]);
+}
+
+//Replay from reset reproduces every timer event and DAC write of the capture, at the same time
+void test_replay(void) {
+  TraceReplay p;
+  TEST_ASSERT_TRUE(p.open(tracePath));
+  boot();
+  TEST_ASSERT_TRUE(p.run(60000000));
+  if (p.mismatches) {
+    printf("first mismatch at %llu us: type %u arg %u data %u, capture %llu us: type %u arg %u data %u\n",
+           (unsigned long long)p.firstBad.us, p.firstBad.type, p.firstBad.arg, p.firstBad.data,
+           (unsigned long long)p.firstBadRef.us, p.firstBadRef.type, p.firstBadRef.arg, p.firstBadRef.data);
+  }
+  TEST_ASSERT_EQUAL(0, p.mismatches);
+  TEST_ASSERT_EQUAL(0, p.adcMisses);
+  TEST_ASSERT_GREATER_THAN(1000, p.compared);
+  TEST_ASSERT_TRUE(hostRxPending.empty());
+}
+
+//Replay with the rx bytes after the run command withheld diverges (sample timer of the update missing)
+void test_replay_diverges(void) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    TraceReplay p;
+    p.open(tracePath);
+    while (!hostRxPending.empty() && hostRxPending.back().second != '>') hostRxPending.pop_back();
+    hostRxPending.pop_back();
+    while (!hostRxPending.empty() && hostRxPending.back().second != '>') hostRxPending.pop_back();
+    boot();
+    p.run(60000000);
+    _exit(p.mismatches > 0 ? 0 : 1);
+  }
+  int st;
+  waitpid(pid, &st, 0);
+  TEST_ASSERT_TRUE(WIFEXITED(st));
+  TEST_ASSERT_EQUAL(0, WEXITSTATUS(st));
+}
+
+int main(int argc, char **argv) {
+  tracePath = getenv("TRACE_FILE");
+  if (!tracePath) {
+    int fd = mkstemp(tracePathBuf);
+    close(fd);
+    tracePath = tracePathBuf;
+    pid_t pid = fork();
+    if (pid == 0) {
+      record(tracePath);
+      _exit(0);
+    }
+    int st;
+    waitpid(pid, &st, 0);
+  }
+
+  UNITY_BEGIN();
+  RUN_TEST(test_replay);
+  RUN_TEST(test_replay_diverges);
+  RUN_TEST(test_capture);
+  RUN_TEST(test_reader);
+  int r = UNITY_END();
+  if (tracePath == tracePathBuf) unlink(tracePath);
+  return r;
+}
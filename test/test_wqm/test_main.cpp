@@ -0,0 +1,125 @@
+/*
+ * WQM sensor conversion against float references, idle sleep between WQM samples
+ */
+#include <unity.h>
+#include "../../src/WQM_PotStat_Shield.cpp"
+
+//Nernst reference (0.001 pH)
+double refPH(long uV, int t) {
+  double slope = 0.1984 * (t / 100.0 + 273.15); //mV per pH
+  return PH_ISO - (uV - PH_E0) / slope;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_ph_nernst(void) {
+  const int temps[] = {-2000, 0, 2500, 8000, 15000};
+  for (byte k = 0; k < 5; k++) {
+    for (long uV = -300000; uV <= 300000; uV += 25000) {
+      TEST_ASSERT_FLOAT_WITHIN(1.5, refPH(uV, temps[k]), calcPH(uV, temps[k]));
+    }
+  }
+}
+
+void test_ph_range(void) {
+  //beyond the pH range at the steepest / flattest slope, no 16 bit overflow
+  const int temps[] = {-2000, 15000};
+  for (byte k = 0; k < 2; k++) {
+    for (long uV = -2500000; uV <= 2500000; uV += 50000) {
+      int p = calcPH(uV, temps[k]);
+      TEST_ASSERT_GREATER_OR_EQUAL(0, p);
+      TEST_ASSERT_LESS_OR_EQUAL(PH_MAX, p);
+      TEST_ASSERT_FLOAT_WITHIN(1.5, constrain(refPH(uV, temps[k]), 0.0, (double)PH_MAX), p);
+    }
+  }
+  TEST_ASSERT_EQUAL(PH_MAX, calcPH(-1500000, -2000));
+  TEST_ASSERT_EQUAL(0, calcPH(1500000, -2000));
+}
+
+void test_temp_lut(void) {
+  //table ends (clamped -20..150 deg. C) and interpolation midway
+  TEST_ASSERT_EQUAL(15000, lookupTemp(-5));
+  TEST_ASSERT_EQUAL(-539, lookupTemp(32767));
+  TEST_ASSERT_EQUAL((4692 + 4099) / 2, lookupTemp(4 * 1024 + 512));
+  TEST_ASSERT_EQUAL((-456 - 539) / 2 - 1, lookupTemp(31 * 1024 + 512));
+}
+
+void test_msg_format(void) {
+  //catalog messages are text lines only
+  bootState = BOOT_DONE;
+  hostTake();
+  sendInfo(MSG_PS_NONE);
+  sendError(MSG_ERR_SR_RANGE, 13);
+  TEST_ASSERT_EQUAL_STRING("Info: No PotStat board detected\r\nError: Sample Rate out of range 13\r\n", hostTake().c_str());
+}
+
+void test_switch_time(void) {
+  //reported switch time is the time of the sample since the switch period start
+  bootState = BOOT_DONE;
+  startExperimentWQM();
+  unsigned long t0 = millis();
+  hostTake();
+  hostRun(1100000);
+  finishExperiment();
+  std::string out = hostTake();
+  int n = 0;
+  size_t pos = 0;
+  while ((pos = out.find('\n', pos)) != std::string::npos) {
+    long v[9];
+    if (sscanf(out.c_str() + out.rfind('\n', pos - 1) + 1, " %ld %ld %ld %ld %ld %ld %ld %ld %ld",
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8]) == 9) {
+      TEST_ASSERT_INT_WITHIN(1, v[8] - t0, v[4]);
+      n++;
+    }
+    pos++;
+  }
+  TEST_ASSERT_EQUAL(5, n);
+}
+
+//WQM board ADC codes: mid scale pH, 25 deg. C thermistor, small Cl current
+int16_t wqmAdc(uint8_t addr, uint8_t pair, uint16_t gain) {
+  return addr == 0x49 && pair == 0 ? 15000 : 1000;
+}
+
+//WQM measurement on the virtual clock: CPU asleep between samples except for the blocking
+//ADC conversions and settling delays, timer events served without delay
+void test_idle_duty(void) {
+  //internal ADC and comparator powered down in setup()
+  TEST_ASSERT_EQUAL(0, ADCSRA);
+  TEST_ASSERT_TRUE(ACSR & _BV(ACD));
+  TEST_ASSERT_TRUE(PRR & _BV(PRADC));
+  bootState = BOOT_DONE;
+  setBaud(BLE_BAUD);
+  WQM_Present = true;
+  hostAdc = wqmAdc;
+  startExperimentWQM();
+  hostRun(20000000);
+  hostTake();
+  finishExperiment();
+  std::string out = hostTake();
+  WQM_Present = false;
+  hostAdc = 0;
+  //3 conversions and 3 x 5 ms settling per sample
+  long awakeUs = 3 * (HOST_ADS_START_US + HOST_ADS_CONV_US + HOST_ADS_READ_US) + 3 * 5000L;
+  long duty = WQM_SAMP_RATE * awakeUs / 1000;
+  size_t p = out.find("Info: CPU duty cycle (0.1 %) ");
+  TEST_ASSERT_TRUE(p != std::string::npos);
+  TEST_ASSERT_INT_WITHIN(5, duty, atol(out.c_str() + p + 29));
+  p = out.find("Info: Max. wake latency (us) ");
+  TEST_ASSERT_TRUE(p != std::string::npos);
+  TEST_ASSERT_LESS_OR_EQUAL(100, atol(out.c_str() + p + 29));
+}
+
+int main(int argc, char **argv) {
+  setup();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_ph_nernst);
+  RUN_TEST(test_ph_range);
+  RUN_TEST(test_temp_lut);
+  RUN_TEST(test_msg_format);
+  RUN_TEST(test_switch_time);
+  RUN_TEST(test_idle_duty);
+  return UNITY_END();
+}
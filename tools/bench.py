@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Hot path benchmark per commit
+
+For each commit (default HEAD) runs
+- the host benchmark, test/test_bench in env:native (ns per call), and
+- with --avr, the target benchmark build env:bench under simavr (cycles per call, ATmega328P 16 MHz),
+then appends one JSON line per commit to the output file:
+
+  {"commit": "<sha>", "subject": "...", "host_ns": [...], "avr_cycles": [...]}
+
+Each list has one entry per kernel and experiment config
+({"fn": "calcOutput", "exp": "CV", "n": 64, "min": ..., "max": ..., "mean": ...}, see benchRun()).
+Commits are checked out in a temporary git worktree, the working tree is not touched.
+
+  python3 tools/bench.py [--avr] [--out bench.jsonl] [commit | rev-range ...]
+  python3 tools/bench.py --avr HEAD~10..HEAD
+  python3 tools/bench.py --compare bench.jsonl   # mean change of the last commit vs the one before
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+RECORD = re.compile(r'\{"fn":.*?\}')
+SIMAVR_TIMEOUT = 120  # s, the benchmark build halts after the report
+
+
+def git(*args, cwd=None):
+    return subprocess.check_output(["git"] + list(args), cwd=cwd).decode().strip()
+
+
+def commits(revs):
+    out = []
+    for rev in revs or ["HEAD"]:
+        if ".." in rev:
+            out += git("rev-list", "--reverse", rev).split()
+        else:
+            out.append(git("rev-parse", rev))
+    return out
+
+
+def records(text):
+    return [json.loads(m) for m in RECORD.findall(text)]
+
+
+def host_bench(tree):
+    with tempfile.NamedTemporaryFile(suffix=".jsonl", delete=False) as f:
+        path = f.name
+    try:
+        env = dict(os.environ, BENCH_JSON=path)
+        subprocess.check_call(["pio", "test", "-e", "native", "-f", "test_bench"], cwd=tree, env=env,
+                              stdout=subprocess.DEVNULL)
+        with open(path) as f:
+            return records(f.read())
+    finally:
+        os.unlink(path)
+
+
+def avr_bench(tree):
+    subprocess.check_call(["pio", "run", "-e", "bench"], cwd=tree, stdout=subprocess.DEVNULL)
+    elf = os.path.join(tree, ".pio", "build", "bench", "firmware.elf")
+    run = subprocess.run(["simavr", "-m", "atmega328p", "-f", "16000000", elf], cwd=tree,
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT, timeout=SIMAVR_TIMEOUT)
+    return records(run.stdout.decode(errors="replace"))
+
+
+def bench(sha, avr):
+    tree = tempfile.mkdtemp(prefix="bench-")
+    try:
+        git("worktree", "add", "--detach", tree, sha)
+        result = {"commit": sha, "subject": git("log", "-1", "--format=%s", sha)}
+        result["host_ns"] = host_bench(tree)
+        if avr:
+            result["avr_cycles"] = avr_bench(tree)
+        return result
+    finally:
+        git("worktree", "remove", "--force", tree)
+        shutil.rmtree(tree, ignore_errors=True)
+
+
+def compare(path):
+    with open(path) as f:
+        runs = [json.loads(line) for line in f if line.strip()]
+    if len(runs) < 2:
+        sys.exit("need two runs in %s" % path)
+    old, new = runs[-2], runs[-1]
+    print("%s -> %s" % (old["commit"][:10], new["commit"][:10]))
+    for key in ("avr_cycles", "host_ns"):
+        ref = {(r["fn"], r["exp"]): r["mean"] for r in old.get(key, [])}
+        for r in new.get(key, []):
+            m = ref.get((r["fn"], r["exp"]))
+            if m:
+                print("%-11s %-20s %-4s %10.1f %+7.1f%%" % (key, r["fn"], r["exp"], r["mean"],
+                                                           100.0 * (r["mean"] - m) / m))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("revs", nargs="*", help="commits or rev ranges (default HEAD)")
+    ap.add_argument("--avr", action="store_true", help="also run the target build under simavr")
+    ap.add_argument("--out", default="bench.jsonl", help="results, one JSON line per commit appended")
+    ap.add_argument("--compare", metavar="FILE", help="print the change of the last two runs in FILE")
+    args = ap.parse_args()
+    if args.compare:
+        compare(args.compare)
+        return
+    for sha in commits(args.revs):
+        result = bench(sha, args.avr)
+        with open(args.out, "a") as f:
+            f.write(json.dumps(result) + "\n")
+        print("%s %s: %d host, %d avr results" % (sha[:10], result["subject"], len(result["host_ns"]),
+                                                  len(result.get("avr_cycles", []))))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,81 @@
+# PlatformIO extra script: SRAM / flash usage report
+#
+# Every build: prints static SRAM and flash usage of the firmware and fails
+# the build if either exceeds the budget set in platformio.ini
+# (custom_sram_budget / custom_flash_budget, bytes).
+#
+# pio run -t memreport: detailed report, usage per section and the largest
+# RAM and flash symbols.
+
+Import("env")
+
+import subprocess
+
+ELF = "$BUILD_DIR/${PROGNAME}.elf"
+N_SYMBOLS = 15
+
+
+def tool(name):
+    # avr-size -> avr-nm etc., same toolchain prefix
+    return env.subst("$SIZETOOL").replace("size", name)
+
+
+def sections(elf):
+    out = subprocess.check_output([tool("size"), "-A", elf]).decode()
+    sizes = {}
+    for line in out.splitlines():
+        cols = line.split()
+        if len(cols) >= 2 and cols[0].startswith(".") and cols[1].isdigit():
+            sizes[cols[0]] = int(cols[1])
+    return sizes
+
+
+def usage(elf):
+    s = sections(elf)
+    flash = s.get(".text", 0) + s.get(".data", 0)
+    sram = s.get(".data", 0) + s.get(".bss", 0) + s.get(".noinit", 0)
+    return sram, flash
+
+
+def budget(option, default):
+    return int(env.GetProjectOption(option, default))
+
+
+def check_budget(target, source, env):
+    elf = env.subst(ELF)
+    sram, flash = usage(elf)
+    sram_max = budget("custom_sram_budget", env.BoardConfig().get("upload.maximum_ram_size"))
+    flash_max = budget("custom_flash_budget", env.BoardConfig().get("upload.maximum_size"))
+    print("Memory budget: SRAM %d / %d bytes, flash %d / %d bytes" % (sram, sram_max, flash, flash_max))
+    if sram > sram_max or flash > flash_max:
+        print("Error: memory budget exceeded")
+        return 1
+    return 0
+
+
+def report(target, source, env):
+    elf = env.subst(ELF)
+    for name, size in sorted(sections(elf).items()):
+        print("%-12s %6d" % (name, size))
+    out = subprocess.check_output([tool("nm"), "-S", "--size-sort", "-C", elf]).decode()
+    ram, rom = [], []
+    for line in out.splitlines():
+        cols = line.split(None, 3)
+        if len(cols) < 4:
+            continue
+        size, kind, name = int(cols[1], 16), cols[2], cols[3]
+        (ram if kind in "bBdD" else rom).append((size, name))
+    for title, syms in (("SRAM", ram), ("Flash", rom)):
+        print("\nLargest %s symbols:" % title)
+        for size, name in sorted(syms, reverse=True)[:N_SYMBOLS]:
+            print("%6d  %s" % (size, name))
+    return check_budget(target, source, env)
+
+
+env.AddPostAction(ELF, check_budget)
+env.AddCustomTarget(
+    name="memreport",
+    dependencies=ELF,
+    actions=report,
+    title="Memory Report",
+    description="SRAM/flash usage per section and largest symbols")